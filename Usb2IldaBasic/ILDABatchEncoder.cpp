@@ -0,0 +1,262 @@
+#include "ILDABatchEncoder.h"
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+//Widest vector path the compiler was allowed to emit
+#if defined(__AVX2__)
+   #define ILDA_ENCODER_AVX2
+   #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #define ILDA_ENCODER_SSE2
+   #include <emmintrin.h>
+#endif
+
+//Widest volts (magnitude or offset) the vector paths take, fixed point stays inside 32 bit lanes
+const double g_ILDAEncoderVectorVoltsMax = 120.0;
+
+#if defined(ILDA_ENCODER_AVX2)
+//Four samples of ILDACodeConverter::ToCode before the maxCode clamp (magnitudes already clamped)
+static inline __m128i ILDAFixedToCodes( __m256d magnitude, int fixedBias, unsigned long long scale )
+{
+	__m256d scaled = _mm256_add_pd( _mm256_mul_pd( magnitude, _mm256_set1_pd( ILDACodeConverter::GetFixedVoltOne() ) ), _mm256_set1_pd( 0.5 ) );
+	__m128i fixed = _mm_sub_epi32( _mm256_cvttpd_epi32( scaled ), _mm_set1_epi32( fixedBias ) );
+	__m256i code = _mm256_mul_epu32( _mm256_cvtepu32_epi64( fixed ), _mm256_set1_epi64x( (long long) scale ) );
+	code = _mm256_srli_epi64( code, ILDA_CONVERTER_VOLT_BITS + ILDA_CONVERTER_FRAC_BITS );
+	return _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( code, _mm256_setr_epi32( 0, 2, 4, 6, 0, 2, 4, 6 ) ) );
+}
+#elif defined(ILDA_ENCODER_SSE2)
+//Two samples of ILDACodeConverter::ToCode (lanes 0 and 1) before the maxCode clamp
+static inline __m128i ILDAFixedToCodes( __m128d magnitude, int fixedBias, unsigned long long scale )
+{
+	__m128d scaled = _mm_add_pd( _mm_mul_pd( magnitude, _mm_set1_pd( ILDACodeConverter::GetFixedVoltOne() ) ), _mm_set1_pd( 0.5 ) );
+	__m128i fixed = _mm_sub_epi32( _mm_cvttpd_epi32( scaled ), _mm_set1_epi32( fixedBias ) );
+	__m128i code = _mm_mul_epu32( _mm_unpacklo_epi32( fixed, _mm_setzero_si128() ), _mm_set1_epi64x( (long long) scale ) );
+	code = _mm_srli_epi64( code, ILDA_CONVERTER_VOLT_BITS + ILDA_CONVERTER_FRAC_BITS );
+	return _mm_shuffle_epi32( code, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+}
+#endif
+
+//Benchmark waveform (a tilted Lissajous with a colour ramp)
+const double g_ILDABenchmarkTiltVolts = 8.0;
+const double g_ILDABenchmarkColorVolts = 4.0;
+
+
+/************************************************************
+ILDABatchEncoder Implementation
+*************************************************************/
+ILDABatchEncoder::ILDABatchEncoder() :
+	vectorExact_(true),
+	tiltControl_(0)
+{
+	for( int c = 0; c < encoderChannelTotal; c++ )
+	{
+		voltageMin_[c] = 0;
+		saturateVolts_[c] = 0;
+		fixedBias_[c] = -1;
+		scale_[c] = 0;
+		maxCode_[c] = 0;
+		bipolar_[c] = false;
+	}
+}
+
+void ILDABatchEncoder::Configure( const ILDACodeConverter * const converters[encoderChannelTotal], unsigned char tiltControl )
+{
+	tiltControl_ = tiltControl;
+	vectorExact_ = true;
+	for( int c = 0; c < encoderChannelTotal; c++ )
+	{
+		converters_[c] = *converters[c];
+		voltageMin_[c] = converters[c]->GetVoltageMin();
+		saturateVolts_[c] = converters[c]->GetSaturateVolts();
+		fixedBias_[c] = (int) (converters[c]->GetFixedOffset() - 1);
+		scale_[c] = converters[c]->GetFixedScale();
+		maxCode_[c] = (int) converters[c]->GetMaxCode();
+		bipolar_[c] = converters[c]->IsBipolar();
+
+		vectorExact_ = vectorExact_ && scale_[c] <= 0xFFFFFFFFULL && saturateVolts_[c] < g_ILDAEncoderVectorVoltsMax &&
+			voltageMin_[c] > -g_ILDAEncoderVectorVoltsMax && voltageMin_[c] <= saturateVolts_[c];
+	}
+}
+
+const char* ILDABatchEncoder::GetInstructionSet( void)
+{
+#if defined(ILDA_ENCODER_AVX2)
+	return "AVX2";
+#elif defined(ILDA_ENCODER_SSE2)
+	return "SSE2";
+#else
+	return "Scalar";
+#endif
+}
+
+//Byte order is fixed by shifts, so the host endianness never reaches the wire
+void ILDABatchEncoder::Pack( const int codes[encoderChannelTotal], unsigned char signs, ILDAEncodedSample& out ) const
+{
+	for( int axis = 0; axis < ILDA_ENCODER_TILT_CHANNELS; axis++ )
+	{
+		out.tilt[axis][0] = tiltControl_;
+		out.tilt[axis][1] = (unsigned char) ((codes[encoderX + axis] >> 8) & 0xFF);
+		out.tilt[axis][2] = (unsigned char) (codes[encoderX + axis] & 0xFF);
+	}
+
+	for( int color = 0; color < ILDA_ENCODER_COLOR_CHANNELS; color++ )
+	{
+		out.color[color * 2] = (unsigned char) ((codes[encoderRed + color] >> 8) & 0x0F);
+		out.color[color * 2 + 1] = (unsigned char) (codes[encoderRed + color] & 0xFF);
+	}
+
+	out.signs = signs;
+}
+
+void ILDABatchEncoder::EncodeScalar( const float * const channels[encoderChannelTotal], unsigned int first, unsigned int count, ILDAEncodedSample * out ) const
+{
+	for( unsigned int i = first; i < first + count; i++ )
+	{
+		int codes[encoderChannelTotal];
+		unsigned char signs = 0;
+		for( int c = 0; c < encoderChannelTotal; c++ )
+		{
+			bool neg;
+			codes[c] = (int) converters_[c].ToCode( (double) channels[c][i], neg );
+			if( neg && codes[c] != 0 )
+			{
+				signs |= (unsigned char) (1 << (c - encoderX));
+			}
+		}
+		Pack( codes, signs, out[i] );
+	}
+}
+
+void ILDABatchEncoder::Encode( const float * const channels[encoderChannelTotal], unsigned int count, ILDAEncodedSample * out ) const
+{
+	unsigned int i = 0;
+
+#if defined(ILDA_ENCODER_AVX2)
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 absMask = _mm256_castsi256_ps( _mm256_set1_epi32( 0x7FFFFFFF ) );
+	for( ; vectorExact_ && i + 8 <= count; i += 8 )
+	{
+		int codes[encoderChannelTotal][8];
+		int negMask[ILDA_ENCODER_TILT_CHANNELS] = { 0, 0 };
+		for( int c = 0; c < encoderChannelTotal; c++ )
+		{
+			__m256 v = _mm256_loadu_ps( channels[c] + i );
+			__m256 magnitude = (bipolar_[c]) ? _mm256_and_ps( v, absMask ) : v;
+			__m256d low = _mm256_cvtps_pd( _mm256_castps256_ps128( magnitude ) );
+			__m256d high = _mm256_cvtps_pd( _mm256_extractf128_ps( magnitude, 1 ) );
+			const __m256d minVolts = _mm256_set1_pd( voltageMin_[c] );
+			const __m256d maxVolts = _mm256_set1_pd( saturateVolts_[c] );
+			low = _mm256_min_pd( _mm256_max_pd( low, minVolts ), maxVolts );
+			high = _mm256_min_pd( _mm256_max_pd( high, minVolts ), maxVolts );
+			__m256i code = _mm256_inserti128_si256( _mm256_castsi128_si256( ILDAFixedToCodes( low, fixedBias_[c], scale_[c] ) ),
+				ILDAFixedToCodes( high, fixedBias_[c], scale_[c] ), 1 );
+			code = _mm256_min_epi32( code, _mm256_set1_epi32( maxCode_[c] ) );
+			_mm256_storeu_si256( (__m256i *) codes[c], code );
+
+			if( c < ILDA_ENCODER_TILT_CHANNELS && bipolar_[c] )
+			{
+				__m256 nonZero = _mm256_castsi256_ps( _mm256_cmpgt_epi32( code, _mm256_setzero_si256() ) );
+				negMask[c] = _mm256_movemask_ps( _mm256_and_ps( _mm256_cmp_ps( v, zero, _CMP_LT_OQ ), nonZero ) );
+			}
+		}
+
+		for( int k = 0; k < 8; k++ )
+		{
+			int sample[encoderChannelTotal];
+			for( int c = 0; c < encoderChannelTotal; c++ )
+			{
+				sample[c] = codes[c][k];
+			}
+			unsigned char signs = (unsigned char) (((negMask[0] >> k) & 1) | (((negMask[1] >> k) & 1) << 1));
+			Pack( sample, signs, out[i + k] );
+		}
+	}
+#elif defined(ILDA_ENCODER_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7FFFFFFF ) );
+	for( ; vectorExact_ && i + 4 <= count; i += 4 )
+	{
+		int codes[encoderChannelTotal][4];
+		int negMask[ILDA_ENCODER_TILT_CHANNELS] = { 0, 0 };
+		for( int c = 0; c < encoderChannelTotal; c++ )
+		{
+			__m128 v = _mm_loadu_ps( channels[c] + i );
+			__m128 magnitude = (bipolar_[c]) ? _mm_and_ps( v, absMask ) : v;
+			__m128d low = _mm_cvtps_pd( magnitude );
+			__m128d high = _mm_cvtps_pd( _mm_movehl_ps( magnitude, magnitude ) );
+			const __m128d minVolts = _mm_set1_pd( voltageMin_[c] );
+			const __m128d maxVolts = _mm_set1_pd( saturateVolts_[c] );
+			low = _mm_min_pd( _mm_max_pd( low, minVolts ), maxVolts );
+			high = _mm_min_pd( _mm_max_pd( high, minVolts ), maxVolts );
+			__m128i code = _mm_unpacklo_epi64( ILDAFixedToCodes( low, fixedBias_[c], scale_[c] ), ILDAFixedToCodes( high, fixedBias_[c], scale_[c] ) );
+			//SSE2 has no 32 bit min
+			const __m128i maxCode = _mm_set1_epi32( maxCode_[c] );
+			__m128i over = _mm_cmpgt_epi32( code, maxCode );
+			code = _mm_or_si128( _mm_and_si128( over, maxCode ), _mm_andnot_si128( over, code ) );
+			_mm_storeu_si128( (__m128i *) codes[c], code );
+
+			if( c < ILDA_ENCODER_TILT_CHANNELS && bipolar_[c] )
+			{
+				__m128 nonZero = _mm_castsi128_ps( _mm_cmpgt_epi32( code, _mm_setzero_si128() ) );
+				negMask[c] = _mm_movemask_ps( _mm_and_ps( _mm_cmplt_ps( v, zero ), nonZero ) );
+			}
+		}
+
+		for( int k = 0; k < 4; k++ )
+		{
+			int sample[encoderChannelTotal];
+			for( int c = 0; c < encoderChannelTotal; c++ )
+			{
+				sample[c] = codes[c][k];
+			}
+			unsigned char signs = (unsigned char) (((negMask[0] >> k) & 1) | (((negMask[1] >> k) & 1) << 1));
+			Pack( sample, signs, out[i + k] );
+		}
+	}
+#endif
+
+	//Tail (or everything on a scalar build)
+	EncodeScalar( channels, i, count - i, out );
+}
+
+double ILDABatchEncoder::Benchmark( unsigned int samples, double minMs ) const
+{
+	if( samples == 0 )
+	{
+		return 0;
+	}
+
+	std::vector<float> waveform( samples * encoderChannelTotal );
+	const float * channels[encoderChannelTotal];
+	for( int c = 0; c < encoderChannelTotal; c++ )
+	{
+		channels[c] = &waveform[c * samples];
+	}
+
+	for( unsigned int i = 0; i < samples; i++ )
+	{
+		double phase = 2 * 3.14159265358979 * i / samples;
+		waveform[encoderX * samples + i] = (float) (g_ILDABenchmarkTiltVolts * sin( 3 * phase ));
+		waveform[encoderY * samples + i] = (float) (g_ILDABenchmarkTiltVolts * sin( 2 * phase ));
+		for( int c = encoderRed; c < encoderChannelTotal; c++ )
+		{
+			waveform[c * samples + i] = (float) (g_ILDABenchmarkColorVolts * ((i + c) % samples) / samples);
+		}
+	}
+
+	std::vector<ILDAEncodedSample> encoded( samples );
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	double elapsedMs = 0;
+	unsigned long long encodedTotal = 0;
+	do
+	{
+		Encode( channels, samples, &encoded[0] );
+		encodedTotal += samples;
+		elapsedMs = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+	} while( elapsedMs < minMs );
+
+	return (elapsedMs > 0) ? encodedTotal * 1000.0 / elapsedMs : 0;
+}
@@ -0,0 +1,72 @@
+#ifndef _ILDA_BATCH_ENCODER_H_
+#define _ILDA_BATCH_ENCODER_H_
+
+#include "ILDACodeConverter.h"
+
+//Batch Encoder From Float Waveforms To Bus Payloads
+//Input is structure-of-arrays volts (x, y, r, g, b). The volts to code step runs
+//8 samples wide with AVX2, 4 wide with SSE2, and falls back to scalar code otherwise.
+//Every path repeats ILDACodeConverter::ToCode bit for bit (samples are widened to double and
+//go through the same fixed point), so a batch encoded point matches a single write exactly.
+//Channels whose fixed point does not fit 32 bit lanes are encoded by the scalar path.
+//Output per sample is the two DAC8571 frames, the MCP4728 fast-write payload for
+//R/G/B and the tilt sign bits, ready to hand to the transport.
+
+enum ILDAEncoderChannel{
+	encoderX = 0,
+	encoderY,
+	encoderRed,
+	encoderGreen,
+	encoderBlue,
+
+	encoderChannelTotal
+};
+
+#define ILDA_ENCODER_TILT_CHANNELS 2
+#define ILDA_ENCODER_COLOR_CHANNELS 3
+
+//Wire-ready frames for one sample (all codes big endian)
+struct ILDAEncodedSample
+{
+	unsigned char tilt[ILDA_ENCODER_TILT_CHANNELS][3];    //DAC8571: control, code high, code low
+	unsigned char color[ILDA_ENCODER_COLOR_CHANNELS * 2]; //MCP4728 fast write, channels A-C
+	unsigned char signs;                                  //bit per tilt axis, set while negative
+};
+
+class ILDABatchEncoder
+{
+	public:
+		ILDABatchEncoder();
+		~ILDABatchEncoder() {};
+
+	//Takes the scale of each channel from its conversion table
+	void Configure( const ILDACodeConverter * const converters[encoderChannelTotal], unsigned char tiltControl );
+
+	void Encode( const float * const channels[encoderChannelTotal], unsigned int count, ILDAEncodedSample * out ) const;
+
+	//Widest path compiled in ("AVX2", "SSE2" or "Scalar")
+	static const char* GetInstructionSet( void);
+
+	//Encodes a synthetic waveform for at least minMs and returns samples per second
+	double Benchmark( unsigned int samples, double minMs ) const;
+
+	protected:
+	  void EncodeScalar( const float * const channels[encoderChannelTotal], unsigned int first, unsigned int count, ILDAEncodedSample * out ) const;
+	  void Pack( const int codes[encoderChannelTotal], unsigned char signs, ILDAEncodedSample& out ) const;
+
+	  //Scalar path and tail
+	  ILDACodeConverter converters_[encoderChannelTotal];
+
+	  //Vector copies of each converter's fixed point (magnitudes are clamped to
+	  //[voltageMin_, saturateVolts_], where ToCode gives 0 and maxCode_)
+	  double voltageMin_[encoderChannelTotal];
+	  double saturateVolts_[encoderChannelTotal];
+	  int fixedBias_[encoderChannelTotal];          //fixed-point offset less the one unit bias
+	  unsigned long long scale_[encoderChannelTotal];
+	  int maxCode_[encoderChannelTotal];
+	  bool bipolar_[encoderChannelTotal];
+	  bool vectorExact_;
+	  unsigned char tiltControl_;
+};
+
+#endif //_ILDA_BATCH_ENCODER_H_
@@ -0,0 +1,150 @@
+#ifndef _ILDA_BUS_QUEUE_H_
+#define _ILDA_BUS_QUEUE_H_
+
+#include <atomic>
+#include <cstring>
+
+//Largest single bus frame carried by a queued command (MCP4728 multi-channel frames fit)
+#define ILDA_BUS_MAX_PAYLOAD 16
+
+//Devices Whose Pending Bus Work Is Tracked Separately (drives each device's Busy())
+enum ILDABusClient{
+	hubClient = 0,
+	red637Client,
+	green532Client,
+	blue445Client,
+	shutterClient,
+	xTiltClient,
+	yTiltClient,
+	galvoClient,
+	playerClient,
+
+	busClientTotal
+};
+
+//Scheduling Classes, Highest First
+//The worker always drains a higher class before touching a lower one
+enum ILDABusPriority{
+	safetyPriority = 0,    //frames that write the shutter output and nothing else
+	interactivePriority,   //single property sets
+	bulkPriority,          //streamed scan and pattern points
+
+	busPriorityTotal
+};
+
+//One Unit Of Bus Work
+//Fixed size so that queuing never touches the heap
+struct ILDABusCommand
+{
+	enum Kind {
+		i2cWrite = 0,
+		gpioWrite,
+		tiltUpdate,  //address = TiltDirection, value read from the hub's latest-value slot
+		tiltXY,      //data = X code, Y code (big endian), sign bits
+		tiltSigned,  //address = TiltDirection, data = code (big endian), sign, control byte
+
+		kindTotal
+	};
+
+	unsigned char kind;
+	unsigned char client;
+	unsigned char address;
+	unsigned char dataLen;
+	unsigned short shadowMask;  //hub shadow registers to invalidate if the write fails
+	unsigned char priority;     //ILDABusPriority, assigned by ILDAHub::Submit
+	unsigned int sequence;      //submission order across all classes
+	long long submitUs;         //steady clock at submission, for wait metrics
+	int retries;
+	unsigned char data[ILDA_BUS_MAX_PAYLOAD];
+};
+
+//Bounded Multi-Producer/Single-Consumer Ring
+//Each slot carries a sequence number so producers claim slots with one CAS
+//and the consumer never blocks a producer (D. Vyukov's bounded queue).
+//Capacity must be a power of two.
+template< unsigned int Capacity >
+class ILDABusQueue
+{
+	public:
+		ILDABusQueue() : enqueuePos_(0), dequeuePos_(0)
+		{
+			for( unsigned int i = 0; i < Capacity; i++ )
+			{
+				slots_[i].sequence.store( i );
+			}
+		};
+		~ILDABusQueue() {};
+
+	//Returns false when the ring is full
+	bool Push( const ILDABusCommand& cmd )
+	{
+		Slot* slot;
+		unsigned int pos = enqueuePos_.load();
+		for(;;)
+		{
+			slot = &slots_[ pos & (Capacity - 1) ];
+			unsigned int seq = slot->sequence.load();
+			int diff = (int) seq - (int) pos;
+			if( diff == 0 )
+			{
+				if( enqueuePos_.compare_exchange_weak( pos, pos + 1 ) )
+				{
+					break;
+				}
+			}
+			else if( diff < 0 )
+			{
+				return false;
+			}
+			else
+			{
+				pos = enqueuePos_.load();
+			}
+		}
+
+		slot->cmd = cmd;
+		slot->sequence.store( pos + 1 );
+		return true;
+	};
+
+	//Single consumer only (the hub worker)
+	bool Pop( ILDABusCommand& cmd )
+	{
+		unsigned int pos = dequeuePos_.load();
+		Slot* slot = &slots_[ pos & (Capacity - 1) ];
+		unsigned int seq = slot->sequence.load();
+		if( (int) seq - (int) (pos + 1) < 0 )
+		{
+			return false;
+		}
+
+		cmd = slot->cmd;
+		dequeuePos_.store( pos + 1 );
+		slot->sequence.store( pos + Capacity );
+		return true;
+	};
+
+	bool Empty( void) const
+	{
+		unsigned int pos = dequeuePos_.load();
+		return (int) slots_[ pos & (Capacity - 1) ].sequence.load() - (int) (pos + 1) < 0;
+	};
+
+	unsigned int Size( void) const
+	{
+		return enqueuePos_.load() - dequeuePos_.load();
+	};
+
+	private:
+	  struct Slot
+	  {
+		  std::atomic<unsigned int> sequence;
+		  ILDABusCommand cmd;
+	  };
+
+	  Slot slots_[Capacity];
+	  std::atomic<unsigned int> enqueuePos_;
+	  std::atomic<unsigned int> dequeuePos_;
+};
+
+#endif //_ILDA_BUS_QUEUE_H_
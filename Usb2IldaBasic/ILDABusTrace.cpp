@@ -0,0 +1,216 @@
+#include "ILDABusTrace.h"
+#include "ILDABusQueue.h"
+#include <cstdio>
+
+//File Identification
+const char g_ILDATraceMagic[8] = { 'I', 'L', 'D', 'A', 'T', 'R', 'C', '1' };
+
+//Trace row names (ILDABusClient order, matching the adapter device names)
+const char* g_ILDATraceClientNames[busClientTotal] = { "ILDA-Hub", "Red-Laser-637nm", "Green-Laser-532nm",
+	"Blue-Laser-445nm", "System-Shutter", "X-Tilt", "Y-Tilt", "XY-Galvo", "ILDA-Player" };
+
+const char* g_ILDATraceKindNames[traceKindTotal] = { "I2C Write", "GPIO Write", "I2C Read", "GPIO Read" };
+
+const char* g_ILDATraceResultText[ildaTraceResultTotal] = {
+	"OK",
+	"Trace file could not be opened",
+	"Trace file could not be written",
+	"Not a bus trace file",
+	"Trace file is truncated"
+};
+
+//Little-endian field packing, independent of the host layout
+static void ILDAPutU32( unsigned char * p, unsigned int v )
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = (v >> 24) & 0xFF;
+}
+
+static unsigned int ILDAGetU32( const unsigned char * p )
+{
+	return (unsigned int) p[0] | ((unsigned int) p[1] << 8) | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+//Start as integer nanoseconds (exact for ~584 years), duration as float bits
+static void ILDAPackRecord( const ILDATraceRecord& r, unsigned char * p )
+{
+	unsigned long long startNs = (r.startUs > 0) ? (unsigned long long) (r.startUs * 1000) : 0;
+	ILDAPutU32( p, (unsigned int) (startNs & 0xFFFFFFFF) );
+	ILDAPutU32( p + 4, (unsigned int) (startNs >> 32) );
+	unsigned int duration;
+	memcpy( &duration, &r.durationUs, 4 );
+	ILDAPutU32( p + 8, duration );
+	ILDAPutU32( p + 12, (unsigned int) r.result );
+	p[16] = r.kind;
+	p[17] = r.client;
+	p[18] = r.address;
+	p[19] = r.dataLen;
+	p[20] = r.attempt;
+	p[21] = p[22] = p[23] = 0;
+	memcpy( p + 24, r.data, ILDA_TRACE_PAYLOAD );
+}
+
+static void ILDAUnpackRecord( const unsigned char * p, ILDATraceRecord& r )
+{
+	unsigned long long startNs = (unsigned long long) ILDAGetU32( p ) | ((unsigned long long) ILDAGetU32( p + 4 ) << 32);
+	r.startUs = startNs / 1000.0;
+	unsigned int duration = ILDAGetU32( p + 8 );
+	memcpy( &r.durationUs, &duration, 4 );
+	r.result = (int) ILDAGetU32( p + 12 );
+	r.kind = p[16];
+	r.client = p[17];
+	r.address = p[18];
+	r.dataLen = p[19];
+	r.attempt = p[20];
+	memcpy( r.data, p + 24, ILDA_TRACE_PAYLOAD );
+}
+
+
+/************************************************************
+ILDABusTrace Implementation
+*************************************************************/
+unsigned long ILDABusTrace::GetCount( void) const
+{
+	unsigned long total = next_.load();
+	return (total < ILDA_TRACE_CAPACITY) ? total : ILDA_TRACE_CAPACITY;
+}
+
+void ILDABusTrace::Snapshot( std::vector<ILDATraceRecord>& records ) const
+{
+	unsigned long total = next_.load();
+	unsigned long count = GetCount();
+
+	records.resize( count );
+	for( unsigned long i = 0; i < count; i++ )
+	{
+		records[i] = records_[ (total - count + i) & (ILDA_TRACE_CAPACITY - 1) ];
+	}
+}
+
+int ILDABusTrace::Save( const char * path, const std::vector<ILDATraceRecord>& records )
+{
+	FILE * file = fopen( path, "wb" );
+	if( !file )
+	{
+		return ildaTraceOpenFailed;
+	}
+
+	unsigned char header[16];
+	memcpy( header, g_ILDATraceMagic, 8 );
+	ILDAPutU32( header + 8, (unsigned int) records.size() );
+	ILDAPutU32( header + 12, ILDA_TRACE_RECORD_SIZE );
+	bool ok = fwrite( header, 1, sizeof(header), file ) == sizeof(header);
+
+	unsigned char packed[ILDA_TRACE_RECORD_SIZE];
+	for( size_t i = 0; i < records.size() && ok; i++ )
+	{
+		ILDAPackRecord( records[i], packed );
+		ok = fwrite( packed, 1, ILDA_TRACE_RECORD_SIZE, file ) == ILDA_TRACE_RECORD_SIZE;
+	}
+
+	ok = (fclose( file ) == 0) && ok;
+	return (ok) ? ildaTraceOk : ildaTraceWriteFailed;
+}
+
+//A truncated file still returns the whole records before the cut
+int ILDABusTrace::Load( const char * tracePath, std::vector<ILDATraceRecord>& records )
+{
+	records.clear();
+	FILE * in = fopen( tracePath, "rb" );
+	if( !in )
+	{
+		return ildaTraceOpenFailed;
+	}
+
+	unsigned char header[16];
+	if( fread( header, 1, sizeof(header), in ) != sizeof(header) || memcmp( header, g_ILDATraceMagic, 8 ) != 0 ||
+		ILDAGetU32( header + 12 ) != ILDA_TRACE_RECORD_SIZE )
+	{
+		fclose( in );
+		return ildaTraceBadHeader;
+	}
+	unsigned int count = ILDAGetU32( header + 8 );
+
+	int ret = ildaTraceOk;
+	records.reserve( (count < ILDA_TRACE_CAPACITY) ? count : ILDA_TRACE_CAPACITY );
+	unsigned char packed[ILDA_TRACE_RECORD_SIZE];
+	for( unsigned int i = 0; i < count; i++ )
+	{
+		if( fread( packed, 1, ILDA_TRACE_RECORD_SIZE, in ) != ILDA_TRACE_RECORD_SIZE )
+		{
+			ret = ildaTraceTruncated;
+			break;
+		}
+		records.push_back( ILDATraceRecord() );
+		ILDAUnpackRecord( packed, records.back() );
+	}
+
+	fclose( in );
+	return ret;
+}
+
+//Complete ("X") events, timestamps rebased so the trace starts at zero.
+//Rows (tid) are the devices, named with thread_name metadata events.
+int ILDABusTrace::ConvertToChromeTrace( const char * tracePath, const char * jsonPath )
+{
+	std::vector<ILDATraceRecord> records;
+	int ret = Load( tracePath, records );
+	if( ret != ildaTraceOk && ret != ildaTraceTruncated )
+	{
+		return ret;
+	}
+
+	FILE * out = fopen( jsonPath, "w" );
+	if( !out )
+	{
+		return ildaTraceOpenFailed;
+	}
+
+	fprintf( out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+	for( int client = 0; client < busClientTotal; client++ )
+	{
+		fprintf( out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+			client, g_ILDATraceClientNames[client] );
+	}
+
+	double originUs = (records.empty()) ? 0 : records[0].startUs;
+	for( size_t i = 0; i < records.size(); i++ )
+	{
+		const ILDATraceRecord& r = records[i];
+
+		char bytes[ILDA_TRACE_PAYLOAD * 3 + 1];
+		int shown = (r.dataLen < ILDA_TRACE_PAYLOAD) ? r.dataLen : ILDA_TRACE_PAYLOAD;
+		bytes[0] = '\0';
+		for( int b = 0; b < shown; b++ )
+		{
+			sprintf( bytes + b * 3, "%02X ", r.data[b] );
+		}
+		if( shown > 0 )
+		{
+			bytes[shown * 3 - 1] = '\0';
+		}
+		int client = (r.client < busClientTotal) ? (int) r.client : (int) hubClient;
+
+		const char * kind = (r.kind < traceKindTotal) ? g_ILDATraceKindNames[r.kind] : "Unknown";
+		fprintf( out, "{\"name\":\"%s 0x%02X\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+			"\"args\":{\"bytes\":\"%s\",\"length\":%d,\"attempt\":%d,\"result\":%d}},\n",
+			kind, r.address, (r.result == 0) ? "ok" : "failed", client, r.startUs - originUs, (double) r.durationUs,
+			bytes, (int) r.dataLen, (int) r.attempt, r.result );
+	}
+
+	//Metadata closes the array so every real event can end with a comma
+	fprintf( out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ILDA Bus\"}}\n]}\n" );
+
+	if( fclose( out ) != 0 && ret == ildaTraceOk )
+	{
+		ret = ildaTraceWriteFailed;
+	}
+	return ret;
+}
+
+const char* ILDABusTrace::GetResultText( int result )
+{
+	return (result >= 0 && result < ildaTraceResultTotal) ? g_ILDATraceResultText[result] : "Unknown trace error";
+}
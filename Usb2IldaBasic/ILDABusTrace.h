@@ -0,0 +1,101 @@
+#ifndef _ILDA_BUS_TRACE_H_
+#define _ILDA_BUS_TRACE_H_
+
+#include <vector>
+#include <atomic>
+#include <cstring>
+
+//Always-On Bus Transaction Recorder
+//Every transfer the hub makes lands in a fixed ring of plain records (one copy, no locks,
+//no allocation), the oldest being overwritten. Snapshot copies the ring out oldest first and
+//Save writes the copy to a compact little-endian file that ConvertToChromeTrace turns into Chrome trace JSON
+//(chrome://tracing or Perfetto: one row per device, one slice per transfer).
+//Single writer (the hub, under its bus lock).
+
+//Records kept (power of two, about 2.5 MB)
+#define ILDA_TRACE_CAPACITY 65536
+
+//Frame bytes kept per record (longer frames are cut, dataLen keeps the true length)
+#define ILDA_TRACE_PAYLOAD 16
+
+//File layout: 8 byte magic, record count (u32), record size (u32), then the records
+#define ILDA_TRACE_RECORD_SIZE 40
+
+enum ILDATraceKind{
+	traceI2cWrite = 0,
+	traceGpioWrite,
+	traceI2cRead,
+	traceGpioRead,
+
+	traceKindTotal
+};
+
+enum ILDATraceResult{
+	ildaTraceOk = 0,
+	ildaTraceOpenFailed,
+	ildaTraceWriteFailed,
+	ildaTraceBadHeader,
+	ildaTraceTruncated,
+
+	ildaTraceResultTotal
+};
+
+struct ILDATraceRecord
+{
+	double startUs;         //transport clock
+	float durationUs;
+	int result;             //transport return code, 0 on success
+	unsigned char kind;     //ILDATraceKind
+	unsigned char client;   //ILDABusClient the work was done for
+	unsigned char address;  //7-bit I2C address (0 for GPIO)
+	unsigned char dataLen;
+	unsigned char attempt;  //0 for the first try of a frame
+	unsigned char data[ILDA_TRACE_PAYLOAD];
+};
+
+class ILDABusTrace
+{
+	public:
+		ILDABusTrace() : records_(ILDA_TRACE_CAPACITY), next_(0) {};
+		~ILDABusTrace() {};
+
+	void Record( double startUs, double durationUs, int result, unsigned char kind, unsigned char client,
+		unsigned char address, const unsigned char * data, unsigned int dataLen, unsigned char attempt )
+	{
+		unsigned long next = next_.load();
+		ILDATraceRecord& r = records_[ next & (ILDA_TRACE_CAPACITY - 1) ];
+		r.startUs = startUs;
+		r.durationUs = (float) durationUs;
+		r.result = result;
+		r.kind = kind;
+		r.client = client;
+		r.address = address;
+		r.dataLen = (unsigned char) ((dataLen < 255) ? dataLen : 255);
+		r.attempt = attempt;
+		memcpy( r.data, data, (dataLen < ILDA_TRACE_PAYLOAD) ? dataLen : ILDA_TRACE_PAYLOAD );
+		next_.store( next + 1 );
+	};
+
+	//Records currently held (at most ILDA_TRACE_CAPACITY) and ever made
+	unsigned long GetCount( void) const;
+	unsigned long GetTotal( void) const { return next_.load(); };
+
+	//Copies the ring out oldest first. Caller keeps Record from running meanwhile (the hub
+	//holds its bus lock), the copy is then written by Save with no lock held
+	void Snapshot( std::vector<ILDATraceRecord>& records ) const;
+	static int Save( const char * path, const std::vector<ILDATraceRecord>& records );
+	void Clear( void) { next_.store( 0 ); };
+
+	//Reads a file written by Save (records oldest first)
+	static int Load( const char * tracePath, std::vector<ILDATraceRecord>& records );
+
+	//File written by Save to Chrome trace event JSON
+	static int ConvertToChromeTrace( const char * tracePath, const char * jsonPath );
+	static const char* GetResultText( int result );
+
+	protected:
+	  std::vector<ILDATraceRecord> records_;
+	  std::atomic<unsigned long> next_;
+};
+
+#endif //_ILDA_BUS_TRACE_H_
@@ -0,0 +1,372 @@
+#include "ILDAChipModels.h"
+#include <cstring>
+
+//MCP4728 Internal Reference (volts)
+const double g_ILDAMCP4728InternalVref = 2.048;
+
+//MCP4728 Command Groups (upper bits of the first byte)
+const unsigned char g_ILDAMCP4728FastMask = 0xC0;       //00xxxxxx
+const unsigned char g_ILDAMCP4728WriteMask = 0xF8;
+const unsigned char g_ILDAMCP4728MultiWrite = 0x40;     //01000 DAC1 DAC0 UDAC
+const unsigned char g_ILDAMCP4728SequentialWrite = 0x50;
+const unsigned char g_ILDAMCP4728SingleWrite = 0x58;
+const unsigned char g_ILDAMCP4728SelectMask = 0xE0;
+const unsigned char g_ILDAMCP4728SelectVref = 0x80;     //100x VA VB VC VD
+const unsigned char g_ILDAMCP4728SelectPowerDown = 0xA0;
+const unsigned char g_ILDAMCP4728SelectGain = 0xC0;
+
+//General Call Commands
+const unsigned char g_ILDAGeneralCallReset = 0x06;
+const unsigned char g_ILDAGeneralCallWakeUp = 0x09;
+
+//Readback status byte: RDY/BSY, POR
+const unsigned char g_ILDAMCP4728ReadyFlag = 0x80;
+const unsigned char g_ILDAMCP4728PorFlag = 0x40;
+
+//ACK time of data byte k: the address byte plus bytes 0..k have been clocked
+static double ILDAByteTime( double startUs, double bytePeriodUs, unsigned int k )
+{
+	return startUs + (k + 2) * bytePeriodUs;
+}
+
+
+/************************************************************
+ILDAOutputHistory Implementation
+*************************************************************/
+void ILDAOutputHistory::Add( double timeUs, unsigned char channel, double volts )
+{
+	ILDAOutputEvent e;
+	e.timeUs = timeUs;
+	e.channel = channel;
+	e.volts = volts;
+
+	if( events_.size() < ILDA_MODEL_HISTORY_MAX )
+	{
+		events_.push_back( e );
+	}
+	else
+	{
+		events_[ total_ & (ILDA_MODEL_HISTORY_MAX - 1) ] = e;
+	}
+	total_++;
+}
+
+//Until the ring wraps the oldest event is at 0, afterwards at the next slot to be written
+const ILDAOutputEvent& ILDAOutputHistory::GetEvent( unsigned long index ) const
+{
+	if( total_ <= ILDA_MODEL_HISTORY_MAX )
+	{
+		return events_[index];
+	}
+	return events_[ (total_ + index) & (ILDA_MODEL_HISTORY_MAX - 1) ];
+}
+
+
+/************************************************************
+ILDAMCP4728Model Implementation
+*************************************************************/
+ILDAMCP4728Model::ILDAMCP4728Model( unsigned char address, double vdd, double eepromWriteUs ) :
+	address_(address),
+	vdd_(vdd),
+	eepromWriteUs_(eepromWriteUs),
+	eepromReadyUs_(0)
+{
+	//Factory EEPROM: code 0, VDD reference, gain 1, normal mode
+	for( int i = 0; i < 4; i++ )
+	{
+		eeprom_[i].code = 0;
+		eeprom_[i].vref = false;
+		eeprom_[i].pd = 0;
+		eeprom_[i].gain = false;
+		outputs_[i] = 0;
+	}
+	Reset( 0 );
+}
+
+void ILDAMCP4728Model::Reset( double timeUs )
+{
+	for( int i = 0; i < 4; i++ )
+	{
+		input_[i] = eeprom_[i];
+		Update( i, timeUs );
+	}
+}
+
+//Upper byte: VREF PD1 PD0 Gx D11-D8
+void ILDAMCP4728Model::Decode( Register& reg, unsigned char upper, unsigned char lower )
+{
+	reg.vref = (upper & 0x80) != 0;
+	reg.pd = (upper >> 5) & 0x03;
+	reg.gain = (upper & 0x10) != 0;
+	reg.code = ((unsigned int) (upper & 0x0F) << 8) | lower;
+}
+
+void ILDAMCP4728Model::Encode( const Register& reg, unsigned char * bytes )
+{
+	bytes[0] = (unsigned char) (((reg.vref) ? 0x80 : 0) | (reg.pd << 5) | ((reg.gain) ? 0x10 : 0) | ((reg.code >> 8) & 0x0F));
+	bytes[1] = (unsigned char) (reg.code & 0xFF);
+}
+
+//Logged only when the output moves
+void ILDAMCP4728Model::Update( int channel, double timeUs )
+{
+	const Register& reg = input_[channel];
+	double reference = (reg.vref) ? g_ILDAMCP4728InternalVref * ((reg.gain) ? 2 : 1) : vdd_;
+	double volts = (reg.pd != 0) ? 0 : reference * reg.code / 4096;
+	if( volts != outputs_[channel] || history_.GetTotal() == 0 )
+	{
+		outputs_[channel] = volts;
+		history_.Add( timeUs, (unsigned char) channel, volts );
+	}
+}
+
+bool ILDAMCP4728Model::Write( unsigned char address, const unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs )
+{
+	if( address == 0x00 )
+	{
+		for( unsigned int i = 0; i < dataLen; i++ )
+		{
+			double timeUs = ILDAByteTime( startUs, bytePeriodUs, i );
+			if( data[i] == g_ILDAGeneralCallReset )
+			{
+				Reset( timeUs );
+			}
+			else if( data[i] == g_ILDAGeneralCallWakeUp )
+			{
+				for( int c = 0; c < 4; c++ )
+				{
+					input_[c].pd = 0;
+					Update( c, timeUs );
+				}
+			}
+		}
+		return true;
+	}
+
+	//No new writes while the EEPROM is being programmed
+	if( IsEepromBusy( startUs ) )
+	{
+		return false;
+	}
+
+	unsigned int i = 0;
+	while( i < dataLen )
+	{
+		unsigned char cmd = data[i];
+		int channel = (cmd >> 1) & 0x03;
+
+		if( (cmd & g_ILDAMCP4728FastMask) == 0 )
+		{
+			//Fast write: two bytes per channel from A, VREF and gain untouched
+			for( int c = 0; i + 1 < dataLen && (data[i] & g_ILDAMCP4728FastMask) == 0; c = (c + 1) & 0x03, i += 2 )
+			{
+				input_[c].pd = (data[i] >> 4) & 0x03;
+				input_[c].code = ((unsigned int) (data[i] & 0x0F) << 8) | data[i + 1];
+				Update( c, ILDAByteTime( startUs, bytePeriodUs, i + 1 ) );
+			}
+			break;
+		}
+		else if( (cmd & g_ILDAMCP4728WriteMask) == g_ILDAMCP4728MultiWrite )
+		{
+			if( i + 2 >= dataLen )
+			{
+				return false;
+			}
+			Decode( input_[channel], data[i + 1], data[i + 2] );
+			Update( channel, ILDAByteTime( startUs, bytePeriodUs, i + 2 ) );
+			i += 3;
+		}
+		else if( (cmd & g_ILDAMCP4728WriteMask) == g_ILDAMCP4728SequentialWrite )
+		{
+			//Starting channel through D, input registers and EEPROM
+			for( i++; channel < 4 && i + 1 < dataLen; channel++, i += 2 )
+			{
+				Decode( input_[channel], data[i], data[i + 1] );
+				eeprom_[channel] = input_[channel];
+				Update( channel, ILDAByteTime( startUs, bytePeriodUs, i + 1 ) );
+			}
+			eepromReadyUs_ = ILDAByteTime( startUs, bytePeriodUs, dataLen - 1 ) + eepromWriteUs_;
+			break;
+		}
+		else if( (cmd & g_ILDAMCP4728WriteMask) == g_ILDAMCP4728SingleWrite )
+		{
+			if( i + 2 >= dataLen )
+			{
+				return false;
+			}
+			Decode( input_[channel], data[i + 1], data[i + 2] );
+			eeprom_[channel] = input_[channel];
+			Update( channel, ILDAByteTime( startUs, bytePeriodUs, i + 2 ) );
+			eepromReadyUs_ = ILDAByteTime( startUs, bytePeriodUs, i + 2 ) + eepromWriteUs_;
+			break;
+		}
+		else if( (cmd & g_ILDAMCP4728SelectMask) == g_ILDAMCP4728SelectVref || (cmd & g_ILDAMCP4728SelectMask) == g_ILDAMCP4728SelectGain )
+		{
+			//Bit 3 is channel A
+			bool vref = (cmd & g_ILDAMCP4728SelectMask) == g_ILDAMCP4728SelectVref;
+			for( int c = 0; c < 4; c++ )
+			{
+				bool set = (cmd & (0x08 >> c)) != 0;
+				if( vref )
+				{
+					input_[c].vref = set;
+				}
+				else
+				{
+					input_[c].gain = set;
+				}
+				Update( c, ILDAByteTime( startUs, bytePeriodUs, i ) );
+			}
+			i++;
+		}
+		else if( (cmd & g_ILDAMCP4728SelectMask) == g_ILDAMCP4728SelectPowerDown )
+		{
+			//PDA PDB in the command byte, PDC PDD in the top of the next
+			if( i + 1 >= dataLen )
+			{
+				return false;
+			}
+			unsigned char bits[4] = { (unsigned char) ((cmd >> 2) & 0x03), (unsigned char) (cmd & 0x03),
+				(unsigned char) ((data[i + 1] >> 6) & 0x03), (unsigned char) ((data[i + 1] >> 4) & 0x03) };
+			for( int c = 0; c < 4; c++ )
+			{
+				input_[c].pd = bits[c];
+				Update( c, ILDAByteTime( startUs, bytePeriodUs, i + 1 ) );
+			}
+			i += 2;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//Six bytes per channel: status, input register, status, EEPROM
+bool ILDAMCP4728Model::Read( unsigned char address, unsigned char * data, unsigned int dataLen, double startUs, double /*bytePeriodUs*/ )
+{
+	if( address != address_ )
+	{
+		return false;
+	}
+
+	unsigned char image[24];
+	unsigned char status = (unsigned char) (((IsEepromBusy( startUs )) ? 0 : g_ILDAMCP4728ReadyFlag) | g_ILDAMCP4728PorFlag | (address_ & 0x07));
+	for( int c = 0; c < 4; c++ )
+	{
+		unsigned char * group = &image[c * 6];
+		group[0] = (unsigned char) (status | (c << 4));
+		Encode( input_[c], group + 1 );
+		group[3] = group[0];
+		Encode( eeprom_[c], group + 4 );
+	}
+
+	memcpy( data, image, (dataLen < sizeof(image)) ? dataLen : sizeof(image) );
+	if( dataLen > sizeof(image) )
+	{
+		memset( data + sizeof(image), 0xFF, dataLen - sizeof(image) );
+	}
+	return true;
+}
+
+
+/************************************************************
+ILDADac8571Model Implementation
+*************************************************************/
+ILDADac8571Model::ILDADac8571Model( unsigned char address, unsigned char broadcastAddress, double fullScale ) :
+	address_(address),
+	broadcast_(broadcastAddress),
+	fullScale_(fullScale),
+	temp_(0),
+	dac_(0),
+	powerDown_(0),
+	control_(0),
+	output_(0)
+{
+}
+
+void ILDADac8571Model::Update( double timeUs )
+{
+	double volts = (powerDown_ != 0) ? 0 : fullScale_ * dac_ / 65536;
+	if( volts != output_ || history_.GetTotal() == 0 )
+	{
+		output_ = volts;
+		history_.Add( timeUs, 0, volts );
+	}
+}
+
+//Control byte: 0 0 L1 L0 x BRCSEL PD0 0
+bool ILDADac8571Model::Write( unsigned char address, const unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs )
+{
+	if( dataLen == 0 )
+	{
+		return true;
+	}
+
+	control_ = data[0];
+	int load = (control_ >> 4) & 0x03;
+	bool powerDownSelect = (control_ & 0x02) != 0;
+
+	//Broadcast: BRCSEL picks between loading every DAC from its temporary register and
+	//taking the data word (store and load), the load bits are not used
+	if( address == broadcast_ && address != address_ )
+	{
+		load = (control_ & 0x04) ? 1 : 2;
+	}
+
+	//A load from the temporary register needs no data word
+	if( dataLen < 3 )
+	{
+		if( load == 2 )
+		{
+			dac_ = temp_;
+			Update( ILDAByteTime( startUs, bytePeriodUs, 0 ) );
+		}
+		return dataLen == 1;
+	}
+
+	for( unsigned int i = 1; i + 1 < dataLen; i += 2 )
+	{
+		unsigned int value = ((unsigned int) data[i] << 8) | data[i + 1];
+		double timeUs = ILDAByteTime( startUs, bytePeriodUs, i + 1 );
+		if( powerDownSelect )
+		{
+			powerDown_ = (data[i] >> 6) & 0x03;
+		}
+		else if( load == 0 )
+		{
+			temp_ = value;
+		}
+		else if( load == 1 )
+		{
+			temp_ = value;
+			dac_ = value;
+		}
+		else
+		{
+			//10 (and the reserved 11) latch the temporary register, the data word is ignored
+			dac_ = temp_;
+		}
+		Update( timeUs );
+	}
+
+	return true;
+}
+
+bool ILDADac8571Model::Read( unsigned char address, unsigned char * data, unsigned int dataLen, double /*startUs*/, double /*bytePeriodUs*/ )
+{
+	if( address != address_ )
+	{
+		return false;
+	}
+
+	unsigned char image[3] = { (unsigned char) (dac_ >> 8), (unsigned char) (dac_ & 0xFF), control_ };
+	memcpy( data, image, (dataLen < sizeof(image)) ? dataLen : sizeof(image) );
+	if( dataLen > sizeof(image) )
+	{
+		memset( data + sizeof(image), 0xFF, dataLen - sizeof(image) );
+	}
+	return true;
+}
@@ -0,0 +1,130 @@
+#ifndef _ILDA_CHIP_MODELS_H_
+#define _ILDA_CHIP_MODELS_H_
+
+#include <vector>
+#include "ILDATransport.h"
+
+//Byte-Level DAC Models For The Simulated Bridge
+//Each model decodes the exact I2C frames the adapter sends and keeps the register image a
+//readback returns. Every output change is logged at the simulated time of the ACK of the
+//byte that completes it, so the effect and the timing of any write path can be checked.
+//LDAC is taken as tied low (the MCP4728 outputs follow their input registers).
+
+//Most output events kept per model (power of two, the oldest are overwritten when full)
+#define ILDA_MODEL_HISTORY_MAX 1048576
+
+struct ILDAOutputEvent
+{
+	double timeUs;
+	unsigned char channel;
+	double volts;
+};
+
+//Shared output log, a ring that grows to ILDA_MODEL_HISTORY_MAX and then wraps
+class ILDAOutputHistory
+{
+	public:
+		ILDAOutputHistory() : total_(0) {};
+		~ILDAOutputHistory() {};
+
+	void Add( double timeUs, unsigned char channel, double volts );
+
+	//Events currently held (at most ILDA_MODEL_HISTORY_MAX) and ever added
+	unsigned long GetCount( void) const { return (unsigned long) events_.size(); };
+	unsigned long GetTotal( void) const { return total_; };
+
+	//Held event, 0 being the oldest
+	const ILDAOutputEvent& GetEvent( unsigned long index ) const;
+	void Clear( void) { events_.clear(); total_ = 0; };
+
+	protected:
+	  std::vector<ILDAOutputEvent> events_;
+	  unsigned long total_;
+};
+
+//MCP4728 Quad 12-bit DAC
+//Fast, multi, sequential and single writes, VREF/gain/power-down select commands,
+//general call reset/wake-up/software update, and the EEPROM busy window after a
+//sequential or single write (writes are NACKed until RDY returns).
+class ILDAMCP4728Model : public ILDAI2cDeviceModel
+{
+	public:
+		ILDAMCP4728Model( unsigned char address, double vdd = 5.0, double eepromWriteUs = 50000 );
+		~ILDAMCP4728Model() {};
+
+	bool Acknowledges( unsigned char address ) const { return address == address_ || address == 0x00; };
+	bool Write( unsigned char address, const unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs );
+	bool Read( unsigned char address, unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs );
+
+	//Power-on: input registers loaded from EEPROM
+	void Reset( double timeUs );
+
+	double GetOutput( int channel ) const { return outputs_[channel]; };
+	unsigned int GetCode( int channel ) const { return input_[channel].code; };
+	unsigned int GetEepromCode( int channel ) const { return eeprom_[channel].code; };
+	bool IsEepromBusy( double timeUs ) const { return timeUs < eepromReadyUs_; };
+	const ILDAOutputHistory& GetHistory( void) const { return history_; };
+	void ClearHistory( void) { history_.Clear(); };
+
+	protected:
+	  struct Register
+	  {
+		  unsigned int code;
+		  bool vref;           //internal 2.048 V reference
+		  unsigned char pd;    //power-down bits, 0 = normal
+		  bool gain;           //x2 (internal reference only)
+	  };
+
+	  static void Decode( Register& reg, unsigned char upper, unsigned char lower );
+	  static void Encode( const Register& reg, unsigned char * bytes );
+	  void Update( int channel, double timeUs );
+
+	  unsigned char address_;
+	  double vdd_;
+	  double eepromWriteUs_;
+	  double eepromReadyUs_;
+	  Register input_[4];
+	  Register eeprom_[4];
+	  double outputs_[4];
+	  ILDAOutputHistory history_;
+};
+
+//DAC8571 16-bit DAC
+//Control byte load bits: 00 store to the temporary register, 01 store and load the DAC,
+//10 load the DAC from the temporary register. PD0 selects power-down (mode in the top
+//two data bits). Repeated data words after one control byte are each applied.
+//The broadcast address reaches every DAC8571 on the bus. There BRCSEL 0 loads every DAC
+//from its own temporary register, BRCSEL 1 applies the data word (or power-down) to all.
+class ILDADac8571Model : public ILDAI2cDeviceModel
+{
+	public:
+		ILDADac8571Model( unsigned char address, unsigned char broadcastAddress, double fullScale );
+		~ILDADac8571Model() {};
+
+	bool Acknowledges( unsigned char address ) const { return address == address_ || address == broadcast_; };
+	bool Write( unsigned char address, const unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs );
+
+	//Readback: DAC register high, low, last control byte
+	bool Read( unsigned char address, unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs );
+
+	double GetOutput( void) const { return output_; };
+	unsigned int GetCode( void) const { return dac_; };
+	unsigned int GetTemporary( void) const { return temp_; };
+	const ILDAOutputHistory& GetHistory( void) const { return history_; };
+	void ClearHistory( void) { history_.Clear(); };
+
+	protected:
+	  void Update( double timeUs );
+
+	  unsigned char address_;
+	  unsigned char broadcast_;
+	  double fullScale_;    //volts at code 65536 (reference times any output gain)
+	  unsigned int temp_;
+	  unsigned int dac_;
+	  unsigned char powerDown_;
+	  unsigned char control_;
+	  double output_;
+	  ILDAOutputHistory history_;
+};
+
+#endif //_ILDA_CHIP_MODELS_H_
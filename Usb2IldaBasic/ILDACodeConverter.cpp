@@ -0,0 +1,74 @@
+#include "ILDACodeConverter.h"
+#include <cmath>
+
+const double ILDACodeConverter::voltOne_ = (double) (1LL << ILDA_CONVERTER_VOLT_BITS);
+const double ILDACodeConverter::fixedOne_ = (double) (1LL << ILDA_CONVERTER_FRAC_BITS);
+
+
+/************************************************************
+ILDACodeConverter Implementation
+*************************************************************/
+ILDACodeConverter::ILDACodeConverter() :
+	offset_(0),
+	scale_(0),
+	saturateVolts_(0),
+	maxCode_(0),
+	bipolar_(false),
+	voltageMin_(0),
+	increment_(0)
+{
+}
+
+void ILDACodeConverter::Configure( double voltageMin, double voltageMax, unsigned long resolution, bool bipolar )
+{
+	bipolar_ = bipolar;
+	voltageMin_ = voltageMin;
+	maxCode_ = (resolution > 0) ? (unsigned int) (resolution - 1) : 0;
+
+	double span = voltageMax - voltageMin;
+	if( span <= 0 || resolution == 0 )
+	{
+		//Degenerate channel, everything converts to 0
+		maxCode_ = 0;
+		increment_ = 0;
+		offset_ = 0;
+		scale_ = 0;
+		saturateVolts_ = 0;
+		return;
+	}
+
+	increment_ = span / resolution;
+	offset_ = (long long) floor( voltageMin * voltOne_ + 0.5 );
+	scale_ = (unsigned long long) ceil( resolution / span * fixedOne_ );
+
+	//Smallest fixed-point span whose code saturates (ToCode adds the one unit bias).
+	//Checked in integers, so the formula itself reaches maxCode_ at saturateVolts_.
+	long long fullScale = (long long) ceil( (double) maxCode_ * voltOne_ * fixedOne_ / scale_ ) - 1;
+	while( (((unsigned long long) (fullScale + 1) * scale_) >> (ILDA_CONVERTER_VOLT_BITS + ILDA_CONVERTER_FRAC_BITS)) < maxCode_ )
+	{
+		fullScale++;
+	}
+	saturateVolts_ = (offset_ + fullScale) / voltOne_;
+}
+
+//Plain loop over the inline conversion, written so the compiler can unroll it
+void ILDACodeConverter::ToCodes( const double * volts, unsigned int count, unsigned short * codes, unsigned char * negBits ) const
+{
+	if( negBits )
+	{
+		for( unsigned int i = 0; i < (count + 7) / 8; i++ )
+		{
+			negBits[i] = 0;
+		}
+	}
+
+	for( unsigned int i = 0; i < count; i++ )
+	{
+		bool neg;
+		codes[i] = (unsigned short) ToCode( volts[i], neg );
+		if( negBits && neg && codes[i] != 0 )
+		{
+			negBits[i >> 3] |= (unsigned char) (1 << (i & 7));
+		}
+	}
+}
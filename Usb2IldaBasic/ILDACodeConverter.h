@@ -0,0 +1,88 @@
+#ifndef _ILDA_CODE_CONVERTER_H_
+#define _ILDA_CODE_CONVERTER_H_
+
+//Fixed-Point Volts To DAC Code Conversion
+//Each channel precomputes its offset (Q.24 volts) and codes-per-volt (Q16.16) once (Configure),
+//after which a conversion is one multiply to fixed point, one integer multiply and a shift.
+//Codes truncate like the original (volts - min) / increment division and saturate at
+//0 and resolution - 1. Bipolar channels convert the magnitude and report the sign.
+//The scale is rounded up and the fixed-point volts are rounded and biased up by one unit,
+//so a voltage that is an exact multiple of the increment (ToVolts( k )) always converts back
+//to k; only inputs within about a thousandth of a code below a boundary are taken up to it.
+
+//Fractional bits of the fixed-point volts and scale
+//(the product stays below 2^57 for any input that does not saturate)
+#define ILDA_CONVERTER_VOLT_BITS 24
+#define ILDA_CONVERTER_FRAC_BITS 16
+
+class ILDACodeConverter
+{
+	public:
+		ILDACodeConverter();
+		~ILDACodeConverter() {};
+
+	void Configure( double voltageMin, double voltageMax, unsigned long resolution, bool bipolar );
+
+	//Single conversion (neg is only ever set on bipolar channels)
+	inline unsigned int ToCode( double volts, bool& neg ) const
+	{
+		neg = bipolar_ && volts < 0;
+		double magnitude = (neg) ? -volts : volts;
+		//Out of range inputs never reach the fixed-point cast (keeps the product below from overflowing)
+		if( magnitude >= saturateVolts_ )
+		{
+			return maxCode_;
+		}
+		long long fixedVolts = (long long) ( magnitude * voltOne_ + 0.5 ) - offset_ + 1;
+		if( fixedVolts <= 0 )
+		{
+			return 0;
+		}
+
+		unsigned long long code = ((unsigned long long) fixedVolts * scale_) >> (ILDA_CONVERTER_VOLT_BITS + ILDA_CONVERTER_FRAC_BITS);
+		return (code > maxCode_) ? maxCode_ : (unsigned int) code;
+	};
+
+	inline unsigned int ToCode( double volts ) const
+	{
+		bool neg;
+		return ToCode( volts, neg );
+	};
+
+	inline double ToVolts( unsigned int code, bool neg = false ) const
+	{
+		double volts = voltageMin_ + code * increment_;
+		return (neg) ? -volts : volts;
+	};
+
+	//Batch conversion for waveforms and patterns
+	//negBits (optional, bipolar channels) receives one bit per sample, LSB first
+	void ToCodes( const double * volts, unsigned int count, unsigned short * codes, unsigned char * negBits = 0 ) const;
+
+	unsigned int GetMaxCode( void) const { return maxCode_; };
+	double GetIncrement( void) const { return increment_; };
+	double GetVoltageMin( void) const { return voltageMin_; };
+	double GetCodesPerVolt( void) const { return (increment_ > 0) ? 1.0 / increment_ : 0; };
+	bool IsBipolar( void) const { return bipolar_; };
+
+	//Fixed-point parameters, for vector code that repeats ToCode bit for bit
+	long long GetFixedOffset( void) const { return offset_; };
+	unsigned long long GetFixedScale( void) const { return scale_; };
+	double GetSaturateVolts( void) const { return saturateVolts_; };
+	static double GetFixedVoltOne( void) { return voltOne_; };
+
+	protected:
+	  static const double voltOne_;
+	  static const double fixedOne_;
+
+	  long long offset_;             //voltage minimum, Q.24 volts
+	  unsigned long long scale_;     //codes per volt, Q16.16 (rounded up)
+	  double saturateVolts_;         //smallest magnitude that converts to maxCode_
+	  unsigned int maxCode_;
+	  bool bipolar_;
+
+	  double voltageMin_;
+	  double increment_;
+};
+
+#endif //_ILDA_CODE_CONVERTER_H_
@@ -0,0 +1,316 @@
+#include "ILDAFile.h"
+#include <cstring>
+
+#ifdef WIN32
+   #define WIN32_LEAN_AND_MEAN
+   #include <windows.h>
+#else
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+#endif
+
+//Bytes per point record, indexed by format code (0 = unsupported)
+const unsigned int g_ILDARecordSizes[6] = { 8, 6, 3, 0, 10, 8 };
+
+//Status Byte Blanking Bit (the last-point bit is redundant with the record count)
+const unsigned char g_ILDAStatusBlanked = 0x40;
+
+//ILDA Standard Default Palette (64 entries, later indices fall back to white)
+const int g_ILDADefaultPaletteSize = 64;
+const unsigned char g_ILDADefaultPalette[g_ILDADefaultPaletteSize][3] = {
+	{255,   0,   0}, {255,  16,   0}, {255,  32,   0}, {255,  48,   0},
+	{255,  64,   0}, {255,  80,   0}, {255,  96,   0}, {255, 112,   0},
+	{255, 128,   0}, {255, 144,   0}, {255, 160,   0}, {255, 176,   0},
+	{255, 192,   0}, {255, 208,   0}, {255, 224,   0}, {255, 240,   0},
+	{255, 255,   0}, {224, 255,   0}, {192, 255,   0}, {160, 255,   0},
+	{128, 255,   0}, { 96, 255,   0}, { 64, 255,   0}, { 32, 255,   0},
+	{  0, 255,   0}, {  0, 255,  36}, {  0, 255,  73}, {  0, 255, 109},
+	{  0, 255, 146}, {  0, 255, 182}, {  0, 255, 219}, {  0, 255, 255},
+	{  0, 227, 255}, {  0, 198, 255}, {  0, 170, 255}, {  0, 142, 255},
+	{  0, 113, 255}, {  0,  85, 255}, {  0,  56, 255}, {  0,  28, 255},
+	{  0,   0, 255}, { 32,   0, 255}, { 64,   0, 255}, { 96,   0, 255},
+	{128,   0, 255}, {160,   0, 255}, {192,   0, 255}, {224,   0, 255},
+	{255,   0, 255}, {255,  32, 255}, {255,  64, 255}, {255,  96, 255},
+	{255, 128, 255}, {255, 160, 255}, {255, 192, 255}, {255, 224, 255},
+	{255, 255, 255}, {255, 224, 224}, {255, 192, 192}, {255, 160, 160},
+	{255, 128, 128}, {255,  96,  96}, {255,  64,  64}, {255,  32,  32}
+};
+
+//All multi-byte ILDA fields are big endian
+static short ILDAReadShort( const unsigned char * p )
+{
+	return (short) (((unsigned short) p[0] << 8) | p[1]);
+}
+
+static unsigned int ILDAReadUShort( const unsigned char * p )
+{
+	return ((unsigned int) p[0] << 8) | p[1];
+}
+
+
+/************************************************************
+ILDAFrameReader Implementation
+*************************************************************/
+ILDAFrameReader::ILDAFrameReader() :
+	data_(0),
+	size_(0),
+#ifdef WIN32
+	file_(INVALID_HANDLE_VALUE),
+	mapping_(0)
+#else
+	file_(-1)
+#endif
+{
+}
+
+ILDAFrameReader::~ILDAFrameReader()
+{
+	Close();
+}
+
+int ILDAFrameReader::Open( const char * path )
+{
+	Close();
+
+#ifdef WIN32
+	file_ = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+	if( file_ == INVALID_HANDLE_VALUE )
+	{
+		return ildaFileOpenFailed;
+	}
+
+	LARGE_INTEGER fileSize;
+	if( !GetFileSizeEx( file_, &fileSize ) || fileSize.QuadPart == 0 )
+	{
+		Close();
+		return ildaFileOpenFailed;
+	}
+	size_ = (size_t) fileSize.QuadPart;
+
+	mapping_ = CreateFileMappingA( file_, 0, PAGE_READONLY, 0, 0, 0 );
+	if( !mapping_ )
+	{
+		Close();
+		return ildaFileOpenFailed;
+	}
+
+	data_ = (const unsigned char *) MapViewOfFile( mapping_, FILE_MAP_READ, 0, 0, 0 );
+#else
+	file_ = open( path, O_RDONLY );
+	if( file_ < 0 )
+	{
+		return ildaFileOpenFailed;
+	}
+
+	struct stat info;
+	if( fstat( file_, &info ) != 0 || info.st_size == 0 )
+	{
+		Close();
+		return ildaFileOpenFailed;
+	}
+	size_ = (size_t) info.st_size;
+
+	void * view = mmap( 0, size_, PROT_READ, MAP_PRIVATE, file_, 0 );
+	data_ = (view == MAP_FAILED) ? 0 : (const unsigned char *) view;
+#endif
+
+	if( !data_ )
+	{
+		Close();
+		return ildaFileOpenFailed;
+	}
+
+	int ret = IndexSections();
+	if( ret != ildaFileOk )
+	{
+		Close();
+	}
+	return ret;
+}
+
+void ILDAFrameReader::Close( void)
+{
+#ifdef WIN32
+	if( data_ )
+	{
+		UnmapViewOfFile( data_ );
+	}
+	if( mapping_ )
+	{
+		CloseHandle( mapping_ );
+		mapping_ = 0;
+	}
+	if( file_ != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( file_ );
+		file_ = INVALID_HANDLE_VALUE;
+	}
+#else
+	if( data_ )
+	{
+		munmap( (void *) data_, size_ );
+	}
+	if( file_ >= 0 )
+	{
+		close( file_ );
+		file_ = -1;
+	}
+#endif
+
+	data_ = 0;
+	size_ = 0;
+	frames_.clear();
+	palettes_.clear();
+}
+
+//Walks the section headers only, point data is left untouched until decoded.
+//A section with zero records marks the end of the file.
+int ILDAFrameReader::IndexSections( void)
+{
+	size_t pos = 0;
+	int palette = -1;
+
+	while( pos + ILDA_HEADER_SIZE <= size_ )
+	{
+		const unsigned char * header = data_ + pos;
+		if( memcmp( header, "ILDA", 4 ) != 0 )
+		{
+			return ildaFileBadHeader;
+		}
+
+		unsigned char format = header[7];
+		unsigned int records = ILDAReadUShort( header + 24 );
+		if( records == 0 )
+		{
+			break;
+		}
+
+		if( format >= sizeof(g_ILDARecordSizes) / sizeof(g_ILDARecordSizes[0]) || g_ILDARecordSizes[format] == 0 )
+		{
+			return ildaFileUnsupportedFormat;
+		}
+
+		size_t body = (size_t) records * g_ILDARecordSizes[format];
+		pos += ILDA_HEADER_SIZE;
+		if( pos + body > size_ )
+		{
+			return ildaFileTruncated;
+		}
+
+		if( format == 2 )
+		{
+			//Palettes are tiny, copy them now so decoding never looks back
+			std::vector<unsigned char> entries( ILDA_PALETTE_SIZE * 3, 255 );
+			unsigned int count = (records < ILDA_PALETTE_SIZE) ? records : ILDA_PALETTE_SIZE;
+			memcpy( &entries[0], data_ + pos, count * 3 );
+			palettes_.push_back( entries );
+			palette = (int) palettes_.size() - 1;
+		}
+		else
+		{
+			FrameEntry entry;
+			entry.offset = pos;
+			entry.records = records;
+			entry.format = format;
+			entry.palette = palette;
+			frames_.push_back( entry );
+		}
+
+		pos += body;
+	}
+
+	return (frames_.empty()) ? ildaFileNoFrames : ildaFileOk;
+}
+
+unsigned int ILDAFrameReader::GetPointCount( unsigned int frame ) const
+{
+	return (frame < frames_.size()) ? frames_[frame].records : 0;
+}
+
+int ILDAFrameReader::GetFormat( unsigned int frame ) const
+{
+	return (frame < frames_.size()) ? frames_[frame].format : -1;
+}
+
+int ILDAFrameReader::DecodeFrame( unsigned int frame, std::vector<ILDAPoint>& points ) const
+{
+	if( frame >= frames_.size() )
+	{
+		return ildaFileBadIndex;
+	}
+
+	const FrameEntry& entry = frames_[frame];
+	const unsigned int recordSize = g_ILDARecordSizes[entry.format];
+	const bool is3D = (entry.format == 0 || entry.format == 4);
+	const bool trueColor = (entry.format == 4 || entry.format == 5);
+	const unsigned char * palette = (entry.palette >= 0) ? &palettes_[entry.palette][0] : 0;
+
+	points.resize( entry.records );
+	const unsigned char * record = data_ + entry.offset;
+	for( unsigned int i = 0; i < entry.records; i++, record += recordSize )
+	{
+		ILDAPoint& point = points[i];
+		point.x = ILDAReadShort( record );
+		point.y = ILDAReadShort( record + 2 );
+		point.z = (is3D) ? ILDAReadShort( record + 4 ) : 0;
+
+		const unsigned char * tail = record + ((is3D) ? 6 : 4);
+		unsigned char status = tail[0];
+		point.blanked = (status & g_ILDAStatusBlanked) != 0;
+
+		if( trueColor )
+		{
+			//Stored blue, green, red
+			point.b = tail[1];
+			point.g = tail[2];
+			point.r = tail[3];
+		}
+		else
+		{
+			unsigned char index = tail[1];
+			if( palette )
+			{
+				point.r = palette[index * 3];
+				point.g = palette[index * 3 + 1];
+				point.b = palette[index * 3 + 2];
+			}
+			else if( index < g_ILDADefaultPaletteSize )
+			{
+				point.r = g_ILDADefaultPalette[index][0];
+				point.g = g_ILDADefaultPalette[index][1];
+				point.b = g_ILDADefaultPalette[index][2];
+			}
+			else
+			{
+				point.r = point.g = point.b = 255;
+			}
+		}
+	}
+
+	return ildaFileOk;
+}
+
+const char* ILDAFrameReader::GetResultText( int result )
+{
+	switch( result )
+	{
+	  case ildaFileOk:
+		return "OK";
+	  case ildaFileOpenFailed:
+		return "File could not be opened or mapped";
+	  case ildaFileBadHeader:
+		return "Section header does not start with ILDA";
+	  case ildaFileUnsupportedFormat:
+		return "Unsupported ILDA format code";
+	  case ildaFileTruncated:
+		return "File ends inside a section";
+	  case ildaFileNoFrames:
+		return "File contains no frames";
+	  case ildaFileBadIndex:
+		return "Frame index out of range";
+	  default:
+		return "Unknown ILDA file error";
+	}
+}
@@ -0,0 +1,86 @@
+#ifndef _ILDA_FILE_H_
+#define _ILDA_FILE_H_
+
+#include <vector>
+#include <cstddef>
+
+//ILDA Image Data Transfer Format (.ild) Reader
+//The file is memory-mapped and only the section headers are walked on Open.
+//Point records are decoded a frame at a time when the frame is asked for.
+//Supported sections: 0 (3D indexed), 1 (2D indexed), 2 (palette), 4 (3D true colour), 5 (2D true colour)
+
+//Section Header Size (bytes)
+#define ILDA_HEADER_SIZE 32
+
+//Entries In The Default Palette (a format 2 section may replace it for the frames after it)
+#define ILDA_PALETTE_SIZE 256
+
+enum ILDAFileResult{
+	ildaFileOk = 0,
+	ildaFileOpenFailed,
+	ildaFileBadHeader,
+	ildaFileUnsupportedFormat,
+	ildaFileTruncated,
+	ildaFileNoFrames,
+	ildaFileBadIndex,
+
+	ildaFileResultTotal
+};
+
+//One Decoded Point
+//Coordinates are signed ILDA units (-32768..32767), colour is 0-255 per primary
+struct ILDAPoint
+{
+	short x;
+	short y;
+	short z;
+	unsigned char r;
+	unsigned char g;
+	unsigned char b;
+	bool blanked;
+};
+
+class ILDAFrameReader
+{
+	public:
+		ILDAFrameReader();
+		~ILDAFrameReader();
+
+	int Open( const char * path );
+	void Close( void);
+	bool IsOpen( void) const { return data_ != 0; };
+
+	unsigned int GetFrameCount( void) const { return (unsigned int) frames_.size(); };
+	unsigned int GetPointCount( unsigned int frame ) const;
+	int GetFormat( unsigned int frame ) const;
+
+	//Replaces the contents of points with the frame's records
+	int DecodeFrame( unsigned int frame, std::vector<ILDAPoint>& points ) const;
+
+	static const char* GetResultText( int result );
+
+	protected:
+	  struct FrameEntry
+	  {
+		  size_t offset;          //first point record
+		  unsigned int records;
+		  unsigned char format;
+		  int palette;            //index into palettes_, -1 for the default palette
+	  };
+
+	  int IndexSections( void);
+
+	  const unsigned char * data_;
+	  size_t size_;
+#ifdef WIN32
+	  void * file_;
+	  void * mapping_;
+#else
+	  int file_;
+#endif
+
+	  std::vector<FrameEntry> frames_;
+	  std::vector< std::vector<unsigned char> > palettes_;
+};
+
+#endif //_ILDA_FILE_H_
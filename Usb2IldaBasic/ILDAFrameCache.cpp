@@ -0,0 +1,136 @@
+#include "ILDAFrameCache.h"
+#include <algorithm>
+#include <cstring>
+
+//FNV-1a 64 bit parameters
+const unsigned long long g_ILDAFnvOffset = 14695981039346656037ULL;
+const unsigned long long g_ILDAFnvPrime = 1099511628211ULL;
+
+static unsigned long long ILDAFnvAppend( unsigned long long hash, const void * data, size_t len )
+{
+	const unsigned char * bytes = (const unsigned char *) data;
+	for( size_t i = 0; i < len; i++ )
+	{
+		hash ^= bytes[i];
+		hash *= g_ILDAFnvPrime;
+	}
+	return hash;
+}
+
+
+/************************************************************
+ILDAFrameCache Implementation
+*************************************************************/
+ILDAFrameCache::ILDAFrameCache( size_t capacityPoints ) :
+	arena_(capacityPoints),
+	used_(0),
+	hits_(0),
+	misses_(0),
+	evictions_(0)
+{
+}
+
+unsigned long long ILDAFrameCache::Hash( const double * xVolts, const double * yVolts, unsigned int count )
+{
+	unsigned long long hash = g_ILDAFnvOffset;
+	hash = ILDAFnvAppend( hash, &count, sizeof(count) );
+	hash = ILDAFnvAppend( hash, xVolts, count * sizeof(double) );
+	hash = ILDAFnvAppend( hash, yVolts, count * sizeof(double) );
+	return hash;
+}
+
+const ILDACachedPoint * ILDAFrameCache::Find( unsigned long long key, unsigned int count )
+{
+	std::map< unsigned long long, std::list<Entry>::iterator >::iterator found = index_.find( key );
+	if( found == index_.end() || found->second->count != count )
+	{
+		misses_++;
+		return 0;
+	}
+
+	//Move to the front without touching the arena
+	lru_.splice( lru_.begin(), lru_, found->second );
+	hits_++;
+	return &arena_[ found->second->offset ];
+}
+
+ILDACachedPoint * ILDAFrameCache::Insert( unsigned long long key, unsigned int count )
+{
+	if( count == 0 || count > arena_.size() )
+	{
+		return 0;
+	}
+
+	//Replaces a stale entry under the same key
+	std::map< unsigned long long, std::list<Entry>::iterator >::iterator found = index_.find( key );
+	if( found != index_.end() )
+	{
+		lru_.erase( found->second );
+		index_.erase( found );
+	}
+
+	if( arena_.size() - used_ < count )
+	{
+		size_t live = 0;
+		for( std::list<Entry>::iterator it = lru_.begin(); it != lru_.end(); ++it )
+		{
+			live += it->count;
+		}
+
+		while( arena_.size() - live < count )
+		{
+			live -= lru_.back().count;
+			index_.erase( lru_.back().key );
+			lru_.pop_back();
+			evictions_++;
+		}
+
+		Compact();
+	}
+
+	Entry entry;
+	entry.key = key;
+	entry.offset = used_;
+	entry.count = count;
+	lru_.push_front( entry );
+	index_[key] = lru_.begin();
+	used_ += count;
+
+	return &arena_[ entry.offset ];
+}
+
+//Slides the live entries to the front of the arena in offset order so the free space is one tail
+void ILDAFrameCache::Compact( void)
+{
+	std::vector<Entry*> live;
+	for( std::list<Entry>::iterator it = lru_.begin(); it != lru_.end(); ++it )
+	{
+		live.push_back( &(*it) );
+	}
+	std::sort( live.begin(), live.end(), []( const Entry* a, const Entry* b ) { return a->offset < b->offset; } );
+
+	size_t next = 0;
+	for( size_t i = 0; i < live.size(); i++ )
+	{
+		if( live[i]->offset != next )
+		{
+			memmove( &arena_[next], &arena_[ live[i]->offset ], live[i]->count * sizeof(ILDACachedPoint) );
+			live[i]->offset = next;
+		}
+		next += live[i]->count;
+	}
+	used_ = next;
+}
+
+void ILDAFrameCache::Clear( void)
+{
+	lru_.clear();
+	index_.clear();
+	used_ = 0;
+}
+
+void ILDAFrameCache::SetCapacity( size_t capacityPoints )
+{
+	Clear();
+	arena_.assign( capacityPoints, ILDACachedPoint() );
+}
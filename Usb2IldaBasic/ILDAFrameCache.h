@@ -0,0 +1,74 @@
+#ifndef _ILDA_FRAME_CACHE_H_
+#define _ILDA_FRAME_CACHE_H_
+
+#include <vector>
+#include <list>
+#include <map>
+#include <cstddef>
+
+//Pre-Quantised Scan Cache
+//Scans that are replayed unchanged (ROI patterns on every timepoint) are encoded once.
+//Every point is kept as the two ready-to-send DAC8571 frames plus its sign pin states,
+//packed back to back in one arena. Least recently used scans are evicted to make room.
+
+//Tilt axes per cached point (matches TiltDirection)
+#define ILDA_CACHE_AXES 2
+
+//DAC8571 frame: control byte, code high, code low
+#define ILDA_CACHE_FRAME_SIZE 3
+
+struct ILDACachedPoint
+{
+	unsigned char frames[ILDA_CACHE_AXES][ILDA_CACHE_FRAME_SIZE];
+	unsigned char signs;   //bit per axis, set while the axis is negative
+};
+
+class ILDAFrameCache
+{
+	public:
+		ILDAFrameCache( size_t capacityPoints );
+		~ILDAFrameCache() {};
+
+	//Content key of a scan (FNV-1a over the raw coordinates)
+	static unsigned long long Hash( const double * xVolts, const double * yVolts, unsigned int count );
+
+	//Cached points for the key, or null on a miss (a hit becomes most recently used)
+	const ILDACachedPoint * Find( unsigned long long key, unsigned int count );
+
+	//Space for count points under key, evicting as needed.
+	//Returns null if the scan is larger than the whole arena.
+	ILDACachedPoint * Insert( unsigned long long key, unsigned int count );
+
+	void Clear( void);
+	void SetCapacity( size_t capacityPoints );
+	size_t GetCapacity( void) const { return arena_.size(); };
+	size_t GetUsed( void) const { return used_; };
+
+	//Statistics
+	unsigned long GetHits( void) const { return hits_; };
+	unsigned long GetMisses( void) const { return misses_; };
+	unsigned long GetEvictions( void) const { return evictions_; };
+
+	protected:
+	  struct Entry
+	  {
+		  unsigned long long key;
+		  size_t offset;
+		  unsigned int count;
+	  };
+
+	  void Compact( void);
+
+	  std::vector<ILDACachedPoint> arena_;
+	  size_t used_;   //arena points in front of the free tail
+
+	  //Front is most recently used
+	  std::list<Entry> lru_;
+	  std::map< unsigned long long, std::list<Entry>::iterator > index_;
+
+	  unsigned long hits_;
+	  unsigned long misses_;
+	  unsigned long evictions_;
+};
+
+#endif //_ILDA_FRAME_CACHE_H_
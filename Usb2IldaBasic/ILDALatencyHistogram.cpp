@@ -0,0 +1,94 @@
+#include "ILDALatencyHistogram.h"
+
+//Values below this are counted one per bucket (the linear head of the table)
+const unsigned long long g_ILDAHistogramLinear = 1ull << ILDA_HISTOGRAM_SUB_BITS;
+
+
+/************************************************************
+ILDALatencyHistogram Implementation
+*************************************************************/
+void ILDALatencyHistogram::Record( double us )
+{
+	if( us < 0 )
+	{
+		us = 0;
+	}
+
+	buckets_[ BucketIndex( (unsigned long long) (us * 1000) ) ]++;
+	count_++;
+	if( us > maxUs_.load() )
+	{
+		maxUs_.store( us );
+	}
+}
+
+void ILDALatencyHistogram::Reset( void)
+{
+	for( unsigned int i = 0; i < ILDA_HISTOGRAM_BUCKETS; i++ )
+	{
+		buckets_[i].store( 0 );
+	}
+	count_.store( 0 );
+	maxUs_.store( 0 );
+}
+
+//Walks the buckets until the wanted rank is covered, the answer never exceeds the maximum seen
+double ILDALatencyHistogram::GetPercentile( double fraction ) const
+{
+	unsigned long count = count_.load();
+	if( count == 0 )
+	{
+		return 0;
+	}
+
+	unsigned long rank = (unsigned long) (fraction * count + 0.5);
+	rank = (rank < 1) ? 1 : rank;
+
+	unsigned long seen = 0;
+	for( unsigned int i = 0; i < ILDA_HISTOGRAM_BUCKETS; i++ )
+	{
+		seen += buckets_[i].load();
+		if( seen >= rank )
+		{
+			double upper = BucketUpperUs( i );
+			double maxUs = maxUs_.load();
+			return (upper < maxUs) ? upper : maxUs;
+		}
+	}
+
+	return maxUs_.load();
+}
+
+//Bucket = sub-bucket count per octave * octave + top sub-bits below the leading one
+unsigned int ILDALatencyHistogram::BucketIndex( unsigned long long ns )
+{
+	if( ns < g_ILDAHistogramLinear )
+	{
+		return (unsigned int) ns;
+	}
+
+	unsigned int msb = 0;
+	for( unsigned long long v = ns; v > 1; v >>= 1 )
+	{
+		msb++;
+	}
+
+	unsigned int shift = msb - ILDA_HISTOGRAM_SUB_BITS;
+	unsigned int sub = (unsigned int) (ns >> shift) & (g_ILDAHistogramLinear - 1);
+	unsigned int index = (shift + 1) * (unsigned int) g_ILDAHistogramLinear + sub;
+
+	return (index < ILDA_HISTOGRAM_BUCKETS) ? index : ILDA_HISTOGRAM_BUCKETS - 1;
+}
+
+double ILDALatencyHistogram::BucketUpperUs( unsigned int index )
+{
+	if( index < g_ILDAHistogramLinear )
+	{
+		return (index + 1) / 1000.0;
+	}
+
+	unsigned int shift = index / (unsigned int) g_ILDAHistogramLinear - 1;
+	unsigned long long sub = index % g_ILDAHistogramLinear;
+	unsigned long long upper = ((g_ILDAHistogramLinear + sub + 1) << shift);
+	return upper / 1000.0;
+}
@@ -0,0 +1,40 @@
+#ifndef _ILDA_LATENCY_HISTOGRAM_H_
+#define _ILDA_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+
+//Log-Linear Latency Histogram
+//Values are kept in nanoseconds. Each power of two is split into 8 linear sub-buckets,
+//so any reported percentile is within 12.5% of the true value across the whole range
+//(ns to minutes) with a fixed 320-bucket table and no allocation.
+//One writer (the hub, under its bus lock), any number of readers.
+
+//Sub-buckets per power of two (2^3)
+#define ILDA_HISTOGRAM_SUB_BITS 3
+#define ILDA_HISTOGRAM_BUCKETS 320
+
+class ILDALatencyHistogram
+{
+	public:
+		ILDALatencyHistogram() { Reset(); };
+		~ILDALatencyHistogram() {};
+
+	void Record( double us );
+	void Reset( void);
+
+	unsigned long GetCount( void) const { return count_.load(); };
+	double GetMax( void) const { return maxUs_.load(); };
+
+	//Latency at or below which the given fraction (0-1) of samples fall, in us
+	double GetPercentile( double fraction ) const;
+
+	protected:
+	  static unsigned int BucketIndex( unsigned long long ns );
+	  static double BucketUpperUs( unsigned int index );
+
+	  std::atomic<unsigned long> buckets_[ILDA_HISTOGRAM_BUCKETS];
+	  std::atomic<unsigned long> count_;
+	  std::atomic<double> maxUs_;
+};
+
+#endif //_ILDA_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,35 @@
+#include "ILDAMcp2221Transport.h"
+
+//Only translation unit of the transport layer that needs the Microchip DLL
+#define MCP2221_LIB
+
+#ifdef WIN32
+   #define WIN32_LEAN_AND_MEAN
+   #include <windows.h>
+#endif
+
+#include "mcp2221_dll_um.h"
+
+
+/************************************************************
+ILDAMcp2221Transport Implementation
+*************************************************************/
+int ILDAMcp2221Transport::I2cWrite(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData)
+{
+	return Mcp2221_I2cWrite(handle_, dataLen, slaveAddress, use7bitAddress, i2cTxData);
+}
+
+int ILDAMcp2221Transport::SetGpioValues(unsigned char * gpioValues)
+{
+	return Mcp2221_SetGpioValues(handle_, gpioValues);
+}
+
+int ILDAMcp2221Transport::I2cRead(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cRxData)
+{
+	return Mcp2221_I2cRead(handle_, dataLen, slaveAddress, use7bitAddress, i2cRxData);
+}
+
+int ILDAMcp2221Transport::GetGpioValues(unsigned char * gpioValues)
+{
+	return Mcp2221_GetGpioValues(handle_, gpioValues);
+}
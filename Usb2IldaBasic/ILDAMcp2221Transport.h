@@ -0,0 +1,25 @@
+#ifndef _ILDA_MCP2221_TRANSPORT_H_
+#define _ILDA_MCP2221_TRANSPORT_H_
+
+#include "ILDATransport.h"
+
+//Real Hardware Backend
+//The handle is opened and closed by ILDAHub (DetectDevice/VerifiedClose), the transport only borrows it
+class ILDAMcp2221Transport : public ILDATransport
+{
+	public:
+		ILDAMcp2221Transport( void * handle) : handle_(handle) {};
+		~ILDAMcp2221Transport() {};
+
+	int I2cWrite(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData);
+	int SetGpioValues(unsigned char * gpioValues);
+	int I2cRead(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cRxData);
+	int GetGpioValues(unsigned char * gpioValues);
+
+	const char* GetName( void) const { return "MCP2221"; };
+
+	protected:
+	  void * handle_;
+};
+
+#endif //_ILDA_MCP2221_TRANSPORT_H_
@@ -0,0 +1,150 @@
+#include "ILDAPowerCurve.h"
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <cmath>
+
+//Fritsch-Carlson bound on the tangent to secant ratios
+const double g_ILDAMonotoneLimit = 9.0;
+
+
+/************************************************************
+ILDAPowerCurve Implementation
+*************************************************************/
+bool ILDAPowerCurve::Parse( const std::string& table )
+{
+	std::vector< std::pair<double, double> > points;   //volts, mW
+
+	size_t start = 0;
+	while( start < table.size() )
+	{
+		size_t end = table.find( ';', start );
+		if( end == std::string::npos )
+		{
+			end = table.size();
+		}
+
+		std::string entry = table.substr( start, end - start );
+		start = end + 1;
+		if( entry.find_first_not_of( " \t" ) == std::string::npos )
+		{
+			continue;
+		}
+
+		const char * text = entry.c_str();
+		char * next;
+		double volts = strtod( text, &next );
+		while( *next == ' ' || *next == '\t' )
+		{
+			next++;
+		}
+		if( next == text || *next != ':' )
+		{
+			return false;
+		}
+		text = next + 1;
+		double power = strtod( text, &next );
+		while( *next == ' ' || *next == '\t' )
+		{
+			next++;
+		}
+		if( next == text || *next != '\0' || power < 0 )
+		{
+			return false;
+		}
+		points.push_back( std::make_pair( volts, power ) );
+	}
+
+	if( points.size() < 2 )
+	{
+		return false;
+	}
+	std::sort( points.begin(), points.end() );
+
+	std::vector<double> power, volts;
+	for( size_t i = 0; i < points.size(); i++ )
+	{
+		if( i > 0 && (points[i].first == points[i - 1].first || points[i].second < points[i - 1].second) )
+		{
+			//Repeated voltage or power dropping with drive
+			return false;
+		}
+		//A plateau keeps its lowest voltage
+		if( power.empty() || points[i].second > power.back() )
+		{
+			power.push_back( points[i].second );
+			volts.push_back( points[i].first );
+		}
+	}
+
+	if( power.size() < 2 )
+	{
+		return false;
+	}
+
+	//Secants, then tangents limited so every segment stays monotone
+	size_t knots = power.size();
+	std::vector<double> secants( knots - 1 ), slopes( knots );
+	for( size_t k = 0; k < knots - 1; k++ )
+	{
+		secants[k] = (volts[k + 1] - volts[k]) / (power[k + 1] - power[k]);
+	}
+
+	slopes[0] = secants[0];
+	slopes[knots - 1] = secants[knots - 2];
+	for( size_t k = 1; k < knots - 1; k++ )
+	{
+		slopes[k] = (secants[k - 1] + secants[k]) / 2;
+	}
+
+	for( size_t k = 0; k < knots - 1; k++ )
+	{
+		double a = slopes[k] / secants[k];
+		double b = slopes[k + 1] / secants[k];
+		double s = a * a + b * b;
+		if( s > g_ILDAMonotoneLimit )
+		{
+			double t = 3 / sqrt( s );
+			slopes[k] = t * a * secants[k];
+			slopes[k + 1] = t * b * secants[k];
+		}
+	}
+
+	power_.swap( power );
+	volts_.swap( volts );
+	slopes_.swap( slopes );
+	return true;
+}
+
+void ILDAPowerCurve::Clear( void)
+{
+	power_.clear();
+	volts_.clear();
+	slopes_.clear();
+}
+
+//Binary search for the segment, then one cubic Hermite evaluation
+double ILDAPowerCurve::VoltsForPower( double power ) const
+{
+	if( !IsCalibrated() )
+	{
+		return 0;
+	}
+	if( power <= power_.front() )
+	{
+		return volts_.front();
+	}
+	if( power >= power_.back() )
+	{
+		return volts_.back();
+	}
+
+	size_t k = (std::upper_bound( power_.begin(), power_.end(), power ) - power_.begin()) - 1;
+	double h = power_[k + 1] - power_[k];
+	double t = (power - power_[k]) / h;
+	double t2 = t * t;
+	double t3 = t2 * t;
+
+	return (2 * t3 - 3 * t2 + 1) * volts_[k] + (t3 - 2 * t2 + t) * h * slopes_[k]
+		+ (-2 * t3 + 3 * t2) * volts_[k + 1] + (t3 - t2) * h * slopes_[k + 1];
+}
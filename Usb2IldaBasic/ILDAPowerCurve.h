@@ -0,0 +1,35 @@
+#ifndef _ILDA_POWER_CURVE_H_
+#define _ILDA_POWER_CURVE_H_
+
+#include <vector>
+#include <string>
+
+//Measured Optical Power Versus Drive Voltage For One Laser
+//Calibration points are written "volts:mW" separated by ';' (e.g. "0:0;1.2:0.4;5:11.8").
+//Power must not fall as voltage rises. The inverse (volts for a wanted power) is a
+//monotone cubic (Fritsch-Carlson), so interpolated powers never overshoot the measurements.
+
+class ILDAPowerCurve
+{
+	public:
+		ILDAPowerCurve() {};
+		~ILDAPowerCurve() {};
+
+	//Replaces the curve, false (curve left untouched) on a malformed or non-monotone table
+	bool Parse( const std::string& table );
+	void Clear( void);
+
+	bool IsCalibrated( void) const { return power_.size() >= 2; };
+	double GetPowerMax( void) const { return (IsCalibrated()) ? power_.back() : 0; };
+
+	//Drive voltage that gives power mW (clamped to the measured range)
+	double VoltsForPower( double power ) const;
+
+	protected:
+	  //Interpolation knots, strictly increasing in power
+	  std::vector<double> power_;
+	  std::vector<double> volts_;
+	  std::vector<double> slopes_;   //dV/dP at each knot
+};
+
+#endif //_ILDA_POWER_CURVE_H_
@@ -0,0 +1,170 @@
+#include "ILDATraceReplay.h"
+#include <cstring>
+
+//Targets tracked for the redundant-frame model (7-bit I2C addresses)
+const unsigned int g_ILDAReplayAddresses = 128;
+
+
+/************************************************************
+ILDATraceReplay Implementation
+*************************************************************/
+//Two frames carry the same latest-value update if they hit the same register
+//(same address, control byte and length)
+static bool ILDASameRegister( const ILDATraceRecord& a, const ILDATraceRecord& b )
+{
+	return a.kind == traceI2cWrite && b.kind == traceI2cWrite && a.address == b.address &&
+		a.dataLen == b.dataLen && a.dataLen > 0 && a.data[0] == b.data[0];
+}
+
+int ILDATraceReplay::Run( const std::vector<ILDATraceRecord>& records, ILDASimulatedTransport& transport,
+	const ILDAReplayOptions& options, ILDAReplayResult& result )
+{
+	result.Reset();
+	transport.ResetStatistics();
+	result.recorded = (unsigned long) records.size();
+	if( records.empty() )
+	{
+		return 0;
+	}
+
+	//Last frame seen by each target and the GPIO pin states, for skipRedundant
+	std::vector<unsigned char> lastFrame( g_ILDAReplayAddresses * ILDA_TRACE_PAYLOAD );
+	std::vector<unsigned int> lastLen( g_ILDAReplayAddresses, 0 );
+	unsigned char pins[MCP2221_GPIO_TOTAL] = { 0xFF, 0xFF, 0xFF, 0xFF };
+
+	std::vector<unsigned char> frame;
+	std::vector<double> arrivals;
+	double originUs = records[0].startUs;
+	size_t i = 0;
+	while( i < records.size() )
+	{
+		const ILDATraceRecord& r = records[i];
+		double arrivalUs = r.startUs - originUs;
+
+		//The bus is idle until the next recorded transfer arrives
+		if( options.originalTiming && transport.GetClockUs() < arrivalUs )
+		{
+			transport.Delay( arrivalUs - transport.GetClockUs() );
+		}
+		double startUs = transport.GetClockUs();
+		if( !options.originalTiming )
+		{
+			arrivalUs = startUs;
+		}
+
+		//A newer value for the same register arrived while this one waited
+		if( options.coalesce && options.originalTiming )
+		{
+			bool superseded = false;
+			for( size_t k = i + 1; k < records.size() && records[k].startUs - originUs <= startUs && !superseded; k++ )
+			{
+				superseded = ILDASameRegister( r, records[k] );
+			}
+			if( superseded )
+			{
+				result.coalesced++;
+				i++;
+				continue;
+			}
+		}
+
+		unsigned int shown = (r.dataLen < ILDA_TRACE_PAYLOAD) ? r.dataLen : ILDA_TRACE_PAYLOAD;
+		if( options.skipRedundant && r.dataLen <= ILDA_TRACE_PAYLOAD )
+		{
+			bool redundant = false;
+			if( r.kind == traceGpioWrite )
+			{
+				redundant = true;
+				for( unsigned int p = 0; p < MCP2221_GPIO_TOTAL; p++ )
+				{
+					redundant = redundant && (r.data[p] == 0xFF || r.data[p] == pins[p]);
+				}
+			}
+			else if( r.kind == traceI2cWrite && r.address < g_ILDAReplayAddresses )
+			{
+				redundant = lastLen[r.address] == r.dataLen &&
+					memcmp( &lastFrame[r.address * ILDA_TRACE_PAYLOAD], r.data, shown ) == 0;
+			}
+			if( redundant )
+			{
+				result.skipped++;
+				i++;
+				continue;
+			}
+		}
+
+		//Remember what each target now holds
+		if( r.kind == traceGpioWrite )
+		{
+			for( unsigned int p = 0; p < MCP2221_GPIO_TOTAL; p++ )
+			{
+				pins[p] = (r.data[p] == 0xFF) ? pins[p] : r.data[p];
+			}
+		}
+		else if( r.kind == traceI2cWrite && r.address < g_ILDAReplayAddresses )
+		{
+			memcpy( &lastFrame[r.address * ILDA_TRACE_PAYLOAD], r.data, shown );
+			lastLen[r.address] = r.dataLen;
+		}
+
+		//Frames past the recorded payload are resent as zeros, only their length matters here
+		frame.assign( r.dataLen, 0 );
+		if( shown > 0 )
+		{
+			memcpy( &frame[0], r.data, shown );
+		}
+
+		//Writes to the same address that are already waiting ride along in this transfer
+		arrivals.assign( 1, arrivalUs );
+		size_t next = i + 1;
+		if( options.batch && r.kind == traceI2cWrite )
+		{
+			while( next < records.size() && records[next].kind == traceI2cWrite && records[next].address == r.address &&
+				(!options.originalTiming || records[next].startUs - originUs <= startUs) &&
+				frame.size() + records[next].dataLen <= MCP2221_I2C_REPORT_PAYLOAD )
+			{
+				const ILDATraceRecord& m = records[next];
+				unsigned int mShown = (m.dataLen < ILDA_TRACE_PAYLOAD) ? m.dataLen : ILDA_TRACE_PAYLOAD;
+				frame.insert( frame.end(), m.data, m.data + mShown );
+				frame.resize( frame.size() + m.dataLen - mShown, 0 );
+				arrivals.push_back( (options.originalTiming) ? m.startUs - originUs : startUs );
+				memcpy( &lastFrame[m.address * ILDA_TRACE_PAYLOAD], m.data, mShown );
+				lastLen[m.address] = m.dataLen;
+				result.merged++;
+				next++;
+			}
+		}
+
+		unsigned char * data = (frame.empty()) ? 0 : &frame[0];
+		switch( r.kind )
+		{
+		  case traceGpioWrite:
+			transport.SetGpioValues( data );
+			break;
+		  case traceI2cRead:
+			transport.I2cRead( (unsigned int) frame.size(), r.address, true, data );
+			break;
+		  case traceGpioRead:
+			{
+				unsigned char gpio[MCP2221_GPIO_TOTAL];
+				transport.GetGpioValues( gpio );
+			}
+			break;
+		  default:
+			transport.I2cWrite( (unsigned int) frame.size(), r.address, true, data );
+			break;
+		}
+
+		double endUs = transport.GetClockUs();
+		result.transfers++;
+		result.busUs += endUs - startUs;
+		for( size_t a = 0; a < arrivals.size(); a++ )
+		{
+			result.latency.Record( endUs - arrivals[a] );
+		}
+		result.spanUs = endUs;
+		i = next;
+	}
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef _ILDA_TRACE_REPLAY_H_
+#define _ILDA_TRACE_REPLAY_H_
+
+#include <vector>
+#include "ILDABusTrace.h"
+#include "ILDATransport.h"
+#include "ILDALatencyHistogram.h"
+
+//Bus Trace Replay Against The Simulated Bridge
+//A recorded session is pushed through an ILDASimulatedTransport, either at the recorded
+//arrival times (transfers queue behind each other exactly as the bus would make them) or
+//back to back. Optional what-if models show what the session would have cost with:
+//  skip redundant - shadow registers, frames identical to what the target already holds
+//  coalesce       - latest-value DAC writes, a frame superseded before it could start is dropped
+//  batch          - frames to one address that are already waiting go out as one transfer
+//                   (repeated data words, accepted by the DAC8571 and MCP4728 fast write)
+//Time is the simulated clock: with real time off a long session replays in milliseconds,
+//with it on the replay also holds the calling thread for the recorded gaps.
+
+struct ILDAReplayOptions
+{
+	ILDAReplayOptions() : originalTiming(true), skipRedundant(false), coalesce(false), batch(false) {};
+
+	bool originalTiming;   //false: as fast as possible
+	bool skipRedundant;
+	bool coalesce;
+	bool batch;
+};
+
+//Latency is arrival to completion (queueing included), transfers count what reached the bus
+struct ILDAReplayResult
+{
+	ILDAReplayResult() { Reset(); };
+	void Reset( void)
+	{
+		recorded = transfers = skipped = coalesced = merged = 0;
+		busUs = spanUs = 0;
+		latency.Reset();
+	};
+
+	unsigned long recorded;
+	unsigned long transfers;
+	unsigned long skipped;
+	unsigned long coalesced;
+	unsigned long merged;
+	double busUs;    //time the bridge was busy
+	double spanUs;   //first arrival to last completion
+	ILDALatencyHistogram latency;
+};
+
+class ILDATraceReplay
+{
+	public:
+	//Transport statistics and clock are reset first, result is overwritten
+	static int Run( const std::vector<ILDATraceRecord>& records, ILDASimulatedTransport& transport,
+		const ILDAReplayOptions& options, ILDAReplayResult& result );
+};
+
+#endif //_ILDA_TRACE_REPLAY_H_
@@ -0,0 +1,283 @@
+#include "ILDATransport.h"
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+//Bits clocked per I2C byte (8 data + ACK)
+const double g_I2CBitsPerByte = 9;
+
+//Below this a delay spins instead of sleeping (OS sleep granularity)
+const double g_SimSpinThresholdUs = 2000;
+
+
+/************************************************************
+ILDATransport Implementation
+*************************************************************/
+//The MCP2221 has no multi-transfer report, so the default batch still costs one
+//HID exchange per frame. It saves the per-point property and lock round trips.
+int ILDATransport::ExecuteBatch(const ILDATransportOp * ops, unsigned int count, unsigned int * failedOp)
+{
+	int ret = 0;
+	unsigned int i;
+	for( i = 0; i < count; i++ )
+	{
+		const ILDATransportOp& op = ops[i];
+		double startUs = (monitor_ && op.kind != ILDATransportOp::delay) ? GetClockUs() : 0;
+		switch( op.kind )
+		{
+		  case ILDATransportOp::i2cWrite:
+			ret = I2cWrite( op.dataLen, op.address, true, (unsigned char *) op.data );
+			break;
+		  case ILDATransportOp::gpioWrite:
+			ret = SetGpioValues( (unsigned char *) op.data );
+			break;
+		  case ILDATransportOp::delay:
+			Delay( op.delayUs );
+			break;
+		  default:
+			ret = -1;
+			break;
+		}
+
+		if( monitor_ && op.kind != ILDATransportOp::delay )
+		{
+			monitor_->OnTransfer( op, GetClockUs() - startUs, ret );
+		}
+
+		if( ret != 0 )
+		{
+			break;
+		}
+	}
+
+	if( failedOp )
+	{
+		*failedOp = i;
+	}
+	return ret;
+}
+
+double ILDATransport::GetClockUs( void) const
+{
+	return std::chrono::duration_cast< std::chrono::duration<double, std::micro> >(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+//Sleeps off the bulk of long delays, spins the remainder for sub-millisecond accuracy
+void ILDATransport::Delay( double us )
+{
+	if( us <= 0 )
+	{
+		return;
+	}
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+		std::chrono::microseconds( (long long) us );
+
+	if( us > g_SimSpinThresholdUs )
+	{
+		std::this_thread::sleep_for( std::chrono::microseconds( (long long) (us - g_SimSpinThresholdUs) ) );
+	}
+
+	while( std::chrono::steady_clock::now() < deadline )
+	{
+		//spin
+	}
+}
+
+
+/************************************************************
+ILDASimulatedTransport Implementation
+*************************************************************/
+ILDASimulatedTransport::ILDASimulatedTransport( double reportLatencyUs, double i2cClockHz, unsigned int overheadReports ) :
+	realTime_(true)
+{
+	SetLatencyModel( reportLatencyUs, i2cClockHz, overheadReports );
+	ResetStatistics();
+
+	//GPIO Power-On State Is Low
+	memset( gpioValues_, 0x00, sizeof(gpioValues_) );
+	memset( lastFrame_, 0x00, sizeof(lastFrame_) );
+	memset( lastFrameLen_, 0x00, sizeof(lastFrameLen_) );
+}
+
+void ILDASimulatedTransport::SetLatencyModel( double reportLatencyUs, double i2cClockHz, unsigned int overheadReports )
+{
+	reportLatencyUs_ = (reportLatencyUs < 0) ? 0 : reportLatencyUs;
+	//Clock of 0 is treated as an infinitely fast bus
+	i2cClockHz_ = (i2cClockHz < 0) ? 0 : i2cClockHz;
+	overheadReports_ = overheadReports;
+}
+
+void ILDASimulatedTransport::ResetStatistics( void)
+{
+	simTimeUs_ = 0;
+	reportCount_ = 0;
+	transactionCount_ = 0;
+	byteCount_ = 0;
+}
+
+//An I2C transfer costs the overhead (status) reports plus one report per 60 byte chunk,
+//and the address byte plus data bytes clocked on the bus.  Returns the modelled time.
+double ILDASimulatedTransport::Transaction( unsigned int dataLen )
+{
+	unsigned long reports = overheadReports_ + (dataLen + MCP2221_I2C_REPORT_PAYLOAD - 1) / MCP2221_I2C_REPORT_PAYLOAD;
+	if( dataLen == 0 )
+	{
+		reports++;
+	}
+
+	double busUs = 0;
+	if( i2cClockHz_ > 0 )
+	{
+		busUs = (dataLen + 1) * g_I2CBitsPerByte * 1e6 / i2cClockHz_;
+	}
+
+	reportCount_ += reports;
+	transactionCount_++;
+	byteCount_ += dataLen;
+
+	return reports * reportLatencyUs_ + busUs;
+}
+
+double ILDASimulatedTransport::BytePeriod( void) const
+{
+	return (i2cClockHz_ > 0) ? g_I2CBitsPerByte * 1e6 / i2cClockHz_ : 0;
+}
+
+int ILDASimulatedTransport::I2cWrite(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData)
+{
+	if( dataLen > 0 && !i2cTxData )
+	{
+		return -1;
+	}
+
+	unsigned char address = (use7bitAddress) ? slaveAddress & 0x7F : (slaveAddress >> 1) & 0x7F;
+	unsigned int copyLen = (dataLen < lastFrameMax_) ? dataLen : lastFrameMax_;
+	if( copyLen > 0 )
+	{
+		memcpy( lastFrame_[address], i2cTxData, copyLen );
+	}
+	lastFrameLen_[address] = copyLen;
+
+	Elapse( Transaction( dataLen ) );
+
+	if( devices_.empty() )
+	{
+		return 0;
+	}
+
+	//Every model that acknowledges sees the frame (general call and broadcast addresses).
+	//Addresses no model answers for (the laser switch) are taken as with no models attached.
+	double startUs = simTimeUs_ - (dataLen + 1) * BytePeriod();
+	bool modelled = false;
+	bool acked = false;
+	for( size_t i = 0; i < devices_.size(); i++ )
+	{
+		if( devices_[i]->Acknowledges( address ) )
+		{
+			modelled = true;
+			acked = devices_[i]->Write( address, i2cTxData, dataLen, startUs, BytePeriod() ) || acked;
+		}
+	}
+
+	return (modelled && !acked) ? -1 : 0;
+}
+
+int ILDASimulatedTransport::I2cRead(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cRxData)
+{
+	if( dataLen > 0 && !i2cRxData )
+	{
+		return -1;
+	}
+
+	if( dataLen > 0 )
+	{
+		memset( i2cRxData, 0x00, dataLen );
+	}
+	Elapse( Transaction( dataLen ) );
+
+	if( devices_.empty() )
+	{
+		return 0;
+	}
+
+	unsigned char address = (use7bitAddress) ? slaveAddress & 0x7F : (slaveAddress >> 1) & 0x7F;
+	double startUs = simTimeUs_ - (dataLen + 1) * BytePeriod();
+	bool modelled = false;
+	for( size_t i = 0; i < devices_.size(); i++ )
+	{
+		if( devices_[i]->Acknowledges( address ) )
+		{
+			modelled = true;
+			if( devices_[i]->Read( address, i2cRxData, dataLen, startUs, BytePeriod() ) )
+			{
+				return 0;
+			}
+		}
+	}
+
+	return (modelled) ? -1 : 0;
+}
+
+//Same 0xFF "no change" convention as Mcp2221_SetGpioValues
+int ILDASimulatedTransport::SetGpioValues(unsigned char * gpioValues)
+{
+	if( !gpioValues )
+	{
+		return -1;
+	}
+
+	for( int i = 0; i < MCP2221_GPIO_TOTAL; i++ )
+	{
+		if( gpioValues[i] != 0xFF )
+		{
+			gpioValues_[i] = gpioValues[i];
+		}
+	}
+
+	reportCount_++;
+	transactionCount_++;
+
+	Elapse( reportLatencyUs_ );
+
+	return 0;
+}
+
+unsigned int ILDASimulatedTransport::GetLastFrame( unsigned char slaveAddress, unsigned char * buf, unsigned int bufLen ) const
+{
+	unsigned char address = slaveAddress & 0x7F;
+	unsigned int len = (lastFrameLen_[address] < bufLen) ? lastFrameLen_[address] : bufLen;
+	memcpy( buf, lastFrame_[address], len );
+
+	return len;
+}
+
+int ILDASimulatedTransport::GetGpioValues( unsigned char * gpioValues )
+{
+	if( !gpioValues )
+	{
+		return -1;
+	}
+
+	memcpy( gpioValues, gpioValues_, sizeof(gpioValues_) );
+
+	reportCount_++;
+	transactionCount_++;
+
+	Elapse( reportLatencyUs_ );
+
+	return 0;
+}
+
+void ILDASimulatedTransport::Elapse( double us )
+{
+	simTimeUs_ += us;
+
+	if( !realTime_ || us <= 0 )
+	{
+		return;
+	}
+
+	ILDATransport::Delay( us );
+}
@@ -0,0 +1,164 @@
+#ifndef _ILDA_TRANSPORT_H_
+#define _ILDA_TRANSPORT_H_
+
+#include <vector>
+
+//Transport Layer Beneath ILDAHub
+//Every byte sent to the bridge goes through exactly one ILDATransport owned by the hub.
+//The MCP2221 backend (ILDAMcp2221Transport.h) wraps the Microchip DLL, the simulated
+//backend runs in-process with a latency model so that the DAC write paths can be timed
+//without hardware. Nothing in this file depends on the DLL.
+
+//MCP2221 HID Report Limits (64 byte reports, 60 bytes of I2C payload per report)
+#define MCP2221_REPORT_SIZE 64
+#define MCP2221_I2C_REPORT_PAYLOAD 60
+#define MCP2221_GPIO_TOTAL 4
+
+//Largest frame carried by one batched step (a four channel MCP4728 fast write)
+#define ILDA_TRANSPORT_OP_PAYLOAD 8
+
+//One Step Of A Batched Transfer
+struct ILDATransportOp
+{
+	enum Kind {
+		i2cWrite = 0,
+		gpioWrite,   //data = 4 GPIO values, 0xFF for no change
+		delay,       //hold the bus for delayUs (dwell between points)
+
+		kindTotal
+	};
+
+	unsigned char kind;
+	unsigned char address;
+	unsigned char dataLen;
+	unsigned char data[ILDA_TRANSPORT_OP_PAYLOAD];
+	double delayUs;
+};
+
+//Told the duration and result of every transfer a batch makes (delays excluded)
+class ILDATransportMonitor
+{
+	public:
+		virtual ~ILDATransportMonitor() {};
+
+	virtual void OnTransfer( const ILDATransportOp& op, double us, int ret ) = 0;
+};
+
+//Chip Model Attached To The Simulated Bus
+//startUs is the simulated time the address byte starts, bytePeriodUs the time per clocked byte
+class ILDAI2cDeviceModel
+{
+	public:
+		virtual ~ILDAI2cDeviceModel() {};
+
+	virtual bool Acknowledges( unsigned char address ) const = 0;
+	//False NACKs the frame
+	virtual bool Write( unsigned char address, const unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs ) = 0;
+	virtual bool Read( unsigned char address, unsigned char * data, unsigned int dataLen, double startUs, double bytePeriodUs ) = 0;
+};
+
+class ILDATransport
+{
+	public:
+		ILDATransport() : monitor_(0) {};
+		virtual ~ILDATransport() {};
+
+	//Mirrors the Mcp2221_I2cWrite and Mcp2221_SetGpioValues signatures (0 on success)
+	virtual int I2cWrite(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData) = 0;
+	virtual int SetGpioValues(unsigned char * gpioValues) = 0;
+
+	//Readback (warm start), mirrors Mcp2221_I2cRead and Mcp2221_GetGpioValues
+	virtual int I2cRead(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cRxData) = 0;
+	virtual int GetGpioValues(unsigned char * gpioValues) = 0;
+
+	//Runs a whole op list in one call, stopping at the first failure
+	//failedOp (optional) receives the index of the failing op, or count on success
+	virtual int ExecuteBatch(const ILDATransportOp * ops, unsigned int count, unsigned int * failedOp = 0);
+	virtual void Delay( double us );
+
+	//Clock transfers are timed against (us, arbitrary origin)
+	virtual double GetClockUs( void) const;
+	void SetMonitor( ILDATransportMonitor * monitor ) { monitor_ = monitor; };
+
+	virtual const char* GetName( void) const = 0;
+
+	protected:
+	  ILDATransportMonitor * monitor_;
+};
+
+//In-Process Bridge Simulator
+//Each call costs a number of USB HID round trips plus the I2C clocking time of the frame.
+//In real-time mode the calling thread is held for that long, otherwise the time is only
+//accumulated on the simulated clock.
+class ILDASimulatedTransport : public ILDATransport
+{
+	public:
+		ILDASimulatedTransport( double reportLatencyUs = 1000, double i2cClockHz = 100000, unsigned int overheadReports = 1 );
+		~ILDASimulatedTransport() {};
+
+	int I2cWrite(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData);
+	int SetGpioValues(unsigned char * gpioValues);
+
+	//Reads return the attached model's register image (all zero with no model), GPIO reads the simulated pins
+	int I2cRead(unsigned int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cRxData);
+	int GetGpioValues(unsigned char * gpioValues);
+
+	//Dwell is only accumulated on the simulated clock unless running in real time
+	void Delay( double us ) { Elapse( us ); };
+
+	//Transfers are timed on the simulated clock, so histograms show the modelled cost
+	double GetClockUs( void) const { return simTimeUs_; };
+
+	const char* GetName( void) const { return "Simulated"; };
+
+	//Latency Model
+	void SetLatencyModel( double reportLatencyUs, double i2cClockHz, unsigned int overheadReports );
+	double GetReportLatency( void) const { return reportLatencyUs_; };
+	double GetI2cClock( void) const { return i2cClockHz_; };
+	unsigned int GetOverheadReports( void) const { return overheadReports_; };
+	void SetRealTime( bool realTime ) { realTime_ = realTime; };
+	//Time the caller waited elsewhere while the bus was idle, counted without waiting again
+	void Idle( double us ) { simTimeUs_ += us; };
+	bool GetRealTime( void) const { return realTime_; };
+
+	//Statistics
+	unsigned long GetReportCount( void) const { return reportCount_; };
+	unsigned long GetTransactionCount( void) const { return transactionCount_; };
+	unsigned long GetByteCount( void) const { return byteCount_; };
+	double GetSimulatedTime( void) const { return simTimeUs_; };
+	void ResetStatistics( void);
+
+	//Last Frame Seen Per 7-bit Address (returns copied length)
+	unsigned int GetLastFrame( unsigned char slaveAddress, unsigned char * buf, unsigned int bufLen ) const;
+
+	//Chip Models (not owned)
+	//A frame fails when the models answering its address all NACK it. Addresses no model
+	//answers for are accepted (writes) or read as zeros, as with no models attached.
+	void AttachDevice( ILDAI2cDeviceModel * device ) { devices_.push_back( device ); };
+	void DetachDevices( void) { devices_.clear(); };
+
+	protected:
+	  void Elapse( double us );
+	  double Transaction( unsigned int dataLen );
+	  double BytePeriod( void) const;
+
+	  static const unsigned int lastFrameMax_ = MCP2221_REPORT_SIZE;
+
+	  double reportLatencyUs_;
+	  double i2cClockHz_;
+	  unsigned int overheadReports_;
+	  bool realTime_;
+
+	  double simTimeUs_;
+	  unsigned long reportCount_;
+	  unsigned long transactionCount_;
+	  unsigned long byteCount_;
+
+	  unsigned char gpioValues_[MCP2221_GPIO_TOTAL];
+	  unsigned char lastFrame_[128][lastFrameMax_];
+	  unsigned int lastFrameLen_[128];
+
+	  std::vector<ILDAI2cDeviceModel*> devices_;
+};
+
+#endif //_ILDA_TRANSPORT_H_
@@ -4,6 +4,9 @@
 #include <string>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <thread>
+#include <chrono>
 
 
 #define MCP2221_LIB
@@ -30,6 +33,39 @@
 
 const char* g_ILDADefaultDescriptor = "ILDA-Scientific-Bridge";
 
+//How the last DetectDevice reached the bridge
+const char* g_ILDADetectOpenHandle = "Open Handle";
+const char* g_ILDADetectSerial = "Serial Number";
+const char* g_ILDADetectIndex = "Index";
+const char* g_ILDADetectEnumeration = "Enumeration";
+const char* g_ILDADetectSimulated = "Simulated";
+const char* g_ILDADetectFailed = "Not Found";
+
+//Start Modes (Warm reads the outputs back instead of assuming 0 V)
+const char* g_ILDAStartCold = "Cold";
+const char* g_ILDAStartWarm = "Warm";
+
+//MCP4728 Readback: per channel 3 bytes of input register then 3 bytes of EEPROM
+const int g_ILDAMCP4728ReadBytes = MCP4728_CHANNELS * 6;
+//Readback upper byte: VREF (bit 7), PD1:PD0 (bits 6-5, must be clear), gain (bit 4)
+const unsigned char g_ILDAMCP4728VrefBit = 0x80;
+const unsigned char g_ILDAMCP4728PowerDownMask = 0x60;
+const unsigned char g_ILDAMCP4728GainBit = 0x10;
+
+//Hub Transport Backends
+const char* g_ILDATransportMCP2221 = "MCP2221";
+const char* g_ILDATransportSimulated = "Simulated";
+
+//MCP4728 Write Modes (Deferred stages laser codes until a commit or shutter change)
+const char* g_ILDAMCP4728WriteSingle = "Single Channel";
+const char* g_ILDAMCP4728WriteDeferred = "Fast Write (Deferred)";
+
+//Simulated Bridge Defaults (Full Speed HID polls every 1ms, I2C Standard Mode)
+const double g_ILDASimDefaultReportLatencyUs = 1000;
+const double g_ILDASimDefaultI2cClockHz = 100000;
+//Status reports the DLL exchanges per I2C transfer on top of the data reports
+const long g_ILDASimDefaultOverheadReports = 1;
+
 //LaserControl Hardware Constants
 
 //Colorspecific Description (add more here and adjust BeamColor enum)
@@ -62,6 +98,29 @@ const int g_LaserSwitchAddress = 0x23;
 //const int g_ShutterAndLaserDACI2CAddress = 0x60; (Real Default, However, factory misprogrammed, will fix later
 const char g_ShutterAndLaserDACI2CAddress = 0x61;
 
+//MCP4728 Single Write Command (channel bits are OR'd in)
+const char g_ILDAMCP4728SingleWriteCmd = 0x41;
+
+//MCP4728 Sequential Write From Channel A (input registers and EEPROM, UDAC clear)
+const char g_ILDAMCP4728SequentialWriteCmd = 0x50;
+
+//MCP4728 Write Command Group (first byte 01000 multi-write, 01010 sequential write)
+const unsigned char g_ILDAMCP4728WriteCmdMask = 0xF8;
+const unsigned char g_ILDAMCP4728MultiWriteCmd = 0x40;
+
+//MCP4728 EEPROM Programming (RDY/BSY is bit 7 of each readback group, high when idle)
+const unsigned char g_ILDAMCP4728ReadyBit = 0x80;
+const double g_ILDAMCP4728EepromTimeoutMs = 100;
+const int g_ILDAMCP4728EepromPollMs = 5;
+//Longest wait for queued work before the commit (a player or DA sequence keeps the queues busy)
+const double g_ILDAMCP4728CommitIdleMs = 1000;
+
+//Power-On Defaults Status Values
+const char* g_ILDADefaultsNotWritten = "Not Written";
+const char* g_ILDADefaultsVerified = "Verified";
+const char* g_ILDADefaultsWriteFailed = "Write Failed";
+const char* g_ILDADefaultsVerifyFailed = "Verify Failed";
+
 //Beam Axis Specific Descriptions (add more here and adjust TiltDirection enum)
 const char* g_ILDAXTiltDescrip = "Horizontal Axis Tilt Control";
 const char* g_ILDAYTiltDescrip = "Vertical Axis Tilt Control";
@@ -74,6 +133,17 @@ const char g_ILDAYTiltDAC12CAddress = 0x4C;
 
 const char g_ILDATiltDACI2CAddresses[(int) dirTotal] = {g_ILDAXTiltDACI2CAddress, g_ILDAYTiltDAC12CAddress};
 
+//DAC8571 Broadcast Address (every DAC8571 on the bus answers)
+const char g_ILDATiltBroadcastAddress = 0x48;
+
+//DAC8571 Control Bytes (Load bits LD1:LD0)
+const char g_ILDADac8571DispCmd = 0x10;   //01: load DAC from I2C data
+const char g_ILDADac8571StoreCmd = 0x00;  //00: store to temporary register
+const char g_ILDADac8571LoadCmd = 0x20;   //10: load DAC from temporary register
+
+//Simulated DAC8571 output at full code (reference times the output stage gain)
+const double g_ILDASimTiltFullScale = 10;
+
 //BeamAxis Specific Negative Switch Address (add more here and adjust TiltDirection enum)
 //GPIO Values
 const int g_ILDAXTiltNegAddress = 3;
@@ -89,6 +159,8 @@ const char* g_Blue445LaserPowerName = "Blue-Laser-445nm";  //State Device (has a
 const char* g_SystemShutterName = "System-Shutter";  //State Device (has a fixed value set) no programattic setting of range
 const char* g_XTiltName = "X-Tilt";  //State Device (has a fixed value set) no programattic setting of range
 const char* g_YTiltName = "Y-Tilt";  //State Device (has a fixed value set) no programattic setting of range
+const char* g_GalvoName = "XY-Galvo";
+const char* g_PlayerName = "ILDA-Player";
 
 //Color Specific Class Names Array
 const char* g_ILDALaserNames[(int) colorTotal] = {g_Red637LaserPowerName, g_Green532LaserPowerName, g_Blue445LaserPowerName};
@@ -100,31 +172,109 @@ const char* g_ILDATiltNames[(int) dirTotal] = {g_XTiltName, g_YTiltName};
 
 const long g_MaxLaserResolution = 4096;
 
-bool ILDABinaryFunctor::bigEndian_ = false;
-bool ILDABinaryFunctor::endianCheck_ = false;
+//Laser power calibration property (also read from the module settings file)
+const char* g_ILDALaserCalibrationProp = "Power Calibration (V:mW)";
+
+//MCP4728 Output Range (laser and shutter channels)
+const double g_ILDAMCP4728VoltageMax = 5;
+
+//Per ILDAMCP4728Range: property label, full scale and VREF/gain bits of the upper data byte
+const char* g_ILDAMCP4728RangeNames[mcp4728RangeTotal] = { "0-5 V (VDD)", "0-2.048 V (Internal x1)", "0-4.096 V (Internal x2)" };
+const double g_ILDAMCP4728RangeVolts[mcp4728RangeTotal] = { g_ILDAMCP4728VoltageMax, 2.048, 4.096 };
+const unsigned char g_ILDAMCP4728RangeBits[mcp4728RangeTotal] = { 0x00, g_ILDAMCP4728VrefBit, g_ILDAMCP4728VrefBit | g_ILDAMCP4728GainBit };
+
+//Encoder Micro-Benchmark (samples per pass, minimum run time)
+const unsigned int g_ILDAEncoderBenchmarkSamples = 65536;
+const double g_ILDAEncoderBenchmarkMs = 250;
+
+//Preset Property Values
+const char* g_ILDAPresetNone = "None";
+const char* g_ILDAPresetDefaultName = "Preset 1";
+//Presets are kept here between sessions, one "name=r,g,b,shutter,x,y" line each (empty: not kept)
+const char* g_ILDAPresetDefaultFile = "ILDAPresets.txt";
+
+//System Shutter MCP4728 Codes (open matches ILDASystemShutter at full scale)
+const unsigned int g_ILDAShutterOpenCode = g_MaxLaserResolution - 1;
+const unsigned int g_ILDAShutterClosedCode = 0;
+
+//Tilt DA Sequencing
+const long g_ILDATiltMaxSequenceLength = 16384;
+const double g_ILDATiltDefaultSequenceRateHz = 1000;
+const double g_ILDATiltMaxSequenceRateHz = 100000;
+
+//Playback sleeps until this close to a deadline, then spins (OS sleep granularity)
+const long long g_ILDASequenceSpinNs = 2000000;
+
+//ILDA Playback (12k points per second is the ILDA test pattern rate)
+const double g_ILDAPlayerDefaultPointRate = 12000;
+const double g_ILDAPlayerMaxPointRate = 100000;
+const char* g_ILDAPlayerStopped = "Stopped";
+const char* g_ILDAPlayerPlaying = "Playing";
+//Files up to this many points are encoded in full before the first point goes out
+const size_t g_ILDAPlayerMaxPackedPoints = 1048576;
+
+//Frame Cache Arena (points, 7 bytes each)
+const long g_ILDAFrameCacheDefaultPoints = 65536;
+const long g_ILDAFrameCacheMaxPoints = 4194304;
+
+//Bus Scheduling Classes (ILDABusPriority order)
+const char* g_ILDABusPriorityNames[busPriorityTotal] = { "Safety", "Interactive", "Bulk" };
+//Bus Latency Property Names (ILDABusTarget and ILDABusOutcome order)
+const char* g_ILDABusTargetNames[busTargetTotal] = { "MCP4728", "DAC8571 X", "DAC8571 Y", "DAC8571 Broadcast", "GPIO" };
+const char* g_ILDABusOutcomeNames[busOutcomeTotal] = { "OK", "Retried", "Failed" };
+const char* g_ILDABusLatencyStatNames[4] = { "Count", "p50 (us)", "p99 (us)", "Max (us)" };
+
+//Bus Trace Defaults (the Chrome trace JSON is written next to the dump)
+const char* g_ILDABusTraceDefaultFile = "ILDABusTrace.trc";
+const char* g_ILDABusTraceJsonSuffix = ".json";
+
+//Trace Replay Property Names
+const char* g_ILDAReplayOriginal = "Replay Original Timing";
+const char* g_ILDAReplayFast = "Replay As Fast As Possible";
+const char* g_ILDAReplayOptionNames[3] = { "Replay Skip Redundant", "Replay Coalesce", "Replay Batch" };
+const char* g_ILDAReplayStatNames[9] = { "Replay Transfers", "Replay Skipped", "Replay Coalesced", "Replay Merged",
+	"Replay Bus Time (ms)", "Replay Span (ms)", "Replay Latency p50 (us)", "Replay Latency p99 (us)", "Replay Latency Max (us)" };
+
+//Scan batches take the bus lock for at most this many ops (or this much dwell) at a time
+const unsigned int g_ILDABusSliceOps = 64;
+const double g_ILDABusSliceDwellUs = 5000;
+
+//Upper bound on the ops one tilt move adds to a batch (zero X, zero Y, store X, store Y, GPIO, load)
+const int g_ILDATiltMoveMaxOps = 6;
+
+//Scans up to this many points keep their built ops for replay (larger ones are built slice by slice)
+const int g_ILDAScanOpsMaxPoints = 262144;
 
 //Binary Command References
 //Corresponds to cmdType enum index of class
-const char ILDAMCP4271::writeCmds_[] = { 0x41, 0x00 };
+const char ILDAMCP4271::writeCmds_[] = { g_ILDAMCP4728SingleWriteCmd, 0x00 };
 
-const char ILDADac8571::writeCmds_[] = { 0x10 };
+const char ILDADac8571::writeCmds_[] = { g_ILDADac8571DispCmd, g_ILDADac8571StoreCmd, g_ILDADac8571LoadCmd };
 
 
 // static lock
 //MMThreadLock ILDAHub::lock_;
 
-//Endianness Test
-bool ILDAIsBigEndian( void)
+//Raises the calling playback thread above the default scheduler quantum
+void ILDARaisePlaybackPriority( void)
 {
-  int num = 1;
-  if(*(char *)&num == 1)
-  {
-    return false;
-  }
-  else
-  {
-    return true;
-  }
+#ifdef WIN32
+	SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL );
+#endif
+}
+
+//Sleeps off most of the wait, spins the remainder
+void ILDAWaitUntil( std::chrono::steady_clock::time_point deadline )
+{
+	std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+	if( remaining > std::chrono::nanoseconds( g_ILDASequenceSpinNs ) )
+	{
+		std::this_thread::sleep_for( remaining - std::chrono::nanoseconds( g_ILDASequenceSpinNs ) );
+	}
+	while( std::chrono::steady_clock::now() < deadline )
+	{
+		//spin
+	}
 }
 
 
@@ -141,6 +291,8 @@ MODULE_API void InitializeModuleData()
    RegisterDevice(g_SystemShutterName, MM::ShutterDevice, "System Shutter Control");
    RegisterDevice(g_XTiltName, MM::SignalIODevice, "Beam X Tilt");
    RegisterDevice(g_YTiltName, MM::SignalIODevice, "Beam Y Tilt");
+   RegisterDevice(g_GalvoName, MM::GalvoDevice, "Beam XY Galvo (Point and Shoot)");
+   RegisterDevice(g_PlayerName, MM::GenericDevice, "ILDA (.ild) File Player");
 }
 
 MODULE_API MM::Device* CreateDevice(const char* deviceName)
@@ -176,6 +328,14 @@ MODULE_API MM::Device* CreateDevice(const char* deviceName)
    {
 	  return new ILDABeamTilt(y, (unsigned long) pow(2.0, 16.0));
    }
+   else if (strcmp(deviceName, g_GalvoName) == 0)
+   {
+      return new ILDAGalvo();
+   }
+   else if (strcmp(deviceName, g_PlayerName) == 0)
+   {
+      return new ILDAPlayer();
+   }
    
    return nullptr;
 }
@@ -201,8 +361,83 @@ ILDAHub::ILDAHub() :
 	  vid_(MCP2221_DEFAULT_VID),
 	  pid_(MCP2221_DEFAULT_PID),
 	  handle_(nullptr),
-	  shutterState_(0)
+	  bridgeIndex_(-1),
+	  detectionMs_(0),
+	  detectionPath_(g_ILDADetectFailed),
+	  warmStart_(false),
+	  warmStartSeeded_(0),
+	  shutterState_(0),
+	  transport_(nullptr),
+	  transportName_(g_ILDATransportMCP2221),
+	  simReportLatencyUs_(g_ILDASimDefaultReportLatencyUs),
+	  simI2cClockHz_(g_ILDASimDefaultI2cClockHz),
+	  simOverheadReports_(g_ILDASimDefaultOverheadReports),
+	  simMcp4728_(nullptr),
+	  mcp4728Deferred_(false),
+	  powerOnDefaultsStatus_(g_ILDADefaultsNotWritten),
+	  worker_(nullptr),
+	  workerSleeping_(false),
+	  stopWorker_(false),
+	  asyncFailures_(0),
+	  asynchronous_(false),
+	  submitSequence_(0),
+	  executedSequence_(0),
+	  batchPreempted_(0),
+	  transferRetrying_(false),
+	  transferFailedUs_(0),
+	  traceClient_(hubClient),
+	  traceAttempt_(0),
+	  busTraceFile_(g_ILDABusTraceDefaultFile),
+	  busTraceStatus_(ILDABusTrace::GetResultText( ildaTraceOk )),
+	  redundantSkipped_(0),
+	  forceRefresh_(false),
+	  tiltCoalesced_(0),
+	  tiltCoalescing_(false),
+	  stopBatch_(false),
+	  compiledDwellUs_(0),
+	  compiledIlluminate_(false),
+	  compiledRangeBits_(0),
+	  frameCache_(g_ILDAFrameCacheDefaultPoints),
+	  encoderThroughput_(0),
+	  presetName_(g_ILDAPresetDefaultName),
+	  presetApplied_(g_ILDAPresetNone),
+	  presetFile_(g_ILDAPresetDefaultFile),
+	  presetGeneration_(0)
 {
+   for( int i = 0; i < MCP4728_CHANNELS; i++ )
+   {
+      mcp4728Codes_[i] = 0;
+      mcp4728Pending_[i] = false;
+      mcp4728Range_[i] = mcp4728RangeVdd;
+      mcp4728RangeCommitted_[i] = false;
+      mcp4728Converters_[i].Configure( 0, g_ILDAMCP4728VoltageMax, g_MaxLaserResolution, false );
+   }
+
+   for( int i = 0; i < busClientTotal; i++ )
+   {
+      pending_[i] = 0;
+   }
+
+   for( int i = 0; i < busPriorityTotal; i++ )
+   {
+      classPending_[i] = 0;
+      classExecuted_[i] = 0;
+      classWaitTotalUs_[i] = 0;
+      classWaitMaxUs_[i] = 0;
+   }
+
+   //Nothing is known about the outputs until they are written
+   InvalidateShadow( ~0u );
+
+   for( int i = 0; i < dirTotal; i++ )
+   {
+      tiltLatest_[i] = 0;
+      tiltRetries_[i] = 1;
+      tiltQueued_[i] = false;
+      tiltDacs_[i] = nullptr;
+      simTilt_[i] = nullptr;
+      tiltXY_[i] = 0;
+   }
 
    InitializeDefaultErrorMessages();
 
@@ -221,6 +456,28 @@ ILDAHub::ILDAHub() :
 
    pAct = new CPropertyAction(this, &ILDAHub::OnPID);
    CreateProperty("Device Product ID", NumToToken(MCP2221_DEFAULT_PID), MM::Integer, false, pAct, true);
+
+   //Filled in by detection, saving the configuration keeps them for the next startup
+   pAct = new CPropertyAction(this, &ILDAHub::OnBridgeSerial);
+   CreateProperty("Bridge Serial Number", "", MM::String, false, pAct, true);
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnBridgeIndex);
+   CreateProperty("Bridge Index", "-1", MM::Integer, false, pAct, true);
+
+   //Warm keeps whatever the outputs hold (restart mid-experiment without glitches)
+   pAct = new CPropertyAction(this, &ILDAHub::OnStartMode);
+   CreateProperty("Start Mode", g_ILDAStartCold, MM::String, false, pAct, true);
+   AddAllowedValue("Start Mode", g_ILDAStartCold);
+   AddAllowedValue("Start Mode", g_ILDAStartWarm);
+
+   //Bus Backend (Simulated runs without the bridge attached)
+   pAct = new CPropertyAction(this, &ILDAHub::OnTransport);
+   CreateProperty("Transport", g_ILDATransportMCP2221, MM::String, false, pAct, true);
+   AddAllowedValue("Transport", g_ILDATransportMCP2221);
+   AddAllowedValue("Transport", g_ILDATransportSimulated);
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnPresetFile);
+   CreateProperty("Preset File", g_ILDAPresetDefaultFile, MM::String, false, pAct, true);
 	
 }
 
@@ -229,8 +486,16 @@ void ILDAHub::GetName(char* pName) const
    CDeviceUtils::CopyLimitedString(pName, g_ILDAHubName);
 }
 	  
+//Busy while any device still has bus work queued
 bool ILDAHub::Busy()
 {
+	for( int i = 0; i < busClientTotal; i++ )
+	{
+		if( pending_[i].load() > 0 )
+		{
+			return true;
+		}
+	}
 	return false;
 }
 
@@ -243,15 +508,351 @@ int ILDAHub::Initialize()
 
    //   MMThreadGuard myLock(lock_);
 
-   if( MM::CanCommunicate == DetectDevice() )
+   if( transportName_ == g_ILDATransportSimulated )
    {
-     initialized_ = true;
-
-     return DEVICE_OK;
+     ILDASimulatedTransport* sim = new ILDASimulatedTransport( simReportLatencyUs_, simI2cClockHz_, (unsigned int) simOverheadReports_ );
+     transport_ = sim;
+     transport_->SetMonitor( this );
+
+     //Frames are decoded by the chips they address, so readback and EEPROM timing behave as on hardware
+     simMcp4728_ = new ILDAMCP4728Model( g_ShutterAndLaserDACI2CAddress );
+     sim->AttachDevice( simMcp4728_ );
+     for( int i = 0; i < dirTotal; i++ )
+     {
+        simTilt_[i] = new ILDADac8571Model( g_ILDATiltDACI2CAddresses[i], g_ILDATiltBroadcastAddress, g_ILDASimTiltFullScale );
+        sim->AttachDevice( simTilt_[i] );
+     }
+     detectionMs_ = 0;
+     detectionPath_ = g_ILDADetectSimulated;
+
+     ret = CreateSimulatedProperties();
+     if (DEVICE_OK != ret)
+        return ret;
    }
-   
+   else if( MM::CanCommunicate == DetectDevice() )
+   {
+     transport_ = new ILDAMcp2221Transport( handle_ );
+     transport_->SetMonitor( this );
+   }
+   else
+   {
       return DEVICE_ERR;
+   }
+
+   //Same conversion as the X-Tilt/Y-Tilt devices
+   for( int i = 0; i < dirTotal; i++ )
+   {
+      tiltDacs_[i] = new ILDADac8571( (TiltDirection) i, (unsigned long) pow(2.0, 16.0) );
+      tiltDacs_[i]->SetHub( this );
+   }
+
+   ConfigureEncoder();
+
+   //Before any device initialises, so their first writes already see the hardware state
+   if( warmStart_ )
+   {
+      ReadBackOutputs();
+   }
+
+   ret = CreateBusProperties();
+   if (DEVICE_OK != ret)
+      return ret;
+
+   StartWorker();
+
+   initialized_ = true;
+
+   return DEVICE_OK;
+}
+
+int ILDAHub::CreateBusProperties()
+{
+   CPropertyAction* pAct = new CPropertyAction(this, &ILDAHub::OnMCP4728WriteMode);
+   int ret = CreateProperty("Laser DAC Write Mode", g_ILDAMCP4728WriteSingle, MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Laser DAC Write Mode", g_ILDAMCP4728WriteSingle);
+   AddAllowedValue("Laser DAC Write Mode", g_ILDAMCP4728WriteDeferred);
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnMCP4728Commit);
+   ret = CreateProperty("Laser DAC Commit", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Laser DAC Commit", "Idle");
+   AddAllowedValue("Laser DAC Commit", "Commit");
+
+   //Current laser and shutter codes become what the board powers up with
+   pAct = new CPropertyAction(this, &ILDAHub::OnPowerOnDefaults);
+   ret = CreateProperty("Laser DAC Power-On Defaults", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Laser DAC Power-On Defaults", "Idle");
+   AddAllowedValue("Laser DAC Power-On Defaults", "Commit");
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnPowerOnDefaultsStatus);
+   ret = CreateProperty("Laser DAC Power-On Defaults Status", g_ILDADefaultsNotWritten, MM::String, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Asynchronous writes return immediately, device Busy() stays true until sent
+   pAct = new CPropertyAction(this, &ILDAHub::OnBusMode);
+   ret = CreateProperty("Bus Mode", "Synchronous", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Bus Mode", "Synchronous");
+   AddAllowedValue("Bus Mode", "Asynchronous");
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnQueueDepth);
+   ret = CreateProperty("Bus Queue Depth", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Per scheduling class: commands waiting, worst and mean time from submit to bus
+   for( long i = 0; i < busPriorityTotal; i++ )
+   {
+      std::string name = g_ILDABusPriorityNames[i];
+      const std::string statNames[3] = { "Bus Queue Depth (" + name + ")",
+         "Bus Max Wait (" + name + ") (us)", "Bus Mean Wait (" + name + ") (us)" };
+      for( long stat = 0; stat < 3; stat++ )
+      {
+         CPropertyActionEx* pExAct = new CPropertyActionEx(this, &ILDAHub::OnBusClassStat, i * 3 + stat);
+         ret = CreateProperty(statNames[stat].c_str(), "0", (stat == 0) ? MM::Integer : MM::Float, true, pExAct);
+         if (DEVICE_OK != ret)
+            return ret;
+      }
+   }
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnBatchPreempted);
+   ret = CreateProperty("Scan Batches Preempted", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Per-transfer latency, e.g. "Bus Latency MCP4728 Retried p99 (us)"
+   for( long target = 0; target < busTargetTotal; target++ )
+   {
+      for( long outcome = 0; outcome < busOutcomeTotal; outcome++ )
+      {
+         for( long stat = 0; stat < 4; stat++ )
+         {
+            std::string name = std::string("Bus Latency ") + g_ILDABusTargetNames[target] + " " +
+               g_ILDABusOutcomeNames[outcome] + " " + g_ILDABusLatencyStatNames[stat];
+            CPropertyActionEx* pExAct = new CPropertyActionEx(this, &ILDAHub::OnBusLatencyStat,
+               (target * busOutcomeTotal + outcome) * 4 + stat);
+            ret = CreateProperty(name.c_str(), "0", (stat == 0) ? MM::Integer : MM::Float, true, pExAct);
+            if (DEVICE_OK != ret)
+               return ret;
+         }
+      }
+   }
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnBusLatencyReset);
+   ret = CreateProperty("Bus Latency Reset", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Bus Latency Reset", "Idle");
+   AddAllowedValue("Bus Latency Reset", "Reset");
+
+   //Every transfer is kept in a fixed ring, Dump writes it out, Export also converts it to Chrome trace JSON
+   pAct = new CPropertyAction(this, &ILDAHub::OnBusTraceFile);
+   ret = CreateProperty("Bus Trace File", g_ILDABusTraceDefaultFile, MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnBusTraceAction);
+   ret = CreateProperty("Bus Trace", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Bus Trace", "Idle");
+   AddAllowedValue("Bus Trace", "Dump");
+   AddAllowedValue("Bus Trace", "Export Chrome Trace");
+   AddAllowedValue("Bus Trace", "Clear");
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnBusTraceRecords);
+   ret = CreateProperty("Bus Trace Records", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnBusTraceStatus);
+   ret = CreateProperty("Bus Trace Status", busTraceStatus_.c_str(), MM::String, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Replays the trace file on a simulated bridge, the options model what-if changes
+   pAct = new CPropertyAction(this, &ILDAHub::OnReplay);
+   ret = CreateProperty("Bus Trace Replay", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Bus Trace Replay", "Idle");
+   AddAllowedValue("Bus Trace Replay", g_ILDAReplayOriginal);
+   AddAllowedValue("Bus Trace Replay", g_ILDAReplayFast);
+
+   for( long i = 0; i < 3; i++ )
+   {
+      CPropertyActionEx* pExAct = new CPropertyActionEx(this, &ILDAHub::OnReplayOption, i);
+      ret = CreateProperty(g_ILDAReplayOptionNames[i], "Off", MM::String, false, pExAct);
+      if (DEVICE_OK != ret)
+         return ret;
+      AddAllowedValue(g_ILDAReplayOptionNames[i], "Off");
+      AddAllowedValue(g_ILDAReplayOptionNames[i], "On");
+   }
+
+   for( long i = 0; i < 9; i++ )
+   {
+      CPropertyActionEx* pExAct = new CPropertyActionEx(this, &ILDAHub::OnReplayStat, i);
+      ret = CreateProperty(g_ILDAReplayStatNames[i], "0", (i < 4) ? MM::Integer : MM::Float, true, pExAct);
+      if (DEVICE_OK != ret)
+         return ret;
+   }
 
+   pAct = new CPropertyAction(this, &ILDAHub::OnAsyncFailures);
+   ret = CreateProperty("Async Write Failures", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Off: skip writes matching the shadow, Once: resend everything next time, Always: never skip
+   pAct = new CPropertyAction(this, &ILDAHub::OnForceRefresh);
+   ret = CreateProperty("Force Refresh", "Off", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Force Refresh", "Off");
+   AddAllowedValue("Force Refresh", "Once");
+   AddAllowedValue("Force Refresh", "Always");
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnRedundantSkipped);
+   ret = CreateProperty("Redundant Writes Skipped", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Only collapses anything while the bus is asynchronous
+   pAct = new CPropertyAction(this, &ILDAHub::OnTiltCoalescing);
+   ret = CreateProperty("Tilt Coalescing", "Off", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Tilt Coalescing", "Off");
+   AddAllowedValue("Tilt Coalescing", "On");
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnTiltCoalesced);
+   ret = CreateProperty("Tilt Updates Coalesced", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //"x,y" in volts, both axes update at the same instant
+   pAct = new CPropertyAction(this, &ILDAHub::OnTiltXY);
+   ret = CreateProperty("Tilt XY (V)", "0,0", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Pre-quantised scan cache (resizing empties it)
+   pAct = new CPropertyAction(this, &ILDAHub::OnFrameCacheSize);
+   ret = CreateProperty("Frame Cache Size (points)", NumToToken(g_ILDAFrameCacheDefaultPoints), MM::Integer, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   SetPropertyLimits("Frame Cache Size (points)", 0, g_ILDAFrameCacheMaxPoints);
+
+   const char* cacheStats[3] = { "Frame Cache Hits", "Frame Cache Misses", "Frame Cache Evictions" };
+   for( long i = 0; i < 3; i++ )
+   {
+      CPropertyActionEx* pExAct = new CPropertyActionEx(this, &ILDAHub::OnFrameCacheStat, i);
+      ret = CreateProperty(cacheStats[i], "0", MM::Integer, true, pExAct);
+      if (DEVICE_OK != ret)
+         return ret;
+   }
+
+   //Batch encoder micro-benchmark (Run encodes a synthetic waveform and reports samples/s)
+   ret = CreateProperty("Encoder Instruction Set", ILDABatchEncoder::GetInstructionSet(), MM::String, true);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnEncoderBenchmark);
+   ret = CreateProperty("Encoder Benchmark", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Encoder Benchmark", "Idle");
+   AddAllowedValue("Encoder Benchmark", "Run");
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnEncoderThroughput);
+   ret = CreateProperty("Encoder Throughput (samples/s)", "0", MM::Float, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Startup cost of finding the bridge, and which path found it
+   pAct = new CPropertyAction(this, &ILDAHub::OnDetectionTime);
+   ret = CreateProperty("Detection Time (ms)", "0", MM::Float, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnDetectionPath);
+   ret = CreateProperty("Detection Path", g_ILDADetectFailed, MM::String, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnWarmStartSeeded);
+   ret = CreateProperty("Warm Start Registers Seeded", "0", MM::Integer, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   //Presets: select a name, then Save the current outputs or write "r,g,b,shutter,x,y" (volts, shutter 0/1)
+   pAct = new CPropertyAction(this, &ILDAHub::OnPresetName);
+   ret = CreateProperty("Preset Name", g_ILDAPresetDefaultName, MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnPresetDefinition);
+   ret = CreateProperty("Preset Definition", "", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnPresetAction);
+   ret = CreateProperty("Preset Action", "Idle", MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   AddAllowedValue("Preset Action", "Idle");
+   AddAllowedValue("Preset Action", "Save");
+   AddAllowedValue("Preset Action", "Delete");
+
+   //Setting a preset name applies it
+   if( ReadPresetFile() != DEVICE_OK )
+   {
+      LogMessage("Presets could not be read from " + presetFile_, false);
+   }
+   pAct = new CPropertyAction(this, &ILDAHub::OnPreset);
+   ret = CreateProperty("Preset", g_ILDAPresetNone, MM::String, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   RefreshPresetList();
+
+   return DEVICE_OK;
+}
+
+//Callers hold stageLock_ (or are still initialising), the player encodes under it
+void ILDAHub::ConfigureEncoder()
+{
+   if( !tiltDacs_[x] || !tiltDacs_[y] )
+   {
+      return;
+   }
+
+   const ILDACodeConverter* converters[encoderChannelTotal] = { &tiltDacs_[x]->GetConverter(), &tiltDacs_[y]->GetConverter(),
+      &mcp4728Converters_[g_ILDALaserDACChannelBits[red637] >> 1], &mcp4728Converters_[g_ILDALaserDACChannelBits[green532] >> 1],
+      &mcp4728Converters_[g_ILDALaserDACChannelBits[blue445] >> 1] };
+   encoder_.Configure( converters, g_ILDADac8571DispCmd );
+}
+
+//Under stageLock_, so a range change cannot reconfigure the encoder part way through a batch
+void ILDAHub::EncodeSamples(const float * const channels[encoderChannelTotal], unsigned int count, ILDAEncodedSample * out)
+{
+   std::lock_guard<std::mutex> guard( stageLock_ );
+   encoder_.Encode( channels, count, out );
+}
+
+void ILDAHub::RefreshPresetList()
+{
+   ClearAllowedValues("Preset");
+   AddAllowedValue("Preset", g_ILDAPresetNone);
+   for( std::map<std::string, ILDAPreset>::const_iterator it = presets_.begin(); it != presets_.end(); ++it )
+   {
+      AddAllowedValue("Preset", it->first.c_str());
+   }
 }
 
 /*HMODULE GetCurrentModule()
@@ -270,6 +871,29 @@ int ILDAHub::Shutdown()
 {
 	initialized_ = false;
 
+	//Queued writes are still sent before the transport goes away
+	StopWorker();
+
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		delete tiltDacs_[i];
+		tiltDacs_[i] = nullptr;
+	}
+
+	if( transport_ )
+	{
+		delete transport_;
+		transport_ = nullptr;
+	}
+
+	delete simMcp4728_;
+	simMcp4728_ = nullptr;
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		delete simTilt_[i];
+		simTilt_[i] = nullptr;
+	}
+
 
 
 /*   wchar_t dllPath[200];
@@ -291,6 +915,7 @@ int ILDAHub::Shutdown()
 			//May want to stop the process completely
 			LogMessage("Error: Device Could Not Be Closed.", false);
 		}
+		handle_ = nullptr;
 	}
 
 	
@@ -306,7 +931,7 @@ int ILDAHub::DetectInstalledDevices()
    // make sure this method is called before we look for available devices
    InitializeModuleData();
    
-   if ( handle_ ) 
+   if ( transport_ ) 
    {
       std::vector<std::string> peripherals; 
       peripherals.clear();
@@ -316,6 +941,8 @@ int ILDAHub::DetectInstalledDevices()
       peripherals.push_back(g_SystemShutterName);
       peripherals.push_back(g_XTiltName);
 	  peripherals.push_back(g_YTiltName);
+      peripherals.push_back(g_GalvoName);
+      peripherals.push_back(g_PlayerName);
       for (size_t i=0; i < peripherals.size(); i++) 
       {
          MM::Device* pDev = ::CreateDevice(peripherals[i].c_str());
@@ -404,9 +1031,110 @@ int ILDAHub::VerifiedClose(void* &ptr, int retries)
   return result;
 }			
 
+//Known bridge first (open handle, serial number, last index), full enumeration only if those miss
 MM::DeviceDetectionStatus ILDAHub::DetectDevice( int retries )
 {
 	LogMessage("In Detect Device", false);
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	MM::DeviceDetectionStatus result = MM::CanCommunicate;
+	if( !OpenKnownBridge() )
+	{
+		result = EnumerateBridges( retries );
+		detectionPath_ = (result == MM::CanCommunicate) ? g_ILDADetectEnumeration : g_ILDADetectFailed;
+	}
+
+	detectionMs_ = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+
+	std::ostringstream o;
+	o << "Bridge detection (" << detectionPath_ << ") took " << detectionMs_ << " ms";
+	LogMessage(o.str().c_str(), false);
+
+	return result;
+}
+
+bool ILDAHub::OpenKnownBridge()
+{
+	//Still open from an earlier detection (Hardware Configuration Wizard, then Initialize)
+	if( handle_ )
+	{
+		if( IsILDABridge( handle_ ) )
+		{
+			detectionPath_ = g_ILDADetectOpenHandle;
+			return true;
+		}
+		VerifiedClose( handle_ );
+		handle_ = nullptr;
+	}
+
+	if( !bridgeSerial_.empty() )
+	{
+		std::wstring serial( bridgeSerial_.begin(), bridgeSerial_.end() );
+		void* ptr = Mcp2221_OpenBySN( (unsigned int)vid_, (unsigned int)pid_, &serial[0] );
+		if( ptr && ptr != INVALID_HANDLE_VALUE )
+		{
+			if( IsILDABridge( ptr ) )
+			{
+				handle_ = ptr;
+				detectionPath_ = g_ILDADetectSerial;
+				return true;
+			}
+			VerifiedClose( ptr );
+		}
+	}
+
+	//Serial enumeration can be switched off in the MCP2221 flash, the index still works then
+	if( bridgeIndex_ >= 0 )
+	{
+		void* ptr = nullptr;
+		if( VerifyListedDevice( (unsigned int) bridgeIndex_, ptr ) == DEVICE_OK )
+		{
+			if( IsILDABridge( ptr ) )
+			{
+				handle_ = ptr;
+				RememberBridge( ptr, (unsigned int) bridgeIndex_ );
+				detectionPath_ = g_ILDADetectIndex;
+				return true;
+			}
+			VerifiedClose( ptr );
+		}
+	}
+
+	return false;
+}
+
+//Ensure the Device is ILDA-Scientific
+bool ILDAHub::IsILDABridge(void* handle)
+{
+	wchar_t descriptor[MM::MaxStrLength];
+	char shortdescriptor[MM::MaxStrLength];
+
+	if( Mcp2221_GetProductDescriptor(handle, descriptor) != 0 )
+	{
+		return false;
+	}
+	wcstombs(shortdescriptor, descriptor, MM::MaxStrLength);
+
+	return strcmp(shortdescriptor, g_ILDADefaultDescriptor) == 0;
+}
+
+void ILDAHub::RememberBridge(void* handle, unsigned int index)
+{
+	wchar_t serial[MM::MaxStrLength];
+	char shortSerial[MM::MaxStrLength];
+
+	bridgeIndex_ = (long) index;
+	if( Mcp2221_GetSerialNumberDescriptor(handle, serial) == 0 )
+	{
+		wcstombs(shortSerial, serial, MM::MaxStrLength);
+		bridgeSerial_ = shortSerial;
+	}
+}
+
+MM::DeviceDetectionStatus ILDAHub::EnumerateBridges( int retries )
+{
    //return MM::CanCommunicate;
 
    /*if (initialized_)
@@ -451,22 +1179,13 @@ MM::DeviceDetectionStatus ILDAHub::DetectDevice( int retries )
 		  {
 
 			LogMessage("returned a valid device");
-			//Ensure the Device is ILDA-Scientific
-			wchar_t descriptor[MM::MaxStrLength];
-			char shortdescriptor[MM::MaxStrLength];
 
-		    Mcp2221_GetProductDescriptor(ptr, descriptor);
-			wcstombs(shortdescriptor, descriptor, MM::MaxStrLength);
-
-			o << "Descriptor is: " << shortdescriptor;
-
-			LogMessage(o.str().c_str(), false);
-
-		    if( strcmp(shortdescriptor, g_ILDADefaultDescriptor) == 0 )
+		    if( IsILDABridge(ptr) )
 		    {
 			  //Device has been found
 				LogMessage("Found Device");
 			  handle_ = ptr;
+			  RememberBridge(ptr, i);
 			  result = MM::CanCommunicate;
 			  break;
 		    }
@@ -495,10 +1214,10 @@ MM::DeviceDetectionStatus ILDAHub::DetectDevice( int retries )
 	   LogMessage("Exception in DetectDevice!", false);
    }
 
-   //Try to call DetectDevice once more to resituate pointers and find ILDA-Scientific
+   //Try to enumerate once more to resituate pointers and find ILDA-Scientific
    if(retries >0 && result != MM::CanCommunicate && ptrFails > 0)
    {
-	  result = DetectDevice(retries--);
+	  result = EnumerateBridges(retries - 1);
    }
 
    return result;
@@ -507,263 +1226,3731 @@ MM::DeviceDetectionStatus ILDAHub::DetectDevice( int retries )
 
 int ILDAHub::I2Cwrite(int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData)
 {
+	if( !transport_ )
+	{
+		return DEVICE_NOT_CONNECTED;
+	}
 
-	return Mcp2221_I2cWrite(handle_, dataLen, slaveAddress, use7bitAddress, i2cTxData);
+	return transport_->I2cWrite(dataLen, slaveAddress, use7bitAddress, i2cTxData);
 }
 
 //Accepts The Pin number (i.e. GPIO 3) as declared in the constants and writes to it
 int ILDAHub::GPIOwrite(int pinIndex, bool isLow)
 {
-	//Default no change values
-	unsigned char modGpioPins[5] = { 0xFF, 0xFF, 0xFF, 0xFF };
-
-	if(isLow)
+	if( pinIndex < 0 || pinIndex >= MCP2221_GPIO_TOTAL )
 	{
-	  LogMessage("Should Be seting Pin High right now");
+		return DEVICE_INVALID_INPUT_PARAM;
 	}
-	else
+
+	//Default no change values
+	unsigned char modGpioPins[MCP2221_GPIO_TOTAL] = { 0xFF, 0xFF, 0xFF, 0xFF };
+	modGpioPins[pinIndex] = (isLow) ? 0x00 : 0x01;
+	ILDA_TRACE_WRITE( (isLow) ? "GPIO write: pin low" : "GPIO write: pin high" );
+
+	if( !transport_ )
 	{
-		LogMessage("Should Be seting Pin Low right now");
+		return DEVICE_NOT_CONNECTED;
 	}
-	modGpioPins[pinIndex] = (isLow) ? 0x00 : 0x01;
 
-	std::ostringstream os;
-	for( int i = 0; i<4; i++)
+	int ret = transport_->SetGpioValues(modGpioPins);
+	ILDA_TRACE_ERROR( ret );
+	return ret;
+}
+
+//Holds a code for the next fast-write frame
+int ILDAHub::StageMCP4728Code(int channel, unsigned int code)
+{
+	if( channel < 0 || channel >= MCP4728_CHANNELS )
 	{
-	  os << "dataByte " << i << " Is: " << (int) modGpioPins[i] << "\n";
+		return DEVICE_INVALID_INPUT_PARAM;
 	}
-    LogMessage(os.str().c_str(), true);
 
+	std::lock_guard<std::mutex> guard( stageLock_ );
+	mcp4728Codes_[channel] = code & 0x0FFF;
+	mcp4728Pending_[channel] = true;
 
-	return Mcp2221_SetGpioValues(handle_, modGpioPins);
-	
+	return DEVICE_OK;
 }
 
-/*******************************************************************
-Action Handlers
-*******************************************************************/
-int ILDAHub::OnVID(MM::PropertyBase* pProp, MM::ActionType pAct)
+//Stages the channels in channelMask and sends them as one frame (the staging lock is held
+//throughout, so no other thread's staged codes can be split from or reordered with them)
+int ILDAHub::WriteMCP4728Codes(const unsigned int codes[MCP4728_CHANNELS], unsigned int channelMask, int retries, int client)
 {
-   if (pAct == MM::BeforeGet)
-   {
-      pProp->Set(vid_);
-   }
-   else if (pAct == MM::AfterSet)
-   {
-	  double vidDummy;
-      pProp->Get(vidDummy);
-	  if(!vidDummy)
-	  {
-		  LogMessage("Failed to Update Value");
-	  }
-	  else
-	  {
-	    vid_ = (long) vidDummy;
-	  }
-   }
-   return DEVICE_OK;
+	std::lock_guard<std::mutex> guard( stageLock_ );
+	for( int i = 0; i < MCP4728_CHANNELS; i++ )
+	{
+		if( channelMask & (1u << i) )
+		{
+			mcp4728Codes_[i] = codes[i] & 0x0FFF;
+			mcp4728Pending_[i] = true;
+		}
+	}
+	return FlushStaged( retries, client );
 }
 
+//One channel as a single write, skipped when the shadow already holds the code
+int ILDAHub::WriteMCP4728Channel(int channel, unsigned int code, int retries, int client)
+{
+	if( channel < 0 || channel >= MCP4728_CHANNELS )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+
+	std::lock_guard<std::mutex> guard( stageLock_ );
+	if( IsMCP4728RangeCommitted( channel ) && IsRedundant( mcp4728ChannelA + channel, code ) )
+	{
+		return DEVICE_OK;
+	}
 
-int ILDAHub::OnPID(MM::PropertyBase* pProp, MM::ActionType pAct)
+	unsigned char data[3];
+	data[0] = g_ILDAMCP4728SingleWriteCmd | (channel << 1);
+	data[1] = MCP4728UpperByte( channel, code );
+	data[2] = code & 0xFF;
+
+	mcp4728Codes_[channel] = code & 0x0FFF;
+	SetShadow( mcp4728ChannelA + channel, code & 0x0FFF );
+	return SubmitI2cWrite( client, g_ShutterAndLaserDACI2CAddress, data, 3, retries, 1u << (mcp4728ChannelA + channel) );
+}
+
+//VREF, PD1:PD0, gain and code bits 11-8 (multi-write, sequential write and readback layout)
+unsigned char ILDAHub::MCP4728UpperByte(int channel, unsigned int code) const
 {
-   if (pAct == MM::BeforeGet)
-   {
-      pProp->Set(pid_);
-   }
-   else if (pAct == MM::AfterSet)
-   {
-	  double pidDummy;
-      pProp->Get(pidDummy);
-	  if(!pidDummy)
-	  {
-		  LogMessage("Failed to Update Value");
-	  }
-	  else
-	  {
-	    pid_ = (long) pidDummy;
-	  }
-   }
-   return DEVICE_OK;
+	return (unsigned char) (g_ILDAMCP4728RangeBits[mcp4728Range_[channel]] | ((code >> 8) & 0x0F));
 }
 
-/************************************************************
-MCP4721 Base Class Member Functions
-*************************************************************/
-ILDAMCP4271::ILDAMCP4271(unsigned long resolution)
+void ILDAHub::SetMCP4728Range(int channel, int range)
 {
-   //Initialize Base Class Members
-   addressDacI2C_ = g_ShutterAndLaserDACI2CAddress;
-   resolution_ = resolution;
-   voltage_ = 0;
-   writeRetries_ = 1;
-   voltageMax_ = 5;
-   voltageMin_ = 0;
+	std::lock_guard<std::mutex> stageGuard( stageLock_ );
+	MMThreadGuard guard( busLock_ );
+	ApplyMCP4728Range( channel, range );
+}
 
-   //Fixed since Laser controller is static 0-5Volts currently
-   voltageInc_ = (voltageMax_ - voltageMin_) / resolution;
+//The shadow is dropped (which also uncommits the range) so the next write to the channel cannot
+//be skipped, it has to carry the new bits. Callers hold stageLock_ and busLock_.
+void ILDAHub::ApplyMCP4728Range(int channel, int range)
+{
+	mcp4728Range_[channel] = range;
+	mcp4728Converters_[channel].Configure( 0, g_ILDAMCP4728RangeVolts[range], g_MaxLaserResolution, false );
+	InvalidateShadow( 1u << (mcp4728ChannelA + channel) );
+	ConfigureEncoder();
 }
 
-int ILDAMCP4271::SetVoltage(long double setVoltage, WriteCmdTypes writeCmd)
+//Commits the range of every channel a successful MCP4728 frame wrote with its current VREF/gain
+//bits (caller holds busLock_). Multi-write blocks and sequential writes carry them, fast writes do not;
+//a block still holding the bits of an older range leaves the channel uncommitted.
+void ILDAHub::NoteMCP4728Ranges(const unsigned char * data, int dataLen)
 {
-	if (!hub_)
+	const unsigned char rangeMask = g_ILDAMCP4728VrefBit | g_ILDAMCP4728GainBit;
+	int i = 0;
+	while( i < dataLen )
 	{
-	  return DEVICE_COMM_HUB_MISSING;
+		unsigned char cmd = data[i] & g_ILDAMCP4728WriteCmdMask;
+		int channel = (data[i] >> 1) & 0x03;
+		if( cmd == g_ILDAMCP4728MultiWriteCmd && i + 2 < dataLen )
+		{
+			if( (data[i + 1] & rangeMask) == g_ILDAMCP4728RangeBits[mcp4728Range_[channel]] )
+			{
+				mcp4728RangeCommitted_[channel].store( true );
+			}
+			i += 3;
+		}
+		else if( cmd == (unsigned char) g_ILDAMCP4728SequentialWriteCmd )
+		{
+			for( i++; channel < MCP4728_CHANNELS && i + 1 < dataLen; channel++, i += 2 )
+			{
+				if( (data[i] & rangeMask) == g_ILDAMCP4728RangeBits[mcp4728Range_[channel]] )
+				{
+					mcp4728RangeCommitted_[channel].store( true );
+				}
+			}
+			return;
+		}
+		else
+		{
+			return;
+		}
 	}
+}
+
+double ILDAHub::GetLaserVoltageMax(int color) const
+{
+	return g_ILDAMCP4728RangeVolts[ mcp4728Range_[g_ILDALaserDACChannelBits[color] >> 1] ];
+}
 
-    if ( setVoltage >= voltageMax_ )
+//One sequential write programs input registers and EEPROM of all four channels,
+//then the EEPROM half of the readback has to match byte for byte
+int ILDAHub::CommitPowerOnDefaults()
+{
+	if( !WaitForIdle( g_ILDAMCP4728CommitIdleMs ) )
 	{
-	  setVoltage = voltageMax_ - voltageInc_;
+		LogMessage("MCP4728 power-on defaults not written: bus work is still being queued (stop playback first)", false);
+		return DEVICE_ERR;
 	}
 
-	unsigned int voltageCode;
-	voltageCode = (unsigned int) ((setVoltage - voltageMin_) / voltageInc_);
+	//Held until the EEPROM is verified, so no other MCP4728 write is submitted while the chip is busy
+	std::lock_guard<std::mutex> stageGuard( stageLock_ );
 
-	//Write only to one DAC Channel
-	const int dataBytes = 3;
-	unsigned char data[dataBytes + 1];
-	//Determine Command Byte Operation
-	switch(writeCmd)
+	unsigned char data[1 + MCP4728_CHANNELS * 2];
+	int dataBytes = 0;
+	unsigned int shadowMask = 0;
+	data[dataBytes++] = g_ILDAMCP4728SequentialWriteCmd;
+	for( int i = 0; i < MCP4728_CHANNELS; i++ )
 	{
-	  case singleWrite:
-		data[0] = writeCmds_[ writeCmd ] | addressDACChannel_ & ~1;
-		data[1] = (voltageCode >> 8) & 0x0F;
-		data[2] = voltageCode & 0xFF;
-		break;
-	  default:
-		  return DEVICE_ERR;
+		data[dataBytes++] = MCP4728UpperByte( i, mcp4728Codes_[i] );
+		data[dataBytes++] = mcp4728Codes_[i] & 0xFF;
+		shadowMask |= 1u << (mcp4728ChannelA + i);
 	}
 
-	//trasmitbyte switch
-	int i =0, ret;
-	while( i < writeRetries_ )
+	int ret;
+	double deadlineUs;
+	ILDASimulatedTransport* sim = nullptr;
 	{
-	  // Upon Successful Write
-	  ret = hub_->I2Cwrite(dataBytes, addressDacI2C_, true, data);
-	  if( ret == 0  )
-	  {
-		  voltage_ = voltageCode *voltageInc_;
-		  break;
-	  }
+		MMThreadGuard guard( busLock_ );
+		if( !transport_ )
+		{
+			return DEVICE_NOT_CONNECTED;
+		}
+		if( transportName_ == g_ILDATransportSimulated )
+		{
+			sim = static_cast<ILDASimulatedTransport*>(transport_);
+		}
+
+		traceClient_ = hubClient;
+		ret = Transmit( ILDABusCommand::i2cWrite, g_ShutterAndLaserDACI2CAddress, data, dataBytes, 1 );
+		if( ret != 0 )
+		{
+			InvalidateShadow( shadowMask );
+			powerOnDefaultsStatus_ = g_ILDADefaultsWriteFailed;
+			return ret;
+		}
 
-	  i++;
+		//Input registers (and so the outputs) now hold the staged codes as well
+		for( int i = 0; i < MCP4728_CHANNELS; i++ )
+		{
+			SetShadow( mcp4728ChannelA + i, mcp4728Codes_[i] );
+			mcp4728Pending_[i] = false;
+		}
+		deadlineUs = transport_->GetClockUs() + g_ILDAMCP4728EepromTimeoutMs * 1000.0;
 	}
 
-	return ret;
+	//Polled on the transport clock, so the simulated EEPROM write time elapses on the simulated bus.
+	//The bus lock is only held for each readback, the poll interval is waited with no lock held,
+	//so tilt and other bus work carry on while the EEPROM is written.
+	unsigned char readback[g_ILDAMCP4728ReadBytes];
+	bool ready = false;
+	bool timedOut = false;
+	while( !ready && !timedOut )
+	{
+		{
+			MMThreadGuard pollGuard( busLock_ );
+			if( !transport_ )
+			{
+				return DEVICE_NOT_CONNECTED;
+			}
 
-}
+			traceClient_ = hubClient;
+			ret = ReadI2c( g_ILDAMCP4728ReadBytes, g_ShutterAndLaserDACI2CAddress, readback );
+			ready = ret == 0;
+			for( int i = 0; i < MCP4728_CHANNELS && ready; i++ )
+			{
+				ready = (readback[i * 6 + 3] & g_ILDAMCP4728ReadyBit) != 0;
+			}
+			timedOut = !ready && transport_->GetClockUs() >= deadlineUs;
+		}
 
+		if( !ready && !timedOut )
+		{
+			//The simulated clock only counts bus time, so the interval is added to it afterwards
+			//(and only waited for on the wall clock when the simulation runs in real time)
+			if( !sim || sim->GetRealTime() )
+			{
+				std::this_thread::sleep_for( std::chrono::milliseconds( g_ILDAMCP4728EepromPollMs ) );
+			}
+			if( sim )
+			{
+				MMThreadGuard clockGuard( busLock_ );
+				sim->Idle( g_ILDAMCP4728EepromPollMs * 1000.0 );
+			}
+		}
+	}
 
-/***************************************************************
-  ILDALaser Implementation
-  *************************************************************/
+	bool verified = ready;
+	for( int i = 0; i < MCP4728_CHANNELS && verified; i++ )
+	{
+		const unsigned char * eeprom = &readback[i * 6 + 3];
+		verified = eeprom[1] == data[1 + i * 2] && eeprom[2] == data[2 + i * 2];
+	}
 
-ILDALaser::ILDALaser( BeamColor color, unsigned long resolution ) : ILDAMCP4271( resolution ),
-initialized_(false),
-busy_(false),
-addressSwitch_(g_LaserSwitchAddress),
-color_(color),
-powerPos_(0),
-numPos_(16)
+	powerOnDefaultsStatus_ = (verified) ? g_ILDADefaultsVerified : g_ILDADefaultsVerifyFailed;
+	if( !verified )
+	{
+		LogMessage("MCP4728 EEPROM readback does not match the power-on defaults written", false);
+		return DEVICE_ERR;
+	}
+
+	return DEVICE_OK;
+}
+
+//Sends every staged channel in one MCP4728 Fast Write (C2:C1 = 00, PD = 00)
+//Channels are clocked in A->D order, so the frame stops after the highest channel that changes.
+//Lower channels that are not pending are re-sent with the code the shadow says they hold;
+//if any of them is unknown (cold start, failed write), or a channel the frame reaches has not
+//had its range committed, only the pending channels go out, each as its own multi-write block,
+//so nothing unknown is driven to a guessed code and VREF/gain reach the chip.
+int ILDAHub::FlushMCP4728(int retries, int client)
 {
-   //MCP4171 Object Specific Hardware Properties
-   //Color Specific Address Bits
-   addressDACChannel_= g_ILDALaserDACChannelBits[color]; 
+	std::lock_guard<std::mutex> guard( stageLock_ );
+	return FlushStaged( retries, client );
+}
 
+//FlushMCP4728 for callers that already hold stageLock_
+int ILDAHub::FlushStaged(int retries, int client)
+{
+	int last = -1;
+	bool anyPending = false;
+	for( int i = 0; i < MCP4728_CHANNELS; i++ )
+	{
+		if( mcp4728Pending_[i] )
+		{
+			anyPending = true;
+			if( !IsMCP4728RangeCommitted( i ) || !ShadowMatches( mcp4728ChannelA + i, mcp4728Codes_[i] ) )
+			{
+				last = i;
+			}
+		}
+	}
 
-   //
-   addressSwitchChannel_ = g_ILDALaserSwitchChannelBits[color];
+	if( last < 0 )
+	{
+		//Every staged code is already on the chip
+		if( anyPending )
+		{
+			redundantSkipped_++;
+		}
+		for( int j = 0; j < MCP4728_CHANNELS; j++ )
+		{
+			mcp4728Pending_[j] = false;
+		}
+		return DEVICE_OK;
+	}
 
-   // Description
-   int ret = CreateProperty(MM::g_Keyword_Description, g_ILDALaserDescrips[color], MM::String, true);
-   assert(DEVICE_OK == ret);
+	//A fast write also needs every channel it reaches to be on its range already
+	bool lowerKnown = true;
+	for( int i = 0; i <= last && lowerKnown; i++ )
+	{
+		unsigned int shadow;
+		lowerKnown = IsMCP4728RangeCommitted( i ) && (i == last || mcp4728Pending_[i] ||
+			(GetShadow( mcp4728ChannelA + i, shadow ) && shadow == mcp4728Codes_[i]));
+	}
 
-   // Name
-   ret = CreateProperty(MM::g_Keyword_Name, g_ILDALaserNames[color], MM::String, true);
-   assert(DEVICE_OK == ret);
-   
-   name_ =  g_ILDALaserNames[color];
+	unsigned char data[MCP4728_CHANNELS * 3];
+	int dataBytes = 0;
+	unsigned int shadowMask = 0;
+	for( int i = 0; i <= last; i++ )
+	{
+		if( lowerKnown )
+		{
+			//Fast write frames carry the power-down bits only, the range committed before stays
+			data[dataBytes++] = (mcp4728Codes_[i] >> 8) & 0x0F;
+			data[dataBytes++] = mcp4728Codes_[i] & 0xFF;
+		}
+		else if( mcp4728Pending_[i] )
+		{
+			data[dataBytes++] = g_ILDAMCP4728SingleWriteCmd | (i << 1);
+			data[dataBytes++] = MCP4728UpperByte( i, mcp4728Codes_[i] );
+			data[dataBytes++] = mcp4728Codes_[i] & 0xFF;
+		}
+		else
+		{
+			continue;
+		}
+		SetShadow( mcp4728ChannelA + i, mcp4728Codes_[i] );
+		shadowMask |= 1u << (mcp4728ChannelA + i);
+	}
 
-   //Check Endianness
+	int ret = SubmitI2cWrite(client, g_ShutterAndLaserDACI2CAddress, data, dataBytes, retries, shadowMask);
+	if( ret == 0 )
+	{
+		for( int j = 0; j < MCP4728_CHANNELS; j++ )
+		{
+			mcp4728Pending_[j] = false;
+		}
+	}
 
-   if( !endianCheck_ )
-   {
-	   LogMessage("Checking Endianness", false);
-	   bigEndian_ = ILDAIsBigEndian();
-	   endianCheck_ = true;
-   }
+	return ret;
+}
 
-   // parent ID display
-   CreateHubIDProperty();
+/*******************************************************************
+Shadow Registers
+*******************************************************************/
+bool ILDAHub::ShadowMatches(int reg, unsigned int value)
+{
+	if( forceRefresh_ )
+	{
+		return false;
+	}
 
+	unsigned int shadow = shadow_[reg].load();
+	return shadow != shadowInvalid_ && shadow == value;
 }
 
-void ILDALaser::GetName(char* pName) const
+//False while nothing is known about the register
+bool ILDAHub::GetShadow(int reg, unsigned int& value)
 {
-   CDeviceUtils::CopyLimitedString(pName, name_.c_str());
+	unsigned int shadow = shadow_[reg].load();
+	if( shadow == shadowInvalid_ )
+	{
+		return false;
+	}
+	value = shadow;
+	return true;
 }
-	  
-bool ILDALaser::Busy()
+
+//Same as ShadowMatches but counts the write it saves
+bool ILDAHub::IsRedundant(int reg, unsigned int value)
 {
+	if( ShadowMatches( reg, value ) )
+	{
+		redundantSkipped_++;
+		return true;
+	}
 	return false;
 }
 
-int ILDALaser::Initialize()
+//An MCP4728 channel in an unknown state may also have lost its range
+void ILDAHub::InvalidateShadow(unsigned int mask)
 {
-   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
+	for( int i = 0; i < shadowTotal; i++ )
+	{
+		if( mask & (1u << i) )
+		{
+			shadow_[i].store( shadowInvalid_ );
+		}
+	}
+	for( int i = 0; i < MCP4728_CHANNELS; i++ )
+	{
+		if( mask & (1u << (mcp4728ChannelA + i)) )
+		{
+			mcp4728RangeCommitted_[i].store( false );
+		}
+	}
+}
 
-   char hubLabel[MM::MaxStrLength];
-   hub->GetLabel(hubLabel);
-   SetParentID(hubLabel); // for backward comp.
+/*******************************************************************
+Bus Command Queue
+*******************************************************************/
+int ILDABusWorker::svc()
+{
+	return hub_->RunWorker();
+}
 
-   hub_ = hub;
+int ILDAHub::SubmitI2cWrite(int client, unsigned char slaveAddress, const unsigned char * data, int dataLen, int retries, unsigned int shadowMask)
+{
+	if( dataLen < 0 || dataLen > ILDA_BUS_MAX_PAYLOAD )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
 
-   // set property list
-   // -----------------
+	ILDABusCommand cmd;
+	cmd.kind = ILDABusCommand::i2cWrite;
+	cmd.client = (unsigned char) client;
+	cmd.address = slaveAddress;
+	cmd.dataLen = (unsigned char) dataLen;
+	cmd.shadowMask = (unsigned short) shadowMask;
+	cmd.retries = retries;
+	memcpy( cmd.data, data, dataLen );
 
-   // create positions and labels for power settings
-   // create positions and labels
-   const int bufSize = 65;
-   char buf[bufSize];
-   for (long i=0; i<numPos_; i++)
-   {
-	  long percentage = 100/numPos_*i;
-      snprintf(buf, bufSize, "%d%%", (unsigned)percentage);
-      SetPositionLabel(i, buf);
-   }
+	return Submit( cmd );
+}
 
-   // State
-   // -----
-   CPropertyAction* pAct = new CPropertyAction (this, &ILDALaser::OnState);
-   int nRet = CreateProperty(MM::g_Keyword_State, "0", MM::Integer, false, pAct);
+//Accepts The Pin number (i.e. GPIO 3) as declared in the constants
+int ILDAHub::SubmitGpioWrite(int client, int pinIndex, bool isLow)
+{
+	if( pinIndex < 0 || pinIndex >= MCP2221_GPIO_TOTAL )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+
+	int shadowReg = gpioPin0 + pinIndex;
+	unsigned int pinValue = (isLow) ? 0 : 1;
+	if( IsRedundant( shadowReg, pinValue ) )
+	{
+		return DEVICE_OK;
+	}
+	SetShadow( shadowReg, pinValue );
+
+	ILDABusCommand cmd;
+	cmd.kind = ILDABusCommand::gpioWrite;
+	cmd.client = (unsigned char) client;
+	cmd.address = 0;
+	cmd.dataLen = MCP2221_GPIO_TOTAL;
+	cmd.shadowMask = (unsigned short) (1u << shadowReg);
+	cmd.retries = 1;
+	//Default no change values
+	memset( cmd.data, 0xFF, MCP2221_GPIO_TOTAL );
+	cmd.data[pinIndex] = (isLow) ? 0x00 : 0x01;
+
+	return Submit( cmd );
+}
+
+//Stores the newest value for the axis and queues a token only if none is outstanding.
+//The token keeps the queue position of the first update it stands for.
+//With Tilt Coalescing Off every update is queued on its own, in order.
+int ILDAHub::SubmitTiltUpdate(int client, int axis, unsigned int code, bool neg, unsigned char control, int retries)
+{
+	if( axis < 0 || axis >= dirTotal )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+	if( !tiltCoalescing_ )
+	{
+		return SubmitTiltSigned( client, axis, code, neg, control, retries );
+	}
+
+	tiltRetries_[axis].store( retries );
+	tiltLatest_[axis].store( ((unsigned int) control << 24) | ((neg) ? 0x10000 : 0) | (code & 0xFFFF) );
+
+	if( tiltQueued_[axis].exchange( true ) )
+	{
+		//Superseded a value that never reached the bus
+		tiltCoalesced_++;
+		return DEVICE_OK;
+	}
+
+	ILDABusCommand cmd;
+	cmd.kind = ILDABusCommand::tiltUpdate;
+	cmd.client = (unsigned char) client;
+	cmd.address = (unsigned char) axis;
+	cmd.dataLen = 0;
+	cmd.shadowMask = 0;
+	cmd.retries = retries;
+
+	return Submit( cmd );
+}
+
+//Sign and magnitude of one axis as a single command, so the zero crossing sequence
+//(zero, switch, magnitude) is never split or interleaved with other bus work
+int ILDAHub::SubmitTiltSigned(int client, int axis, unsigned int code, bool neg, unsigned char control, int retries)
+{
+	if( axis < 0 || axis >= dirTotal )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+
+	ILDABusCommand cmd;
+	cmd.kind = ILDABusCommand::tiltSigned;
+	cmd.client = (unsigned char) client;
+	cmd.address = (unsigned char) axis;
+	cmd.dataLen = 4;
+	cmd.shadowMask = 0;
+	cmd.retries = retries;
+	cmd.data[0] = (code >> 8) & 0xFF;
+	cmd.data[1] = code & 0xFF;
+	cmd.data[2] = (neg) ? 1 : 0;
+	cmd.data[3] = control;
+
+	return Submit( cmd );
+}
+
+//Both axes move as one tiltXY command, the sign switches are ordered by BuildTiltXYOps
+int ILDAHub::SetXY(double xVolts, double yVolts, int client)
+{
+	if( !tiltDacs_[x] || !tiltDacs_[y] )
+	{
+		return DEVICE_NOT_CONNECTED;
+	}
+
+	double volts[dirTotal] = { xVolts, yVolts };
+	unsigned int codes[dirTotal];
+	bool neg[dirTotal];
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		codes[i] = tiltDacs_[i]->VoltageToCode( volts[i], neg[i] );
+		//A zero magnitude always returns the switch to positive
+		neg[i] = neg[i] && codes[i] != 0;
+	}
+
+	int ret = SubmitTiltXY( client, codes, neg );
+	if( ret == DEVICE_OK )
+	{
+		tiltXY_[x] = xVolts;
+		tiltXY_[y] = yVolts;
+	}
+	return ret;
+}
+
+int ILDAHub::SubmitTiltXY(int client, const unsigned int codes[dirTotal], const bool neg[dirTotal], int retries)
+{
+	ILDABusCommand cmd;
+	cmd.kind = ILDABusCommand::tiltXY;
+	cmd.client = (unsigned char) client;
+	cmd.address = g_ILDATiltBroadcastAddress;
+	cmd.dataLen = 5;
+	cmd.shadowMask = 0;
+	cmd.retries = retries;
+	cmd.data[0] = (codes[x] >> 8) & 0xFF;
+	cmd.data[1] = codes[x] & 0xFF;
+	cmd.data[2] = (codes[y] >> 8) & 0xFF;
+	cmd.data[3] = codes[y] & 0xFF;
+	cmd.data[4] = ((neg[x]) ? 0x01 : 0x00) | ((neg[y]) ? 0x02 : 0x00);
+
+	return Submit( cmd );
+}
+
+//One batch encoded sample sent as packed: the tilt code bytes and signs become a tiltXY
+//command, the colour bytes are the MCP4728 fast write for channels A-C (staged codes and
+//shadows follow, so later single writes see what the player left on the chip)
+int ILDAHub::SubmitEncodedSample(int client, const ILDAEncodedSample& sample, int retries)
+{
+	ILDABusCommand cmd;
+	cmd.kind = ILDABusCommand::tiltXY;
+	cmd.client = (unsigned char) client;
+	cmd.address = g_ILDATiltBroadcastAddress;
+	cmd.dataLen = 5;
+	cmd.shadowMask = 0;
+	cmd.retries = retries;
+	cmd.data[0] = sample.tilt[x][1];
+	cmd.data[1] = sample.tilt[x][2];
+	cmd.data[2] = sample.tilt[y][1];
+	cmd.data[3] = sample.tilt[y][2];
+	cmd.data[4] = sample.signs & 0x03;
+
+	int ret = Submit( cmd );
+	if( ret != DEVICE_OK )
+	{
+		return ret;
+	}
+
+	std::lock_guard<std::mutex> guard( stageLock_ );
+	bool changed = false;
+	bool committed = true;
+	for( int i = 0; i < ILDA_ENCODER_COLOR_CHANNELS; i++ )
+	{
+		mcp4728Codes_[i] = ((unsigned int) sample.color[i * 2] << 8) | sample.color[i * 2 + 1];
+		mcp4728Pending_[i] = false;
+		committed = committed && IsMCP4728RangeCommitted( i );
+		changed = changed || !ShadowMatches( mcp4728ChannelA + i, mcp4728Codes_[i] );
+	}
+	if( !changed && committed )
+	{
+		redundantSkipped_++;
+		return DEVICE_OK;
+	}
+
+	unsigned int shadowMask = 0;
+	for( int i = 0; i < ILDA_ENCODER_COLOR_CHANNELS; i++ )
+	{
+		SetShadow( mcp4728ChannelA + i, mcp4728Codes_[i] );
+		shadowMask |= 1u << (mcp4728ChannelA + i);
+	}
+	if( committed )
+	{
+		return SubmitI2cWrite( client, g_ShutterAndLaserDACI2CAddress, sample.color, sizeof(sample.color), retries, shadowMask );
+	}
+
+	//A range not yet on the chip goes out in multi-write blocks, the fast write cannot carry it
+	unsigned char blocks[ILDA_ENCODER_COLOR_CHANNELS * 3];
+	for( int i = 0; i < ILDA_ENCODER_COLOR_CHANNELS; i++ )
+	{
+		blocks[i * 3] = (unsigned char) (g_ILDAMCP4728SingleWriteCmd | (i << 1));
+		blocks[i * 3 + 1] = MCP4728UpperByte( i, mcp4728Codes_[i] );
+		blocks[i * 3 + 2] = (unsigned char) (mcp4728Codes_[i] & 0xFF);
+	}
+	return SubmitI2cWrite( client, g_ShutterAndLaserDACI2CAddress, blocks, sizeof(blocks), retries, shadowMask );
+}
+
+//Same magnitude/sign split as the X-Tilt/Y-Tilt devices
+unsigned int ILDAHub::TiltVoltageToCode(int axis, double volts, bool& neg)
+{
+	neg = false;
+	if( axis < 0 || axis >= dirTotal || !tiltDacs_[axis] )
+	{
+		return 0;
+	}
+	return tiltDacs_[axis]->VoltageToCode( volts, neg );
+}
+
+double ILDAHub::GetTiltVoltageMax(void)
+{
+	return (tiltDacs_[x]) ? tiltDacs_[x]->GetVoltageMax() : 0;
+}
+
+//Drives the system shutter channel directly (same frame as ILDASystemShutter's single write)
+int ILDAHub::SetShutterOutput(bool open, int client)
+{
+	int channel = g_ILDASystemShutterChannelBit >> 1;
+	unsigned int code = (open) ? g_ILDAShutterOpenCode : g_ILDAShutterClosedCode;
+
+	shutterState_ = open;
+	return WriteMCP4728Channel( channel, code, 1, client );
+}
+
+//Fills one batched MCP4728 single write for the shutter channel if it changes
+//rangeBits are the channel's VREF/gain bits (ILDAHub::MCP4728UpperByte of code 0)
+static int ILDAAppendShutterOp(std::vector<ILDATransportOp>& ops, bool open, unsigned char rangeBits, unsigned int state[shadowTotal])
+{
+	int channel = g_ILDASystemShutterChannelBit >> 1;
+	unsigned int code = (open) ? g_ILDAShutterOpenCode : g_ILDAShutterClosedCode;
+	if( state[mcp4728ChannelA + channel] == code )
+	{
+		return 0;
+	}
+
+	ILDATransportOp op;
+	op.kind = ILDATransportOp::i2cWrite;
+	op.address = g_ShutterAndLaserDACI2CAddress;
+	op.dataLen = 3;
+	op.data[0] = g_ILDAMCP4728SingleWriteCmd | g_ILDASystemShutterChannelBit;
+	op.data[1] = rangeBits | ((code >> 8) & 0x0F);
+	op.data[2] = code & 0xFF;
+	ops.push_back( op );
+
+	state[mcp4728ChannelA + channel] = code;
+	return 1;
+}
+
+//Volts to ready-to-send DAC8571 frames, once per distinct scan.
+//Scans larger than the arena (or a zero sized cache) are encoded into a scratch buffer.
+const ILDACachedPoint * ILDAHub::QuantiseScan(const double * xVolts, const double * yVolts, int count)
+{
+	unsigned long long key = ILDAFrameCache::Hash( xVolts, yVolts, count );
+	const ILDACachedPoint * cached = frameCache_.Find( key, count );
+	if( cached )
+	{
+		return cached;
+	}
+
+	ILDACachedPoint * scan = frameCache_.Insert( key, count );
+	if( !scan )
+	{
+		uncachedScan_.resize( count );
+		scan = &uncachedScan_[0];
+	}
+
+	for( int p = 0; p < count; p++ )
+	{
+		double volts[dirTotal] = { xVolts[p], yVolts[p] };
+		scan[p].signs = 0;
+		for( int i = 0; i < dirTotal; i++ )
+		{
+			bool neg;
+			unsigned int code = tiltDacs_[i]->VoltageToCode( volts[i], neg );
+			scan[p].frames[i][0] = g_ILDADac8571DispCmd;
+			scan[p].frames[i][1] = (code >> 8) & 0xFF;
+			scan[p].frames[i][2] = code & 0xFF;
+			if( neg && code != 0 )
+			{
+				scan[p].signs |= 1 << i;
+			}
+		}
+	}
+
+	return scan;
+}
+
+//Jumps onto a new polygon are blanked unless the beam is already there
+//(a closed polygon returns to its own start, so repeating it is not a jump)
+void ILDAHub::MarkScanJumps(const ILDACachedPoint * scan, int count, const int * polygonStarts, int polygonCount)
+{
+	batchJump_.assign( count, 0 );
+	for( int i = 0; i < polygonCount; i++ )
+	{
+		int p = polygonStarts[i];
+		if( p < 0 || p >= count )
+		{
+			continue;
+		}
+		const ILDACachedPoint& from = scan[(p > 0) ? p - 1 : count - 1];
+		batchJump_[p] = memcmp( &from, &scan[p], sizeof(ILDACachedPoint) ) != 0;
+	}
+}
+
+//Outputs once a scan point has been shown: its codes and signs, the shutter open if lit
+static void ILDASetScanState(const ILDACachedPoint& point, bool illuminate, unsigned int state[shadowTotal])
+{
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		state[dac8571X + i] = ((unsigned int) point.frames[i][1] << 8) | point.frames[i][2];
+		state[gpioPin0 + g_ILDATiltNegAddresses[i]] = (point.signs & (1 << i)) ? 0 : 1;
+	}
+	if( illuminate )
+	{
+		state[mcp4728ChannelA + (g_ILDASystemShutterChannelBit >> 1)] = g_ILDAShutterOpenCode;
+	}
+}
+
+static bool ILDAIsScanState(const ILDACachedPoint& point, bool illuminate, const unsigned int state[shadowTotal])
+{
+	unsigned int expected[shadowTotal];
+	memcpy( expected, state, sizeof(expected) );
+	ILDASetScanState( point, illuminate, expected );
+	return memcmp( expected, state, sizeof(expected) ) == 0;
+}
+
+//Builds every point's ops once, for the steady state in which the point before it (the last
+//point, for point 0) has just been shown. Kept while the next scan has the same points, jumps,
+//dwell and illumination, so a repeated scan is replayed without being rebuilt.
+//Returns false for scans too large to keep.
+bool ILDAHub::CompileScan(const ILDACachedPoint * scan, int count, double dwellUs, bool illuminate, unsigned char shutterRangeBits)
+{
+	if( count > g_ILDAScanOpsMaxPoints )
+	{
+		compiledPoints_.clear();
+		scanOps_.clear();
+		scanOpStart_.clear();
+		return false;
+	}
+
+	if( (int) compiledPoints_.size() == count && compiledDwellUs_ == dwellUs && compiledIlluminate_ == illuminate &&
+		compiledRangeBits_ == shutterRangeBits && compiledJump_ == batchJump_ &&
+		memcmp( &compiledPoints_[0], scan, count * sizeof(ILDACachedPoint) ) == 0 )
+	{
+		return true;
+	}
+
+	compiledPoints_.assign( scan, scan + count );
+	compiledJump_ = batchJump_;
+	compiledDwellUs_ = dwellUs;
+	compiledIlluminate_ = illuminate;
+	compiledRangeBits_ = shutterRangeBits;
+
+	ILDATransportOp delayOp;
+	delayOp.kind = ILDATransportOp::delay;
+	delayOp.address = 0;
+	delayOp.dataLen = 0;
+	delayOp.delayUs = dwellUs;
+
+	scanOps_.clear();
+	scanOpStart_.resize( count + 1 );
+	ILDATransportOp move[g_ILDATiltMoveMaxOps];
+	unsigned int state[shadowTotal];
+	memset( state, 0, sizeof(state) );
+	for( int p = 0; p < count; p++ )
+	{
+		scanOpStart_[p] = (unsigned int) scanOps_.size();
+		ILDASetScanState( scan[(p > 0) ? p - 1 : count - 1], illuminate, state );
+
+		unsigned int codes[dirTotal];
+		bool neg[dirTotal];
+		for( int i = 0; i < dirTotal; i++ )
+		{
+			codes[i] = ((unsigned int) scan[p].frames[i][1] << 8) | scan[p].frames[i][2];
+			neg[i] = (scan[p].signs & (1 << i)) != 0;
+		}
+
+		if( illuminate && batchJump_[p] )
+		{
+			ILDAAppendShutterOp( scanOps_, false, shutterRangeBits, state );
+		}
+
+		int moveOps = BuildTiltXYOps( codes, neg, state, move );
+		scanOps_.insert( scanOps_.end(), move, move + moveOps );
+
+		if( illuminate )
+		{
+			ILDAAppendShutterOp( scanOps_, true, shutterRangeBits, state );
+		}
+
+		if( dwellUs > 0 )
+		{
+			scanOps_.push_back( delayOp );
+		}
+	}
+	scanOpStart_[count] = (unsigned int) scanOps_.size();
+
+	return true;
+}
+
+//Runs in slices: busLock_ is taken per slice, so other devices get the bus between slices.
+//Each point's ops come from CompileScan while the shadows at the slice start are the state
+//they were built for; otherwise (first point, another device moved the beam or the shutter)
+//they are built from the shadows as they are at that moment, so nothing replayed can be stale.
+//batchLock_ keeps one scan (and its frameCache_/batchOps_/scanOps_ use) at a time.
+int ILDAHub::RunTiltBatch(const double * xVolts, const double * yVolts, int count, double dwellUs, int repetitions, bool illuminate, int client,
+	const int * polygonStarts, int polygonCount)
+{
+	if( !tiltDacs_[x] || !tiltDacs_[y] )
+	{
+		return DEVICE_NOT_CONNECTED;
+	}
+	if( count <= 0 || !xVolts || !yVolts )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+	if( repetitions < 1 )
+	{
+		repetitions = 1;
+	}
+
+	//Writes queued before the scan land first
+	WaitForIdle();
+
+	std::lock_guard<std::mutex> batchGuard( batchLock_ );
+	stopBatch_.store( false );
+
+	const ILDACachedPoint * scan = QuantiseScan( xVolts, yVolts, count );
+	MarkScanJumps( scan, count, polygonStarts, (polygonStarts) ? polygonCount : 0 );
+
+	const unsigned char shutterRangeBits = MCP4728UpperByte( g_ILDASystemShutterChannelBit >> 1, 0 );
+	const bool compiled = CompileScan( scan, count, dwellUs, illuminate, shutterRangeBits );
+
+	ILDATransportOp delayOp;
+	delayOp.kind = ILDATransportOp::delay;
+	delayOp.address = 0;
+	delayOp.dataLen = 0;
+	delayOp.delayUs = dwellUs;
+
+	//A point adds at most its move, a shutter close and open, and a dwell
+	batchOps_.clear();
+	batchOps_.reserve( g_ILDABusSliceOps + g_ILDATiltMoveMaxOps + 4 );
+
+	const long long total = (long long) count * repetitions;
+	long long next = 0;
+	int lastPoint = -1;
+	int ret = DEVICE_OK;
+	ILDATransportOp move[g_ILDATiltMoveMaxOps];
+	bool finished = false;
+	while( !finished && ret == DEVICE_OK )
+	{
+		//Queued shutter commands go ahead of the next slice (no lock is held between slices)
+		if( next > 0 && classPending_[safetyPriority].load() > 0 )
+		{
+			batchPreempted_++;
+			YieldToSafety();
+		}
+		finished = next >= total || stopBatch_.load();
+
+		std::lock_guard<std::mutex> stageGuard( stageLock_ );
+		MMThreadGuard guard( busLock_ );
+		if( !transport_ )
+		{
+			ret = DEVICE_NOT_CONNECTED;
+			break;
+		}
+
+		unsigned int before[shadowTotal], state[shadowTotal];
+		SnapshotShadows( before );
+		memcpy( state, before, sizeof(state) );
+
+		//Compiled ops hold from here on once the outputs are where the previous point left them
+		bool replay = compiled && next > 0 && ILDAIsScanState( scan[(next - 1) % count], illuminate, state );
+
+		batchOps_.clear();
+		double sliceDwellUs = 0;
+		int slicePoint = lastPoint;
+		while( !finished && batchOps_.size() < g_ILDABusSliceOps && sliceDwellUs < g_ILDABusSliceDwellUs && next < total )
+		{
+			int p = (int) (next % count);
+			if( replay )
+			{
+				batchOps_.insert( batchOps_.end(), scanOps_.begin() + scanOpStart_[p], scanOps_.begin() + scanOpStart_[p + 1] );
+				ILDASetScanState( scan[p], illuminate, state );
+				if( dwellUs > 0 )
+				{
+					sliceDwellUs += dwellUs;
+				}
+				slicePoint = p;
+				next++;
+				continue;
+			}
+
+			unsigned int codes[dirTotal];
+			bool neg[dirTotal];
+			for( int i = 0; i < dirTotal; i++ )
+			{
+				codes[i] = ((unsigned int) scan[p].frames[i][1] << 8) | scan[p].frames[i][2];
+				neg[i] = (scan[p].signs & (1 << i)) != 0;
+			}
+
+			//Light is off for the move onto the first point and every jump between polygons
+			if( illuminate && (next == 0 || batchJump_[p]) )
+			{
+				ILDAAppendShutterOp( batchOps_, false, shutterRangeBits, state );
+			}
+
+			int moveOps = BuildTiltXYOps( codes, neg, state, move );
+			batchOps_.insert( batchOps_.end(), move, move + moveOps );
+
+			if( illuminate )
+			{
+				ILDAAppendShutterOp( batchOps_, true, shutterRangeBits, state );
+			}
+
+			if( dwellUs > 0 )
+			{
+				batchOps_.push_back( delayOp );
+				sliceDwellUs += dwellUs;
+			}
+
+			slicePoint = p;
+			next++;
+			replay = compiled;
+		}
+
+		finished = finished || next >= total;
+		if( finished && illuminate )
+		{
+			ILDAAppendShutterOp( batchOps_, false, shutterRangeBits, state );
+		}
+
+		if( !batchOps_.empty() )
+		{
+			traceClient_ = (unsigned char) client;
+			ret = ExecuteOps( &batchOps_[0], (int) batchOps_.size(), 1 );
+		}
+
+		CommitShadows( before, state, ret == DEVICE_OK );
+		if( ret == DEVICE_OK )
+		{
+			if( illuminate )
+			{
+				int channel = g_ILDASystemShutterChannelBit >> 1;
+				mcp4728Codes_[channel] = state[mcp4728ChannelA + channel] & 0x0FFF;
+				shutterState_ = state[mcp4728ChannelA + channel] != g_ILDAShutterClosedCode;
+			}
+			lastPoint = slicePoint;
+		}
+		else if( illuminate )
+		{
+			//Best effort to leave the light off after a failed slice
+			batchOps_.clear();
+			SnapshotShadows( before );
+			memcpy( state, before, sizeof(state) );
+			if( ILDAAppendShutterOp( batchOps_, false, shutterRangeBits, state ) && ExecuteOps( &batchOps_[0], 1, 1 ) == DEVICE_OK )
+			{
+				CommitShadows( before, state, true );
+				mcp4728Codes_[g_ILDASystemShutterChannelBit >> 1] = g_ILDAShutterClosedCode;
+				shutterState_ = false;
+			}
+		}
+	}
+
+	if( lastPoint >= 0 )
+	{
+		tiltXY_[x] = xVolts[lastPoint];
+		tiltXY_[y] = yVolts[lastPoint];
+	}
+
+	return ret;
+}
+
+//Ends a running RunTiltBatch at its next slice (the shutter is still closed)
+void ILDAHub::StopTiltBatch()
+{
+	stopBatch_.store( true );
+}
+
+void ILDAHub::DefinePreset(const std::string& name, const ILDAPreset& preset)
+{
+	presets_[name] = preset;
+}
+
+//Captures what the hub last put on the outputs
+int ILDAHub::SavePreset(const std::string& name)
+{
+	if( name.empty() || name == g_ILDAPresetNone )
+	{
+		return DEVICE_INVALID_PROPERTY_VALUE;
+	}
+
+	std::lock_guard<std::mutex> stageGuard( stageLock_ );
+	ILDAPreset preset;
+	for( int color = 0; color < colorTotal; color++ )
+	{
+		int channel = g_ILDALaserDACChannelBits[color] >> 1;
+		preset.laserVolts[color] = mcp4728Converters_[channel].ToVolts( mcp4728Codes_[channel] );
+	}
+	preset.shutterOpen = mcp4728Codes_[g_ILDASystemShutterChannelBit >> 1] != g_ILDAShutterClosedCode;
+	preset.tiltVolts[x] = tiltXY_[x];
+	preset.tiltVolts[y] = tiltXY_[y];
+
+	DefinePreset( name, preset );
+	return DEVICE_OK;
+}
+
+bool ILDAHub::DeletePreset(const std::string& name)
+{
+	return presets_.erase( name ) > 0;
+}
+
+//A missing file is an empty preset list; lines that do not parse are skipped
+int ILDAHub::ReadPresetFile()
+{
+	if( presetFile_.empty() )
+	{
+		return DEVICE_OK;
+	}
+
+	FILE * file = fopen( presetFile_.c_str(), "r" );
+	if( !file )
+	{
+		return DEVICE_OK;
+	}
+
+	char line[MM::MaxStrLength];
+	while( fgets( line, sizeof(line), file ) )
+	{
+		std::string entry( line );
+		size_t split = entry.rfind( '=' );
+		if( split == std::string::npos || split == 0 )
+		{
+			continue;
+		}
+
+		ILDAPreset preset;
+		int shutter;
+		if( sscanf(entry.c_str() + split + 1, "%lf,%lf,%lf,%d,%lf,%lf", &preset.laserVolts[red637], &preset.laserVolts[green532],
+			&preset.laserVolts[blue445], &shutter, &preset.tiltVolts[x], &preset.tiltVolts[y]) != 6 )
+		{
+			continue;
+		}
+		preset.shutterOpen = shutter != 0;
+		DefinePreset( entry.substr( 0, split ), preset );
+	}
+
+	fclose( file );
+	return DEVICE_OK;
+}
+
+//Rewritten whole on every change (a handful of lines)
+int ILDAHub::WritePresetFile()
+{
+	if( presetFile_.empty() )
+	{
+		return DEVICE_OK;
+	}
+
+	FILE * file = fopen( presetFile_.c_str(), "w" );
+	if( !file )
+	{
+		return DEVICE_ERR;
+	}
+
+	for( std::map<std::string, ILDAPreset>::const_iterator it = presets_.begin(); it != presets_.end(); ++it )
+	{
+		const ILDAPreset& preset = it->second;
+		fprintf( file, "%s=%.9g,%.9g,%.9g,%d,%.9g,%.9g\n", it->first.c_str(), preset.laserVolts[red637], preset.laserVolts[green532],
+			preset.laserVolts[blue445], (preset.shutterOpen) ? 1 : 0, preset.tiltVolts[x], preset.tiltVolts[y] );
+	}
+
+	return (fclose( file ) == 0) ? DEVICE_OK : DEVICE_ERR;
+}
+
+//The laser and tilt devices pick the new outputs up from the shadows (GetPresetGeneration)
+int ILDAHub::ApplyPreset(const std::string& name)
+{
+	std::map<std::string, ILDAPreset>::const_iterator found = presets_.find( name );
+	if( found == presets_.end() )
+	{
+		return DEVICE_INVALID_PROPERTY_VALUE;
+	}
+	if( !tiltDacs_[x] || !tiltDacs_[y] )
+	{
+		return DEVICE_NOT_CONNECTED;
+	}
+	const ILDAPreset& preset = found->second;
+
+	//Everything is converted before the bus is touched
+	std::lock_guard<std::mutex> stageGuard( stageLock_ );
+	unsigned int dacCodes[MCP4728_CHANNELS];
+	memcpy( dacCodes, mcp4728Codes_, sizeof(dacCodes) );
+	for( int color = 0; color < colorTotal; color++ )
+	{
+		int channel = g_ILDALaserDACChannelBits[color] >> 1;
+		dacCodes[channel] = mcp4728Converters_[channel].ToCode( preset.laserVolts[color] );
+	}
+	dacCodes[g_ILDASystemShutterChannelBit >> 1] = (preset.shutterOpen) ? g_ILDAShutterOpenCode : g_ILDAShutterClosedCode;
+
+	unsigned int tiltCodes[dirTotal];
+	bool neg[dirTotal];
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		tiltCodes[i] = tiltDacs_[i]->VoltageToCode( preset.tiltVolts[i], neg[i] );
+		neg[i] = neg[i] && tiltCodes[i] != 0;
+	}
+
+	//Writes queued before the preset land first, so the snapshot below is current
+	WaitForIdle();
+
+	MMThreadGuard guard( busLock_ );
+	if( !transport_ )
+	{
+		return DEVICE_NOT_CONNECTED;
+	}
+
+	unsigned int before[shadowTotal], state[shadowTotal];
+	SnapshotShadows( before );
+	memcpy( state, before, sizeof(state) );
+
+	//One fast write up to the last channel that differs from the chip, or has yet to get its range
+	int last = -1;
+	bool committed = true;
+	for( int i = 0; i < MCP4728_CHANNELS; i++ )
+	{
+		if( state[mcp4728ChannelA + i] != dacCodes[i] || !IsMCP4728RangeCommitted( i ) )
+		{
+			last = i;
+		}
+	}
+	for( int i = 0; i <= last; i++ )
+	{
+		committed = committed && IsMCP4728RangeCommitted( i );
+	}
+
+	//The fast write cannot carry VREF/gain, so until every channel it reaches is on its range
+	//each channel that needs it gets a multi-write op of its own
+	ILDATransportOp dacOps[MCP4728_CHANNELS];
+	int dacCount = 0;
+	for( int i = 0; i <= last; i++ )
+	{
+		if( committed )
+		{
+			if( dacCount == 0 )
+			{
+				dacOps[0].kind = ILDATransportOp::i2cWrite;
+				dacOps[0].address = g_ShutterAndLaserDACI2CAddress;
+				dacOps[0].dataLen = 0;
+				dacOps[0].delayUs = 0;
+				dacCount = 1;
+			}
+			dacOps[0].data[dacOps[0].dataLen++] = (dacCodes[i] >> 8) & 0x0F;
+			dacOps[0].data[dacOps[0].dataLen++] = dacCodes[i] & 0xFF;
+		}
+		else if( state[mcp4728ChannelA + i] != dacCodes[i] || !IsMCP4728RangeCommitted( i ) )
+		{
+			ILDATransportOp& op = dacOps[dacCount++];
+			op.kind = ILDATransportOp::i2cWrite;
+			op.address = g_ShutterAndLaserDACI2CAddress;
+			op.dataLen = 3;
+			op.data[0] = (unsigned char) (g_ILDAMCP4728SingleWriteCmd | (i << 1));
+			op.data[1] = MCP4728UpperByte( i, dacCodes[i] );
+			op.data[2] = (unsigned char) (dacCodes[i] & 0xFF);
+			op.delayUs = 0;
+		}
+		state[mcp4728ChannelA + i] = dacCodes[i];
+	}
+
+	//Light goes off before the beam moves, and only comes on once it is in place
+	ILDATransportOp ops[g_ILDATiltMoveMaxOps + MCP4728_CHANNELS];
+	int count = 0;
+	if( !preset.shutterOpen )
+	{
+		for( int i = 0; i < dacCount; i++ )
+		{
+			ops[count++] = dacOps[i];
+		}
+	}
+	count += BuildTiltXYOps( tiltCodes, neg, state, ops + count );
+	if( preset.shutterOpen )
+	{
+		for( int i = 0; i < dacCount; i++ )
+		{
+			ops[count++] = dacOps[i];
+		}
+	}
+
+	int ret = DEVICE_OK;
+	if( count == 0 )
+	{
+		redundantSkipped_++;
+	}
+	else
+	{
+		traceClient_ = hubClient;
+		ret = ExecuteOps( ops, count, 1 );
+	}
+
+	CommitShadows( before, state, ret == 0 );
+	if( ret == 0 )
+	{
+		presetGeneration_++;
+		memcpy( mcp4728Codes_, dacCodes, sizeof(dacCodes) );
+		for( int i = 0; i < MCP4728_CHANNELS; i++ )
+		{
+			mcp4728Pending_[i] = false;
+		}
+		tiltXY_[x] = preset.tiltVolts[x];
+		tiltXY_[y] = preset.tiltVolts[y];
+		shutterState_ = preset.shutterOpen;
+	}
+
+	return ret;
+}
+
+//Synchronous: runs on the calling thread and returns the bus result
+//Asynchronous: returns as soon as the command is queued
+int ILDAHub::Submit(const ILDABusCommand& cmd)
+{
+	ILDABusCommand queued = cmd;
+	queued.priority = (unsigned char) ClassifyCommand( cmd );
+	queued.sequence = submitSequence_++;
+	queued.submitUs = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+
+	classPending_[queued.priority]++;
+	if( !asynchronous_.load() || !worker_ )
+	{
+		int ret = Execute( queued );
+		classPending_[queued.priority]--;
+		return ret;
+	}
+
+	pending_[cmd.client]++;
+
+	//Full ring applies backpressure instead of dropping writes
+	while( !queues_[queued.priority].Push( queued ) )
+	{
+		std::this_thread::yield();
+	}
+
+	if( workerSleeping_.load() )
+	{
+		std::lock_guard<std::mutex> guard( wakeLock_ );
+		wake_.notify_one();
+	}
+
+	return DEVICE_OK;
+}
+
+//Retries carries the repo-wide meaning of total attempts
+int ILDAHub::Execute(const ILDABusCommand& cmd)
+{
+	MMThreadGuard guard( busLock_ );
+
+	if( !transport_ )
+	{
+		return DEVICE_NOT_CONNECTED;
+	}
+
+	RecordWait( cmd );
+	traceClient_ = cmd.client;
+
+	int ret = DEVICE_ERR;
+	switch( cmd.kind )
+	{
+	  case ILDABusCommand::i2cWrite:
+	  case ILDABusCommand::gpioWrite:
+		ret = Transmit( cmd.kind, cmd.address, cmd.data, cmd.dataLen, cmd.retries );
+		break;
+	  case ILDABusCommand::tiltUpdate:
+		ret = ExecuteTiltUpdate( cmd.address );
+		break;
+	  case ILDABusCommand::tiltXY:
+		ret = ExecuteTiltXY( cmd );
+		break;
+	  case ILDABusCommand::tiltSigned:
+		ret = ExecuteTiltAxis( cmd.address, ((unsigned int) cmd.data[0] << 8) | cmd.data[1], cmd.data[2] != 0, cmd.data[3], cmd.retries );
+		break;
+	  default:
+		return DEVICE_ERR;
+	}
+
+	//Hardware state is unknown after a failed write
+	if( ret != 0 )
+	{
+		InvalidateShadow( cmd.shadowMask );
+	}
+
+	//A later submission from a higher class already ran, so this write may have
+	//replaced a newer value the shadow recorded at submit time
+	if( (int) (cmd.sequence - executedSequence_) < 0 )
+	{
+		InvalidateShadow( cmd.shadowMask );
+	}
+	else
+	{
+		executedSequence_ = cmd.sequence;
+	}
+
+	return ret;
+}
+
+//Shutter output first whoever asks for it, then streaming clients last
+//Only frames that write nothing but the shutter overtake queued work. A frame that also carries
+//laser codes (deferred mode fast write) stays interactive, behind older writes to the same channels.
+int ILDAHub::ClassifyCommand(const ILDABusCommand& cmd) const
+{
+	unsigned int shutterMask = 1u << (mcp4728ChannelA + (g_ILDASystemShutterChannelBit >> 1));
+	bool shutterOnly = (cmd.shadowMask & ~shutterMask) == 0;
+	if( shutterOnly && (cmd.client == shutterClient || cmd.shadowMask == shutterMask) )
+	{
+		return safetyPriority;
+	}
+	if( cmd.client == playerClient || cmd.client == galvoClient )
+	{
+		return bulkPriority;
+	}
+	return interactivePriority;
+}
+
+//Submit to start of execution (caller holds busLock_)
+void ILDAHub::RecordWait(const ILDABusCommand& cmd)
+{
+	long long nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+	long long waitUs = nowUs - cmd.submitUs;
+
+	int priority = cmd.priority;
+	classExecuted_[priority]++;
+	classWaitTotalUs_[priority] += waitUs;
+	if( waitUs > classWaitMaxUs_[priority].load() )
+	{
+		classWaitMaxUs_[priority].store( waitUs );
+	}
+}
+
+//Waits (without busLock_) until the worker has run every queued safety command
+void ILDAHub::YieldToSafety()
+{
+	if( asynchronous_.load() && worker_ && workerSleeping_.load() )
+	{
+		std::lock_guard<std::mutex> guard( wakeLock_ );
+		wake_.notify_one();
+	}
+	while( classPending_[safetyPriority].load() > 0 )
+	{
+		std::this_thread::yield();
+	}
+}
+
+//Single point where frames reach the transport (caller holds busLock_)
+int ILDAHub::Transmit(int kind, unsigned char address, const unsigned char * data, int dataLen, int retries)
+{
+	int ret = DEVICE_ERR;
+	int attempts = (retries > 0) ? retries : 1;
+	bool gpio = kind == ILDABusCommand::gpioWrite;
+	int i;
+	double startUs = transport_->GetClockUs();
+	double attemptUs = startUs;
+	for( i = 0; i < attempts; i++ )
+	{
+		if( gpio )
+		{
+			ret = transport_->SetGpioValues( (unsigned char *) data );
+		}
+		else
+		{
+			ret = transport_->I2cWrite( dataLen, address, true, (unsigned char *) data );
+		}
+
+		double endUs = transport_->GetClockUs();
+		busTrace_.Record( attemptUs, endUs - attemptUs, ret, (unsigned char) ((gpio) ? traceGpioWrite : traceI2cWrite),
+			traceClient_, (gpio) ? 0 : address, data, (gpio) ? MCP2221_GPIO_TOTAL : dataLen, (unsigned char) i );
+		attemptUs = endUs;
+
+		if( ret == 0 )
+		{
+			break;
+		}
+	}
+
+	int outcome = (ret != 0) ? busOutcomeFailed : (i > 0) ? busOutcomeRetried : busOutcomeOk;
+	RecordTransfer( gpio, address, outcome, attemptUs - startUs );
+	if( ret == 0 && !gpio && address == g_ShutterAndLaserDACI2CAddress )
+	{
+		NoteMCP4728Ranges( data, dataLen );
+	}
+
+	return ret;
+}
+
+//Histogram for the frame's target (unknown addresses are not recorded)
+void ILDAHub::RecordTransfer(bool gpio, unsigned char address, int outcome, double us)
+{
+	int target;
+	if( gpio )
+	{
+		target = busTargetGpio;
+	}
+	else if( address == g_ShutterAndLaserDACI2CAddress )
+	{
+		target = busTargetMCP4728;
+	}
+	else if( address == g_ILDATiltDACI2CAddresses[x] )
+	{
+		target = busTargetDac8571X;
+	}
+	else if( address == g_ILDATiltDACI2CAddresses[y] )
+	{
+		target = busTargetDac8571Y;
+	}
+	else if( address == g_ILDATiltBroadcastAddress )
+	{
+		target = busTargetTiltBroadcast;
+	}
+	else
+	{
+		return;
+	}
+
+	busLatency_[target][outcome].Record( us );
+}
+
+//Failed attempts are held back until the op either succeeds on a resumed batch or is given up
+void ILDAHub::OnTransfer(const ILDATransportOp& op, double us, int ret)
+{
+	bool gpio = op.kind == ILDATransportOp::gpioWrite;
+	double endUs = transport_->GetClockUs();
+	busTrace_.Record( endUs - us, us, ret, (unsigned char) ((gpio) ? traceGpioWrite : traceI2cWrite), traceClient_,
+		op.address, op.data, (gpio) ? MCP2221_GPIO_TOTAL : op.dataLen, (transferRetrying_) ? traceAttempt_ : 0 );
+
+	if( ret != 0 )
+	{
+		transferFailedUs_ += us;
+		return;
+	}
+
+	RecordTransfer( op.kind == ILDATransportOp::gpioWrite, op.address,
+		(transferRetrying_) ? busOutcomeRetried : busOutcomeOk, us + transferFailedUs_ );
+	if( op.kind == ILDATransportOp::i2cWrite && op.address == g_ShutterAndLaserDACI2CAddress )
+	{
+		NoteMCP4728Ranges( op.data, op.dataLen );
+	}
+	transferRetrying_ = false;
+	transferFailedUs_ = 0;
+}
+
+//Sends whatever value is newest for the axis when the token reaches the front.
+//The flag is cleared before the slot is read so that a racing update queues a fresh token.
+int ILDAHub::ExecuteTiltUpdate(int axis)
+{
+	tiltQueued_[axis].store( false );
+	unsigned int packed = tiltLatest_[axis].load();
+	int retries = tiltRetries_[axis].load();
+
+	return ExecuteTiltAxis( axis, packed & 0xFFFF, (packed & 0x10000) != 0, (unsigned char) (packed >> 24), retries );
+}
+
+int ILDAHub::ExecuteTiltAxis(int axis, unsigned int code, bool neg, unsigned char control, int retries)
+{
+	if( axis < 0 || axis >= dirTotal )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+
+	unsigned int before[shadowTotal], state[shadowTotal];
+	SnapshotShadows( before );
+	memcpy( state, before, sizeof(state) );
+
+	ILDATransportOp ops[g_ILDATiltMoveMaxOps];
+	int count = BuildTiltAxisOps( axis, code, neg, control, state, ops );
+	if( count == 0 )
+	{
+		redundantSkipped_++;
+		return DEVICE_OK;
+	}
+
+	int ret = ExecuteOps( ops, count, retries );
+	CommitShadows( before, state, ret == DEVICE_OK );
+
+	return ret;
+}
+
+//Fills a three byte DAC8571 write (control, code high, code low)
+static void ILDAFillDac8571Op(ILDATransportOp& op, unsigned char address, unsigned char control, unsigned int code)
+{
+	op.kind = ILDATransportOp::i2cWrite;
+	op.address = address;
+	op.dataLen = 3;
+	op.data[0] = control;
+	op.data[1] = (code >> 8) & 0xFF;
+	op.data[2] = code & 0xFF;
+}
+
+//The sign switch sits after the DAC, so flipping it under a live output would jump
+//straight from +V to -V. A sign change drives the output to zero first, switches,
+//then writes the new magnitude: the beam passes through the origin instead.
+int ILDAHub::BuildTiltAxisOps(int axis, unsigned int code, bool neg, unsigned char control, unsigned int state[shadowTotal], ILDATransportOp * ops)
+{
+	int count = 0;
+	int pin = g_ILDATiltNegAddresses[axis];
+	int signReg = gpioPin0 + pin;
+	int dacReg = dac8571X + axis;
+	unsigned int pinValue = (neg) ? 0 : 1;
+
+	if( state[signReg] != pinValue )
+	{
+		if( state[dacReg] != 0 )
+		{
+			ILDAFillDac8571Op( ops[count++], g_ILDATiltDACI2CAddresses[axis], g_ILDADac8571DispCmd, 0 );
+			state[dacReg] = 0;
+		}
+
+		ILDATransportOp& gpio = ops[count++];
+		gpio.kind = ILDATransportOp::gpioWrite;
+		gpio.address = 0;
+		gpio.dataLen = MCP2221_GPIO_TOTAL;
+		memset( gpio.data, 0xFF, MCP2221_GPIO_TOTAL );
+		gpio.data[pin] = (unsigned char) pinValue;
+		state[signReg] = pinValue;
+	}
+
+	if( state[dacReg] != code )
+	{
+		ILDAFillDac8571Op( ops[count++], g_ILDATiltDACI2CAddresses[axis], control, code );
+		state[dacReg] = code;
+	}
+
+	return count;
+}
+
+//Runs the ops as one transport batch, resuming at the failed op while attempts remain
+int ILDAHub::ExecuteOps(const ILDATransportOp * ops, int count, int retries)
+{
+	int ret = DEVICE_ERR;
+	int attempts = (retries > 0) ? retries : 1;
+	unsigned int done = 0;
+	for( int i = 0; i < attempts && done < (unsigned int) count; i++ )
+	{
+		unsigned int failedOp = 0;
+		transferRetrying_ = (i > 0);
+		traceAttempt_ = (unsigned char) i;
+		ret = transport_->ExecuteBatch( ops + done, (unsigned int) count - done, &failedOp );
+		done += failedOp;
+	}
+
+	if( ret != 0 && done < (unsigned int) count )
+	{
+		RecordTransfer( ops[done].kind == ILDATransportOp::gpioWrite, ops[done].address, busOutcomeFailed, transferFailedUs_ );
+	}
+	transferRetrying_ = false;
+	transferFailedUs_ = 0;
+	traceAttempt_ = 0;
+
+	return ret;
+}
+
+//Traced readback (caller holds busLock_)
+int ILDAHub::ReadI2c(int dataLen, unsigned char address, unsigned char * data)
+{
+	double startUs = transport_->GetClockUs();
+	int ret = transport_->I2cRead( dataLen, address, true, data );
+	busTrace_.Record( startUs, transport_->GetClockUs() - startUs, ret, traceI2cRead, traceClient_, address, data, dataLen, 0 );
+	return ret;
+}
+
+int ILDAHub::ReadGpio(unsigned char * gpio)
+{
+	double startUs = transport_->GetClockUs();
+	int ret = transport_->GetGpioValues( gpio );
+	busTrace_.Record( startUs, transport_->GetClockUs() - startUs, ret, traceGpioRead, traceClient_, 0, gpio, MCP2221_GPIO_TOTAL, 0 );
+	return ret;
+}
+
+//Only the axes whose state differs are written.
+//An axis changing sign is first driven to zero (see BuildTiltAxisOps), so the switch
+//only ever flips under a zero output and the new magnitude is latched after it.
+//One axis: a plain load-from-data write. Both: store X, store Y, sign pins in one
+//GPIO report, then one broadcast latches both outputs at the same instant.
+//state holds the assumed hardware values and is advanced to what the ops leave behind.
+int ILDAHub::BuildTiltXYOps(const unsigned int codes[dirTotal], const bool neg[dirTotal], unsigned int state[shadowTotal], ILDATransportOp * ops)
+{
+	int count = 0;
+
+	ILDATransportOp gpio;
+	gpio.kind = ILDATransportOp::gpioWrite;
+	gpio.address = 0;
+	gpio.dataLen = MCP2221_GPIO_TOTAL;
+	memset( gpio.data, 0xFF, MCP2221_GPIO_TOTAL );
+	bool gpioChanged = false;
+
+	bool changed[dirTotal];
+	int changedCount = 0, lastChanged = x;
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		int pin = g_ILDATiltNegAddresses[i];
+		unsigned int pinValue = (neg[i]) ? 0 : 1;
+		if( state[gpioPin0 + pin] != pinValue )
+		{
+			//Zero before the switch flips, ahead of any store so the store survives
+			if( state[dac8571X + i] != 0 )
+			{
+				ILDAFillDac8571Op( ops[count++], g_ILDATiltDACI2CAddresses[i], g_ILDADac8571DispCmd, 0 );
+				state[dac8571X + i] = 0;
+			}
+			gpio.data[pin] = (unsigned char) pinValue;
+			state[gpioPin0 + pin] = pinValue;
+			gpioChanged = true;
+		}
+
+		changed[i] = state[dac8571X + i] != codes[i];
+		if( changed[i] )
+		{
+			changedCount++;
+			lastChanged = i;
+		}
+	}
+
+	if( changedCount == 2 )
+	{
+		for( int i = 0; i < dirTotal; i++ )
+		{
+			ILDAFillDac8571Op( ops[count++], g_ILDATiltDACI2CAddresses[i], g_ILDADac8571StoreCmd, codes[i] );
+		}
+	}
+
+	if( gpioChanged )
+	{
+		ops[count++] = gpio;
+	}
+
+	if( changedCount > 0 )
+	{
+		ILDATransportOp& op = ops[count++];
+		op.kind = ILDATransportOp::i2cWrite;
+		op.dataLen = 3;
+		if( changedCount == 2 )
+		{
+			op.address = g_ILDATiltBroadcastAddress;
+			op.data[0] = g_ILDADac8571LoadCmd;
+			op.data[1] = 0x00;
+			op.data[2] = 0x00;
+		}
+		else
+		{
+			ILDAFillDac8571Op( op, g_ILDATiltDACI2CAddresses[lastChanged], g_ILDADac8571DispCmd, codes[lastChanged] );
+		}
+
+		for( int i = 0; i < dirTotal; i++ )
+		{
+			state[dac8571X + i] = codes[i];
+		}
+	}
+
+	return count;
+}
+
+//Working copy of the shadow registers, unknown everywhere while a refresh is forced
+//Registers that cannot be read, or hold a configuration the adapter never writes, stay invalid
+int ILDAHub::ReadBackOutputs()
+{
+	std::lock_guard<std::mutex> stageGuard( stageLock_ );
+	MMThreadGuard guard( busLock_ );
+	warmStartSeeded_ = 0;
+	traceClient_ = hubClient;
+
+	unsigned char mcp[g_ILDAMCP4728ReadBytes];
+	if( ReadI2c( g_ILDAMCP4728ReadBytes, g_ShutterAndLaserDACI2CAddress, mcp ) == 0 )
+	{
+		for( int i = 0; i < MCP4728_CHANNELS; i++ )
+		{
+			const unsigned char * reg = &mcp[i * 6];
+			if( (reg[1] & g_ILDAMCP4728PowerDownMask) == 0 )
+			{
+				//The channel keeps the reference/gain it already runs with
+				int range = (reg[1] & g_ILDAMCP4728VrefBit) ? ((reg[1] & g_ILDAMCP4728GainBit) ? mcp4728RangeInternal2 : mcp4728RangeInternal1) : mcp4728RangeVdd;
+				ApplyMCP4728Range( i, range );
+				mcp4728RangeCommitted_[i].store( true );
+				mcp4728Codes_[i] = ((unsigned int) (reg[1] & 0x0F) << 8) | reg[2];
+				SetShadow( mcp4728ChannelA + i, mcp4728Codes_[i] );
+				warmStartSeeded_++;
+			}
+		}
+		shutterState_ = mcp4728Codes_[g_ILDASystemShutterChannelBit >> 1] != g_ILDAShutterClosedCode;
+	}
+	else
+	{
+		LogMessage("Warm start: MCP4728 readback failed", false);
+	}
+
+	unsigned char gpio[MCP2221_GPIO_TOTAL];
+	bool gpioRead = ReadGpio( gpio ) == 0;
+	if( gpioRead )
+	{
+		for( int pin = 0; pin < MCP2221_GPIO_TOTAL; pin++ )
+		{
+			//Pins not configured as GPIO output report something other than 0/1
+			if( gpio[pin] <= 1 )
+			{
+				SetShadow( gpioPin0 + pin, gpio[pin] );
+				warmStartSeeded_++;
+			}
+		}
+	}
+	else
+	{
+		LogMessage("Warm start: GPIO readback failed", false);
+	}
+
+	//DAC8571 readback: code high, code low, control
+	for( int i = 0; i < dirTotal; i++ )
+	{
+		unsigned char dac[3];
+		if( ReadI2c( 3, g_ILDATiltDACI2CAddresses[i], dac ) != 0 )
+		{
+			LogMessage("Warm start: DAC8571 readback failed", false);
+			continue;
+		}
+		unsigned int code = ((unsigned int) dac[0] << 8) | dac[1];
+		SetShadow( dac8571X + i, code );
+		warmStartSeeded_++;
+
+		int pin = g_ILDATiltNegAddresses[i];
+		bool neg = gpioRead && gpio[pin] == 0;
+		tiltXY_[i] = tiltDacs_[i]->GetConverter().ToVolts( code, neg );
+	}
+
+	std::ostringstream o;
+	o << "Warm start seeded " << warmStartSeeded_ << " of " << (int) shadowTotal << " shadow registers";
+	LogMessage(o.str().c_str(), false);
+
+	return DEVICE_OK;
+}
+
+void ILDAHub::SnapshotShadows(unsigned int state[shadowTotal])
+{
+	for( int i = 0; i < shadowTotal; i++ )
+	{
+		state[i] = (forceRefresh_) ? shadowInvalid_ : shadow_[i].load();
+	}
+}
+
+//Publishes the registers a batch changed, or forgets them if it failed part way
+//Returns the number of registers touched
+int ILDAHub::CommitShadows(const unsigned int before[shadowTotal], const unsigned int after[shadowTotal], bool ok)
+{
+	int touched = 0;
+	for( int i = 0; i < shadowTotal; i++ )
+	{
+		if( before[i] != after[i] )
+		{
+			touched++;
+			if( ok )
+			{
+				SetShadow( i, after[i] );
+			}
+			else
+			{
+				InvalidateShadow( 1u << i );
+			}
+		}
+	}
+	return touched;
+}
+
+int ILDAHub::ExecuteTiltXY(const ILDABusCommand& cmd)
+{
+	unsigned int codes[dirTotal];
+	bool neg[dirTotal];
+	codes[x] = ((unsigned int) cmd.data[0] << 8) | cmd.data[1];
+	codes[y] = ((unsigned int) cmd.data[2] << 8) | cmd.data[3];
+	neg[x] = (cmd.data[4] & 0x01) != 0;
+	neg[y] = (cmd.data[4] & 0x02) != 0;
+
+	unsigned int before[shadowTotal], state[shadowTotal];
+	SnapshotShadows( before );
+	memcpy( state, before, sizeof(state) );
+
+	ILDATransportOp ops[g_ILDATiltMoveMaxOps];
+	int count = BuildTiltXYOps( codes, neg, state, ops );
+	if( count == 0 )
+	{
+		redundantSkipped_++;
+		return DEVICE_OK;
+	}
+
+	int ret = ExecuteOps( ops, count, cmd.retries );
+	CommitShadows( before, state, ret == DEVICE_OK );
+
+	return ret;
+}
+
+//Strict priority: one command from the highest non-empty class per pass, so a safety
+//command waits at most for the command already on the bus
+int ILDAHub::RunWorker()
+{
+	ILDABusCommand cmd;
+
+	for(;;)
+	{
+		bool popped = false;
+		for( int p = 0; p < busPriorityTotal && !popped; p++ )
+		{
+			popped = queues_[p].Pop( cmd );
+		}
+
+		if( popped )
+		{
+			int ret = Execute( cmd );
+			if( ret != DEVICE_OK )
+			{
+				asyncFailures_++;
+				LogMessage("Error: Queued Bus Write Failed", false);
+				LogMessageCode(ret, false);
+			}
+			classPending_[cmd.priority]--;
+			pending_[cmd.client]--;
+			continue;
+		}
+
+		//Drained, exit only once nothing is left to send
+		if( stopWorker_.load() )
+		{
+			break;
+		}
+
+		std::unique_lock<std::mutex> guard( wakeLock_ );
+		workerSleeping_.store( true );
+		if( QueuesEmpty() && !stopWorker_.load() )
+		{
+			wake_.wait_for( guard, std::chrono::milliseconds( 10 ) );
+		}
+		workerSleeping_.store( false );
+	}
+
+	return 0;
+}
+
+void ILDAHub::StartWorker()
+{
+	if( worker_ )
+	{
+		return;
+	}
+
+	stopWorker_.store( false );
+	worker_ = new ILDABusWorker( this );
+	worker_->activate();
+}
+
+void ILDAHub::StopWorker()
+{
+	if( !worker_ )
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard( wakeLock_ );
+		stopWorker_.store( true );
+		wake_.notify_one();
+	}
+
+	worker_->wait();
+	delete worker_;
+	worker_ = nullptr;
+}
+
+bool ILDAHub::QueuesEmpty()
+{
+	for( int i = 0; i < busPriorityTotal; i++ )
+	{
+		if( !queues_[i].Empty() )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//A timeout of 0 waits for as long as it takes, otherwise false once it has passed with work still queued
+bool ILDAHub::WaitForIdle(double timeoutMs)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+		std::chrono::microseconds( (long long) (timeoutMs * 1000) );
+	while( Busy() )
+	{
+		if( timeoutMs > 0 && std::chrono::steady_clock::now() >= deadline )
+		{
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+/*******************************************************************
+Action Handlers
+*******************************************************************/
+int ILDAHub::OnVID(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(vid_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+	  double vidDummy;
+      pProp->Get(vidDummy);
+	  if(!vidDummy)
+	  {
+		  LogMessage("Failed to Update Value");
+	  }
+	  else
+	  {
+	    vid_ = (long) vidDummy;
+	  }
+   }
+   return DEVICE_OK;
+}
+
+
+int ILDAHub::OnPID(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(pid_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+	  double pidDummy;
+      pProp->Get(pidDummy);
+	  if(!pidDummy)
+	  {
+		  LogMessage("Failed to Update Value");
+	  }
+	  else
+	  {
+	    pid_ = (long) pidDummy;
+	  }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBridgeSerial(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(bridgeSerial_.c_str());
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(bridgeSerial_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBridgeIndex(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(bridgeIndex_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(bridgeIndex_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnStartMode(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set((warmStart_) ? g_ILDAStartWarm : g_ILDAStartCold);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string mode;
+      pProp->Get(mode);
+      warmStart_ = (mode == g_ILDAStartWarm);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnWarmStartSeeded(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(warmStartSeeded_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnDetectionTime(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(detectionMs_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnDetectionPath(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(detectionPath_.c_str());
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnTransport(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(transportName_.c_str());
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      //Backend is fixed once the hub is initialized
+      if( initialized_ )
+      {
+         pProp->Set(transportName_.c_str());
+         return DEVICE_OK;
+      }
+      pProp->Get(transportName_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnMCP4728WriteMode(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (mcp4728Deferred_) ? g_ILDAMCP4728WriteDeferred : g_ILDAMCP4728WriteSingle );
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string mode;
+      pProp->Get(mode);
+      mcp4728Deferred_ = (mode == g_ILDAMCP4728WriteDeferred);
+
+      //Nothing may be left stranded when leaving deferred mode
+      if( !mcp4728Deferred_ )
+      {
+         return FlushMCP4728();
+      }
+   }
+   return DEVICE_OK;
+}
+
+//Action Property: sends all staged laser and shutter codes as one frame
+int ILDAHub::OnMCP4728Commit(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      if( action == "Commit" )
+      {
+         pProp->Set("Idle");
+         return FlushMCP4728();
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnPowerOnDefaults(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      if( action == "Commit" )
+      {
+         pProp->Set("Idle");
+         return CommitPowerOnDefaults();
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnPowerOnDefaultsStatus(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(powerOnDefaultsStatus_.c_str());
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBusMode(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (asynchronous_.load()) ? "Asynchronous" : "Synchronous" );
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string mode;
+      pProp->Get(mode);
+
+      //Queued commands finish before writes go back to the calling thread
+      if( mode == "Synchronous" && asynchronous_.load() )
+      {
+         WaitForIdle();
+      }
+      asynchronous_.store( mode == "Asynchronous" );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnQueueDepth(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      long depth = 0;
+      for( int i = 0; i < busPriorityTotal; i++ )
+      {
+         depth += (long) queues_[i].Size();
+      }
+      pProp->Set( depth );
+   }
+   return DEVICE_OK;
+}
+
+//stat = class * 3 + (0 depth, 1 max wait, 2 mean wait)
+int ILDAHub::OnBusClassStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      long priority = stat / 3;
+      switch( stat % 3 )
+      {
+        case 0:
+          pProp->Set( (long) queues_[priority].Size() );
+          break;
+        case 1:
+          pProp->Set( (double) classWaitMaxUs_[priority].load() );
+          break;
+        default:
+        {
+          long executed = classExecuted_[priority].load();
+          pProp->Set( (executed > 0) ? (double) classWaitTotalUs_[priority].load() / executed : 0.0 );
+        }
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBatchPreempted(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( batchPreempted_.load() );
+   }
+   return DEVICE_OK;
+}
+
+//stat = (target * busOutcomeTotal + outcome) * 4 + (0 count, 1 p50, 2 p99, 3 max)
+int ILDAHub::OnBusLatencyStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      const ILDALatencyHistogram& histogram = busLatency_[stat / (busOutcomeTotal * 4)][(stat / 4) % busOutcomeTotal];
+      switch( stat % 4 )
+      {
+        case 0:
+          pProp->Set( (long) histogram.GetCount() );
+          break;
+        case 1:
+          pProp->Set( histogram.GetPercentile( 0.5 ) );
+          break;
+        case 2:
+          pProp->Set( histogram.GetPercentile( 0.99 ) );
+          break;
+        default:
+          pProp->Set( histogram.GetMax() );
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBusLatencyReset(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set("Idle");
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      if( action == "Reset" )
+      {
+         for( int target = 0; target < busTargetTotal; target++ )
+         {
+            for( int outcome = 0; outcome < busOutcomeTotal; outcome++ )
+            {
+               busLatency_[target][outcome].Reset();
+            }
+         }
+      }
+      pProp->Set("Idle");
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBusTraceFile(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(busTraceFile_.c_str());
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(busTraceFile_);
+   }
+   return DEVICE_OK;
+}
+
+//The ring is copied out under the bus lock, the file is written and converted to JSON after it is released
+int ILDAHub::OnBusTraceAction(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set("Idle");
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      int result = ildaTraceOk;
+      if( action == "Clear" )
+      {
+         MMThreadGuard guard( busLock_ );
+         busTrace_.Clear();
+      }
+      else if( action == "Dump" || action == "Export Chrome Trace" )
+      {
+         std::vector<ILDATraceRecord> records;
+         {
+            MMThreadGuard guard( busLock_ );
+            busTrace_.Snapshot( records );
+         }
+         result = ILDABusTrace::Save( busTraceFile_.c_str(), records );
+         if( result == ildaTraceOk && action == "Export Chrome Trace" )
+         {
+            result = ILDABusTrace::ConvertToChromeTrace( busTraceFile_.c_str(), (busTraceFile_ + g_ILDABusTraceJsonSuffix).c_str() );
+         }
+      }
+      busTraceStatus_ = ILDABusTrace::GetResultText( result );
+      pProp->Set("Idle");
+      if( result != ildaTraceOk )
+      {
+         LogMessage(busTraceStatus_.c_str(), false);
+         return DEVICE_ERR;
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBusTraceRecords(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (long) busTrace_.GetCount() );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnBusTraceStatus(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(busTraceStatus_.c_str());
+   }
+   return DEVICE_OK;
+}
+
+//Runs on the property thread with its own transport, the live bus is not touched
+int ILDAHub::OnReplay(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set("Idle");
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      pProp->Set("Idle");
+      if( action != g_ILDAReplayOriginal && action != g_ILDAReplayFast )
+      {
+         return DEVICE_OK;
+      }
+
+      std::vector<ILDATraceRecord> records;
+      int result = ILDABusTrace::Load( busTraceFile_.c_str(), records );
+      busTraceStatus_ = ILDABusTrace::GetResultText( result );
+      if( result != ildaTraceOk && result != ildaTraceTruncated )
+      {
+         LogMessage(busTraceStatus_.c_str(), false);
+         return DEVICE_ERR;
+      }
+
+      ILDASimulatedTransport bridge( simReportLatencyUs_, simI2cClockHz_, (unsigned int) simOverheadReports_ );
+      bridge.SetRealTime( false );
+      replayOptions_.originalTiming = (action == g_ILDAReplayOriginal);
+      ILDATraceReplay::Run( records, bridge, replayOptions_, replayResult_ );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnReplayOption(MM::PropertyBase* pProp, MM::ActionType pAct, long option)
+{
+   bool * flags[3] = { &replayOptions_.skipRedundant, &replayOptions_.coalesce, &replayOptions_.batch };
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (*flags[option]) ? "On" : "Off" );
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string value;
+      pProp->Get(value);
+      *flags[option] = (value == "On");
+   }
+   return DEVICE_OK;
+}
+
+//stat indexes g_ILDAReplayStatNames
+int ILDAHub::OnReplayStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      const ILDAReplayResult& r = replayResult_;
+      const unsigned long counts[4] = { r.transfers, r.skipped, r.coalesced, r.merged };
+      if( stat < 4 )
+      {
+         pProp->Set( (long) counts[stat] );
+      }
+      else
+      {
+         const double values[5] = { r.busUs / 1000, r.spanUs / 1000, r.latency.GetPercentile( 0.5 ),
+            r.latency.GetPercentile( 0.99 ), r.latency.GetMax() };
+         pProp->Set( values[stat - 4] );
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnAsyncFailures(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( asyncFailures_.load() );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnForceRefresh(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (forceRefresh_) ? "Always" : "Off" );
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string mode;
+      pProp->Get(mode);
+      forceRefresh_ = (mode == "Always");
+
+      //One-shot: every register is written again the next time it is set
+      if( mode == "Once" )
+      {
+         InvalidateShadow( ~0u );
+         pProp->Set("Off");
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnRedundantSkipped(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( redundantSkipped_.load() );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnTiltCoalescing(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (tiltCoalescing_) ? "On" : "Off" );
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string mode;
+      pProp->Get(mode);
+      tiltCoalescing_ = (mode == "On");
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnTiltCoalesced(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( tiltCoalesced_.load() );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnTiltXY(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      char buf[MM::MaxStrLength];
+      snprintf(buf, MM::MaxStrLength, "%g,%g", tiltXY_[x], tiltXY_[y]);
+      pProp->Set(buf);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string xy;
+      pProp->Get(xy);
+      double xVolts, yVolts;
+      if( sscanf(xy.c_str(), "%lf,%lf", &xVolts, &yVolts) != 2 )
+      {
+         return DEVICE_INVALID_PROPERTY_VALUE;
+      }
+      return SetXY(xVolts, yVolts);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnPreset(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(presetApplied_.c_str());
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string name;
+      pProp->Get(name);
+      if( name != g_ILDAPresetNone )
+      {
+         int ret = ApplyPreset(name);
+         if( ret != DEVICE_OK )
+         {
+            return ret;
+         }
+      }
+      presetApplied_ = name;
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnPresetName(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(presetName_.c_str());
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(presetName_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnPresetAction(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set("Idle");
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      pProp->Set("Idle");
+      if( action == "Save" )
+      {
+         int ret = SavePreset(presetName_);
+         if( ret != DEVICE_OK )
+         {
+            return ret;
+         }
+      }
+      else if( action == "Delete" )
+      {
+         DeletePreset(presetName_);
+         if( presetApplied_ == presetName_ )
+         {
+            presetApplied_ = g_ILDAPresetNone;
+         }
+      }
+      else
+      {
+         return DEVICE_OK;
+      }
+
+      RefreshPresetList();
+      if( WritePresetFile() != DEVICE_OK )
+      {
+         LogMessage("Presets could not be written to " + presetFile_, false);
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnPresetFile(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(presetFile_.c_str());
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(presetFile_);
+   }
+   return DEVICE_OK;
+}
+
+//"r,g,b,shutter,x,y" for the selected name (empty while it is undefined)
+int ILDAHub::OnPresetDefinition(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      std::map<std::string, ILDAPreset>::const_iterator found = presets_.find( presetName_ );
+      if( found == presets_.end() )
+      {
+         pProp->Set("");
+         return DEVICE_OK;
+      }
+      const ILDAPreset& preset = found->second;
+      char buf[MM::MaxStrLength];
+      snprintf(buf, MM::MaxStrLength, "%g,%g,%g,%d,%g,%g", preset.laserVolts[red637], preset.laserVolts[green532],
+         preset.laserVolts[blue445], (preset.shutterOpen) ? 1 : 0, preset.tiltVolts[x], preset.tiltVolts[y]);
+      pProp->Set(buf);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string definition;
+      pProp->Get(definition);
+      ILDAPreset preset;
+      int shutter;
+      if( presetName_.empty() || presetName_ == g_ILDAPresetNone ||
+         sscanf(definition.c_str(), "%lf,%lf,%lf,%d,%lf,%lf", &preset.laserVolts[red637], &preset.laserVolts[green532],
+            &preset.laserVolts[blue445], &shutter, &preset.tiltVolts[x], &preset.tiltVolts[y]) != 6 )
+      {
+         return DEVICE_INVALID_PROPERTY_VALUE;
+      }
+      preset.shutterOpen = shutter != 0;
+      DefinePreset(presetName_, preset);
+      RefreshPresetList();
+      if( WritePresetFile() != DEVICE_OK )
+      {
+         LogMessage("Presets could not be written to " + presetFile_, false);
+      }
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnFrameCacheSize(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set( (long) frameCache_.GetCapacity() );
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      long points;
+      pProp->Get(points);
+      std::lock_guard<std::mutex> guard( batchLock_ );
+      frameCache_.SetCapacity( (size_t) points );
+   }
+   return DEVICE_OK;
+}
+
+//0 = Hits, 1 = Misses, 2 = Evictions
+int ILDAHub::OnFrameCacheStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      unsigned long value = (stat == 0) ? frameCache_.GetHits() :
+         (stat == 1) ? frameCache_.GetMisses() : frameCache_.GetEvictions();
+      pProp->Set( (long) value );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnEncoderBenchmark(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set("Idle");
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      std::string action;
+      pProp->Get(action);
+      if( action == "Run" )
+      {
+         //A copy, so the player is not held off for the length of the run
+         ILDABatchEncoder encoder;
+         {
+            std::lock_guard<std::mutex> guard( stageLock_ );
+            encoder = encoder_;
+         }
+         encoderThroughput_ = encoder.Benchmark( g_ILDAEncoderBenchmarkSamples, g_ILDAEncoderBenchmarkMs );
+      }
+      pProp->Set("Idle");
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnEncoderThroughput(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(encoderThroughput_);
+   }
+   return DEVICE_OK;
+}
+
+//Latency Model Properties (only created for the Simulated transport)
+int ILDAHub::CreateSimulatedProperties()
+{
+   CPropertyAction* pAct = new CPropertyAction(this, &ILDAHub::OnSimLatency);
+   int ret = CreateProperty("Simulated Report Latency (us)", NumToToken(simReportLatencyUs_), MM::Float, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   SetPropertyLimits("Simulated Report Latency (us)", 0, 100000);
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnSimI2cClock);
+   ret = CreateProperty("Simulated I2C Clock (Hz)", NumToToken(simI2cClockHz_), MM::Float, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   SetPropertyLimits("Simulated I2C Clock (Hz)", 0, 1000000);
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnSimOverheadReports);
+   ret = CreateProperty("Simulated Overhead Reports", NumToToken(simOverheadReports_), MM::Integer, false, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+   SetPropertyLimits("Simulated Overhead Reports", 0, 8);
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnSimBusTime);
+   ret = CreateProperty("Simulated Bus Time (us)", "0", MM::Float, true, pAct);
+   if (DEVICE_OK != ret)
+      return ret;
+
+   pAct = new CPropertyAction(this, &ILDAHub::OnSimOutputs);
+   return CreateProperty("Simulated DAC Outputs (V)", "", MM::String, true, pAct);
+}
+
+int ILDAHub::OnSimLatency(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(simReportLatencyUs_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(simReportLatencyUs_);
+      ILDASimulatedTransport* sim = static_cast<ILDASimulatedTransport*>(transport_);
+      sim->SetLatencyModel(simReportLatencyUs_, simI2cClockHz_, (unsigned int) simOverheadReports_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnSimI2cClock(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(simI2cClockHz_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(simI2cClockHz_);
+      ILDASimulatedTransport* sim = static_cast<ILDASimulatedTransport*>(transport_);
+      sim->SetLatencyModel(simReportLatencyUs_, simI2cClockHz_, (unsigned int) simOverheadReports_);
+   }
+   return DEVICE_OK;
+}
+
+int ILDAHub::OnSimOverheadReports(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(simOverheadReports_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(simOverheadReports_);
+      ILDASimulatedTransport* sim = static_cast<ILDASimulatedTransport*>(transport_);
+      sim->SetLatencyModel(simReportLatencyUs_, simI2cClockHz_, (unsigned int) simOverheadReports_);
+   }
+   return DEVICE_OK;
+}
+
+//Total time the simulated bridge has spent on USB reports and I2C clocking
+int ILDAHub::OnSimBusTime(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      ILDASimulatedTransport* sim = static_cast<ILDASimulatedTransport*>(transport_);
+      pProp->Set(sim->GetSimulatedTime());
+   }
+   return DEVICE_OK;
+}
+
+//What the modelled chips are driving (tilt magnitudes, the sign comes from the GPIO switches).
+//The models change under the bus lock as frames are decoded, so they are read under it too.
+int ILDAHub::OnSimOutputs(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      if( !simMcp4728_ || !simTilt_[x] || !simTilt_[y] )
+      {
+         pProp->Set("");
+         return DEVICE_OK;
+      }
+
+      char text[160];
+      {
+         MMThreadGuard guard( busLock_ );
+         snprintf( text, sizeof(text), "A=%.4f B=%.4f C=%.4f D=%.4f X=%.4f Y=%.4f",
+            simMcp4728_->GetOutput(0), simMcp4728_->GetOutput(1), simMcp4728_->GetOutput(2), simMcp4728_->GetOutput(3),
+            simTilt_[x]->GetOutput(), simTilt_[y]->GetOutput() );
+      }
+      pProp->Set(text);
+   }
+   return DEVICE_OK;
+}
+
+/************************************************************
+MCP4721 Base Class Member Functions
+*************************************************************/
+ILDAMCP4271::ILDAMCP4271(unsigned long resolution)
+{
+   //Initialize Base Class Members
+   addressDacI2C_ = g_ShutterAndLaserDACI2CAddress;
+   busClient_ = hubClient;
+   hub_ = nullptr;
+   resolution_ = resolution;
+   voltage_ = 0;
+   writeRetries_ = 1;
+   voltageMin_ = 0;
+   queuedVoltage_ = 0;
+   queuedCode_ = 0;
+   voltageQueued_ = false;
+   presetSeen_ = 0;
+   ApplyRange( mcp4728RangeVdd );
+}
+
+//Queued (asynchronous bus) and staged (deferred mode) codes count once the shadow shows them on the chip
+void ILDAMCP4271::CompleteVoltage( unsigned int voltageCode )
+{
+	int channel = addressDACChannel_ >> 1;
+	if( hub_->IsAsynchronous() || hub_->IsMCP4728Staged( channel ) )
+	{
+		queuedVoltage_ = converter_.ToVolts( voltageCode );
+		queuedCode_ = voltageCode;
+		voltageQueued_ = true;
+		return;
+	}
+	voltage_ = converter_.ToVolts( voltageCode );
+	voltageQueued_ = false;
+}
+
+//A queued write that failed or was overwritten by another client leaves voltage_ as it was
+long double ILDAMCP4271::GetVoltage( void)
+{
+	if( !hub_ )
+	{
+		return voltage_;
+	}
+	SyncToPreset();
+	if( !voltageQueued_ )
+	{
+		return voltage_;
+	}
+
+	int channel = addressDACChannel_ >> 1;
+	unsigned int code;
+	if( hub_->GetShadow( mcp4728ChannelA + channel, code ) && code == queuedCode_ && !hub_->IsMCP4728Staged( channel ) )
+	{
+		voltage_ = queuedVoltage_;
+		voltageQueued_ = false;
+	}
+	else if( !hub_->IsClientBusy( busClient_ ) && !hub_->IsMCP4728Staged( channel ) )
+	{
+		voltageQueued_ = false;
+	}
+	return voltage_;
+}
+
+//A preset applied since the last look moved the channel, voltage_ follows the shadow again
+bool ILDAMCP4271::SyncToPreset( void)
+{
+	unsigned long generation = hub_->GetPresetGeneration();
+	if( generation == presetSeen_ )
+	{
+		return false;
+	}
+	presetSeen_ = generation;
+
+	unsigned int code;
+	if( !hub_->GetShadow( mcp4728ChannelA + (addressDACChannel_ >> 1), code ) )
+	{
+		return false;
+	}
+	voltage_ = converter_.ToVolts( code );
+	voltageQueued_ = false;
+	return true;
+}
+
+void ILDAMCP4271::ApplyRange( int range )
+{
+   range_ = range;
+   voltageMax_ = g_ILDAMCP4728RangeVolts[range];
+   voltageInc_ = (voltageMax_ - voltageMin_) / resolution_;
+   ConfigureConversion();
+}
+
+int ILDAMCP4271::SetRange( int range )
+{
+	if( range < 0 || range >= mcp4728RangeTotal )
+	{
+		return DEVICE_INVALID_PROPERTY_VALUE;
+	}
+	if (!hub_)
+	{
+	  return DEVICE_COMM_HUB_MISSING;
+	}
+
+	ApplyRange( range );
+	hub_->SetMCP4728Range( addressDACChannel_ >> 1, range );
+
+	//Reference, gain and the rescaled code go out together in one multi-write
+	return SetVoltage( GetRequestedVoltage(), singleWrite );
+}
+
+int ILDAMCP4271::SetVoltage(long double setVoltage, WriteCmdTypes writeCmd)
+{
+	if (!hub_)
+	{
+	  return DEVICE_COMM_HUB_MISSING;
+	}
+
+	//Saturates at the top code of the active range
+	return SetCode( converter_.ToCode( (double) setVoltage ), writeCmd );
+}
+
+int ILDAMCP4271::SetCode(unsigned int voltageCode, WriteCmdTypes writeCmd)
+{
+	if (!hub_)
+	{
+	  return DEVICE_COMM_HUB_MISSING;
+	}
+
+	int ret;
+	//Determine Command Byte Operation
+	switch(writeCmd)
+	{
+	  case singleWrite:
+		//Write only to one DAC Channel (hub retries up to writeRetries_ attempts)
+		//Skipped by the hub while the shadow register already holds this code
+		ret = hub_->WriteMCP4728Channel( addressDACChannel_ >> 1, voltageCode, writeRetries_, busClient_ );
+		if( ret == DEVICE_OK )
+		{
+			CompleteVoltage( voltageCode );
+		}
+		return ret;
+	  case fastWrite:
+		//Staged in the hub, goes out with the other channels in one frame
+		ret = hub_->StageMCP4728Code( addressDACChannel_ >> 1, voltageCode );
+		if( ret == DEVICE_OK && !hub_->GetMCP4728Deferred() )
+		{
+			ret = hub_->FlushMCP4728( writeRetries_, busClient_ );
+		}
+		if( ret == DEVICE_OK )
+		{
+			CompleteVoltage( voltageCode );
+		}
+		return ret;
+	  default:
+		  return DEVICE_ERR;
+	}
+}
+
+
+/***************************************************************
+  ILDALaser Implementation
+  *************************************************************/
+
+ILDALaser::ILDALaser( BeamColor color, unsigned long resolution ) : ILDAMCP4271( resolution ),
+initialized_(false),
+busy_(false),
+addressSwitch_(g_LaserSwitchAddress),
+color_(color),
+powerPos_(0),
+numPos_(16),
+presetState_(0)
+{
+   //MCP4171 Object Specific Hardware Properties
+   //Color Specific Address Bits
+   addressDACChannel_= g_ILDALaserDACChannelBits[color]; 
+   busClient_ = red637Client + color;
+
+
+   //
+   addressSwitchChannel_ = g_ILDALaserSwitchChannelBits[color];
+
+   // Description
+   int ret = CreateProperty(MM::g_Keyword_Description, g_ILDALaserDescrips[color], MM::String, true);
+   assert(DEVICE_OK == ret);
+
+   // Name
+   ret = CreateProperty(MM::g_Keyword_Name, g_ILDALaserNames[color], MM::String, true);
+   assert(DEVICE_OK == ret);
+   
+   name_ =  g_ILDALaserNames[color];
+
+   //Measured power curve, "volts:mW;volts:mW;..." (empty keeps the states linear in volts)
+   CPropertyAction* pAct = new CPropertyAction (this, &ILDALaser::OnCalibration);
+   ret = CreateProperty(g_ILDALaserCalibrationProp, "", MM::String, false, pAct, true);
+   assert(DEVICE_OK == ret);
+
+   // parent ID display
+   CreateHubIDProperty();
+
+}
+
+void ILDALaser::GetName(char* pName) const
+{
+   CDeviceUtils::CopyLimitedString(pName, name_.c_str());
+}
+	  
+//Busy until this laser's queued DAC writes have gone out
+bool ILDALaser::Busy()
+{
+	return (hub_) ? hub_->IsClientBusy( busClient_ ) : false;
+}
+
+int ILDALaser::Initialize()
+{
+   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
+
+   char hubLabel[MM::MaxStrLength];
+   hub->GetLabel(hubLabel);
+   SetParentID(hubLabel); // for backward comp.
+
+   hub_ = hub;
+   ApplyRange( hub_->GetMCP4728Range( addressDACChannel_ >> 1 ) );
+
+   //Warm start: begin from what the channel really outputs
+   unsigned int code;
+   if( hub_->GetShadow( mcp4728ChannelA + (addressDACChannel_ >> 1), code ) )
+   {
+      voltage_ = converter_.ToVolts( code );
+   }
+
+   // set property list
+   // -----------------
+
+   //Calibration from the settings file overrides the configuration value when present
+   char calibration[MM::MaxStrLength];
+   GetProperty(g_ILDALaserCalibrationProp, calibration);
+   int nRet = SetPreInitProperty( g_ILDALaserCalibrationProp, calibration );
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   // create positions and labels for power settings
+   // create positions and labels (percent of the calibrated maximum, or of full scale)
+   const int bufSize = 65;
+   char buf[bufSize];
+   for (long i=0; i<numPos_; i++)
+   {
+	  long percentage = (long) floor( 100 * GetStateFraction( i ) + 0.5 );
+      snprintf(buf, bufSize, "%d%%", (unsigned)percentage);
+      SetPositionLabel(i, buf);
+   }
+   BuildStateCodes();
+
+   // State
+   // -----
+   CPropertyAction* pAct = new CPropertyAction (this, &ILDALaser::OnState);
+   nRet = CreateProperty(MM::g_Keyword_State, "0", MM::Integer, false, pAct);
    if (nRet != DEVICE_OK)
       return nRet;
    SetPropertyLimits(MM::g_Keyword_State, 0, numPos_ - 1);
 
-   // Label
+   // Label
+   // -----
+   pAct = new CPropertyAction (this, &CStateBase::OnLabel);
+   nRet = CreateProperty(MM::g_Keyword_Label, "", MM::String, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   //Raw Voltage Control
+   pAct = new CPropertyAction (this, &ILDALaser::OnVoltage);
+   nRet = CreateProperty("Voltage", NumToToken( voltage_ ), MM::Float, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   SetPropertyLimits("Voltage", voltageMin_, voltageMax_);
+
+   //Without a stored value the output is left as it is (matching writes are skipped anyway)
+   SetPreInitProperty( "Voltage", NumToToken( voltage_ ) );
+
+   //Reference/gain of this channel (a lower range gives finer steps at low power)
+   pAct = new CPropertyAction (this, &ILDALaser::OnRange);
+   nRet = CreateProperty("DAC Range", g_ILDAMCP4728RangeNames[range_], MM::String, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   for (int i = 0; i < mcp4728RangeTotal; i++)
+   {
+      AddAllowedValue("DAC Range", g_ILDAMCP4728RangeNames[i]);
+   }
+
+   //I2C write retries
+   pAct = new CPropertyAction (this, &ILDALaser::OnRetries);
+   nRet = CreateProperty("Write Retries", NumToToken( writeRetries_ ), MM::Integer, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   //Calibrated power of the current state (0 while uncalibrated)
+   pAct = new CPropertyAction (this, &ILDALaser::OnStatePower);
+   nRet = CreateProperty("State Power (mW)", "0", MM::Float, true, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   nRet = UpdateStatus();
+
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   initialized_ = true;
+
+   return DEVICE_OK;
+}
+
+int ILDALaser::Shutdown()
+{
+	initialized_ = false;
+	
+	return DEVICE_OK;
+}
+
+/******************************************************
+  Property Actions
+******************************************************/
+
+//Every position already has its code, a state change is one (shadow checked) DAC write
+int ILDALaser::OnState(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      //Cached unless a preset moved the channel
+      SyncPowerPos();
+      pProp->Set( (long) powerPos_ );
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      if( !hub_ )
+      {
+         return DEVICE_COMM_HUB_MISSING;
+      }
+
+      long powerPos;
+      pProp->Get(powerPos);
+      if( powerPos < 0 || powerPos >= (long) stateCodes_.size() )
+      {
+         return DEVICE_INVALID_PROPERTY_VALUE;
+      }
+
+      //Deferred codes wait in the hub for a commit or shutter change
+      int ret = SetCode( stateCodes_[powerPos], (hub_->GetMCP4728Deferred()) ? fastWrite : singleWrite );
+      if( ret != DEVICE_OK )
+      {
+         return ret;
+      }
+      SetPowerPos(powerPos);
+      UpdateProperty( "Voltage" );
+      UpdateProperty( "State Power (mW)" );
+    }
+                                          
+
+   return DEVICE_OK;
+}
+
+int ILDALaser::OnCalibration(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      // nothing to do, let the caller use cached property
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string table;
+      pProp->Get(table);
+      if( table.find_first_not_of( " \t" ) == std::string::npos )
+      {
+         powerCurve_.Clear();
+      }
+      else if( !powerCurve_.Parse( table ) )
+      {
+         LogMessage( "Power calibration needs volts:mW pairs with power rising with voltage", false );
+         return DEVICE_INVALID_PROPERTY_VALUE;
+      }
+
+      if( initialized_ )
+      {
+         BuildStateCodes();
+      }
+   }
+
+   return DEVICE_OK;
+}
+
+int ILDALaser::OnRange(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(g_ILDAMCP4728RangeNames[range_]);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string name;
+      pProp->Get(name);
+      int range = 0;
+      while( range < mcp4728RangeTotal && name != g_ILDAMCP4728RangeNames[range] )
+      {
+         range++;
+      }
+
+      int ret = SetRange(range);
+      if( ret != DEVICE_OK )
+      {
+         return ret;
+      }
+
+      SetPropertyLimits("Voltage", voltageMin_, voltageMax_);
+      BuildStateCodes();
+      UpdateProperty("Voltage");
+   }
+   return DEVICE_OK;
+}
+
+int ILDALaser::OnStatePower(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      SyncPowerPos();
+      pProp->Set( GetStateFraction( powerPos_ ) * powerCurve_.GetPowerMax() );
+   }
+
+   return DEVICE_OK;
+}
+
+//Interpolation runs here once per state, never on a state change
+//The 0% state is always off (code 0), even when the lowest calibration point is above 0 mW
+void ILDALaser::BuildStateCodes( void)
+{
+   stateCodes_.resize( numPos_ );
+   for( long i = 0; i < numPos_; i++ )
+   {
+      double fraction = GetStateFraction( i );
+      if( fraction <= 0 )
+      {
+         stateCodes_[i] = 0;
+         continue;
+      }
+      double volts = (powerCurve_.IsCalibrated()) ? powerCurve_.VoltsForPower( fraction * powerCurve_.GetPowerMax() )
+         : voltageMin_ + fraction * (voltageMax_ - voltageMin_);
+      stateCodes_[i] = converter_.ToCode( volts );
+   }
+}
+
+//After a preset the state is the one whose code is nearest what the preset left on the channel
+void ILDALaser::SyncPowerPos( void)
+{
+   GetVoltage();
+   if( presetState_ == presetSeen_ || stateCodes_.empty() )
+   {
+      return;
+   }
+   presetState_ = presetSeen_;
+
+   unsigned int code = converter_.ToCode( (double) voltage_ );
+   unsigned long nearest = 0;
+   for( unsigned long i = 1; i < stateCodes_.size(); i++ )
+   {
+      if( abs( (int) stateCodes_[i] - (int) code ) < abs( (int) stateCodes_[nearest] - (int) code ) )
+      {
+         nearest = i;
+      }
+   }
+   SetPowerPos( nearest );
+}
+
+int ILDALaser::OnVoltage(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+
+   if (eAct == MM::BeforeGet)
+   {
+      //State changes also move the output
+      pProp->Set((double) GetVoltage());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      if( !hub_ )
+      {
+         return DEVICE_COMM_HUB_MISSING;
+      }
+
+      double currentVoltage;
+      pProp->Get(currentVoltage);
+	  //Deferred codes wait in the hub for a commit or shutter change
+	  int ret = SetVoltage(currentVoltage, (hub_->GetMCP4728Deferred()) ? fastWrite : singleWrite);
+	  ILDA_TRACE_ERROR( ret );
+	  pProp->Set((double) GetVoltage());
+	  UpdateProperty( "Voltage" );
+	  return ret;
+   }
+                                          
+   return DEVICE_OK;
+
+}
+
+int ILDALaser::OnRetries(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+
+   if (eAct == MM::BeforeGet)
+   {
+      // nothing to do, let the caller use cached property
+   }
+   else if (eAct == MM::AfterSet)
+   {
+	  double proxy;
+      pProp->Get(proxy);
+	  writeRetries_ = (int) proxy;
+   }
+                                          
+   return DEVICE_OK;
+
+}
+
+/***************************************************************
+ILDASystemShutter Implementation
+***************************************************************/
+
+
+ILDASystemShutter::ILDASystemShutter( unsigned long resolution ) : ILDAMCP4271( resolution ),
+initialized_(false), 
+name_(g_SystemShutterName)
+{
+
+   //MCP4171 Object Specific Hardware Properties
+   //Shutter DAC Channel Address
+   addressDACChannel_= g_ILDASystemShutterChannelBit; 
+   busClient_ = shutterClient;
+
+   InitializeDefaultErrorMessages();
+   //EnableDelay();
+
+   // Name
+   int ret = CreateProperty(MM::g_Keyword_Name, g_SystemShutterName, MM::String, true);
+   assert(DEVICE_OK == ret);
+
+   // Description
+   ret = CreateProperty(MM::g_Keyword_Description, "Whole System Shutter (Meant for On-Off Purposes)", MM::String, true);
+   assert(DEVICE_OK == ret);
+
+   // parent ID display
+   CreateHubIDProperty();
+}
+
+ILDASystemShutter::~ILDASystemShutter()
+{
+   Shutdown();
+}
+
+void ILDASystemShutter::GetName(char* name) const
+{
+   CDeviceUtils::CopyLimitedString(name, name_.c_str());
+}
+
+bool ILDASystemShutter::Busy()
+{
+   //Electronic Shutter, only busy while its DAC write is queued
+   /*MM::MMTime interval = GetCurrentMMTime() - changedTime_;
+
+   if (interval < (1000.0 * GetDelayMs() ))
+      return true;
+   else*/
+       return (hub_) ? hub_->IsClientBusy( busClient_ ) : false;
+}
+
+int ILDASystemShutter::Initialize()
+{
+   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
+   if (!hub) {
+      //return ;
+   }
+   char hubLabel[MM::MaxStrLength];
+   hub->GetLabel(hubLabel);
+   SetParentID(hubLabel); // for backward comp.
+
+   hub_ = hub;
+   ApplyRange( hub_->GetMCP4728Range( addressDACChannel_ >> 1 ) );
+
+   // set property list
+   // -----------------
+   
+   // OnOff
+   // ------
+   CPropertyAction* pAct = new CPropertyAction (this, &ILDASystemShutter::OnOnOff);
+   int ret = CreateProperty("OnOff", "0", MM::Integer, false, pAct);
+   if (ret != DEVICE_OK)
+      return ret;
+
+   // set shutter into the off state
+   //WriteToPort(0);
+
+   std::vector<std::string> vals;
+   vals.push_back("0");
+   vals.push_back("1");
+   ret = SetAllowedValues("OnOff", vals);
+   if (ret != DEVICE_OK)
+      return ret;
+
+   ret = UpdateStatus();
+   if (ret != DEVICE_OK)
+      return ret;
+
+   changedTime_ = GetCurrentMMTime();
+   initialized_ = true;
+
+   return DEVICE_OK;
+}
+
+int ILDASystemShutter::Shutdown()
+{
+   if (initialized_)
+   {
+      initialized_ = false;
+   }
+   return DEVICE_OK;
+}
+
+//Note:  Currently Toggles DAC through I2C, however, switch implementation considered for later
+//The OnOff property reads the hub's shutter state, so no property round trip is needed here
+int ILDASystemShutter::SetOpen(bool open)
+{
+	if (!hub_)
+	{
+	  return DEVICE_COMM_HUB_MISSING;
+	}
+	ILDA_TRACE_WRITE( (open) ? "Shutter open" : "Shutter close" );
+
+	//In deferred mode the shutter write also carries any staged laser codes
+	bool deferred = hub_->GetMCP4728Deferred();
+	WriteCmdTypes writeCmd = (deferred) ? fastWrite : singleWrite;
+
+	int ret = SetVoltage( (open) ? voltageMax_ : voltageMin_, writeCmd );
+	if( deferred && ret == DEVICE_OK )
+	{
+		ret = hub_->FlushMCP4728( writeRetries_, busClient_ );
+	}
+	ILDA_TRACE_ERROR( ret );
+	if( ret != DEVICE_OK )
+	{
+		return ret;
+	}
+
+	hub_->SetShutterState( open );
+	return DEVICE_OK;
+}
+
+int ILDASystemShutter::GetOpen(bool& open)
+{
+   if (!hub_)
+   {
+      return DEVICE_COMM_HUB_MISSING;
+   }
+   open = hub_->GetShutterState();
+
+   return DEVICE_OK;
+}
+
+int ILDASystemShutter::Fire(double /*deltaT*/)
+{
+   return DEVICE_UNSUPPORTED_COMMAND;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Action handlers
+///////////////////////////////////////////////////////////////////////////////
+
+int ILDASystemShutter::OnOnOff(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
+   if (eAct == MM::BeforeGet)
+   {
+      // get initialized state
+      pProp->Set((long)hub->GetShutterState());
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long pos;
+      pProp->Get(pos);
+      if (pos != 0 && pos != 1)
+	  {
+         return DEVICE_ERR; // turn everything off
+	  }
+      else
+	  {
+		//Communicate to Hub
+        hub->SetShutterState( (bool) pos );
+	  }
+   }
+
+   return DEVICE_OK;
+}
+
+
+/************************************************************
+MCP4721 Base Class Member Functions
+*************************************************************/
+ILDADac8571::ILDADac8571(TiltDirection axis, unsigned long resolution )
+{
+   //Initialize Base Class Members
+   addressDacI2C_ = g_ILDATiltDACI2CAddresses[axis];
+   axis_ = axis;
+   busClient_ = xTiltClient + axis;
+   shadowReg_ = dac8571X + axis;
+   hub_ = nullptr;
+   resolution_ = resolution;
+   voltage_ = 0;
+   writeRetries_ = 1;
+   voltageMax_ = 10;
+   voltageMin_ = 0;
+   queuedVoltage_ = 0;
+   queuedCode_ = 0;
+   queuedNeg_ = false;
+   voltageQueued_ = false;
+   presetSeen_ = 0;
+
+   //Fixed since Laser controller is static 0-5Volts currently
+   voltageInc_ = (voltageMax_ - voltageMin_) / resolution;
+   ConfigureConversion();
+}
+
+int ILDADac8571::SetVoltage(long double setVoltage, WriteCmdTypes writeCmd)
+{
+	if (!hub_)
+	{
+	  return DEVICE_COMM_HUB_MISSING;
+	}
+
+	bool neg;
+	unsigned int voltageCode = VoltageToCode( setVoltage, neg );
+
+	//Write only to one DAC Channel
+	const int dataBytes = 3;
+	unsigned char data[dataBytes + 1];
+	//Command Byte Selection and Packaging
+	switch(writeCmd)
+	{
+	  case dispWrite:
+		data[0] = writeCmds_[ writeCmd ];
+		data[1] = (voltageCode >> 8) & 0xFF;
+		data[2] = voltageCode & 0xFF;
+		break;
+	  default:
+		  return DEVICE_ERR;
+	}
+
+	//Shadow register already holds this magnitude (sign lives on the GPIO shadow)
+	if( hub_->IsRedundant( shadowReg_, voltageCode ) )
+	{
+		CompleteVoltage( voltageCode, neg );
+		return DEVICE_OK;
+	}
+	hub_->SetShadow( shadowReg_, voltageCode );
+
+	//trasmitbyte switch (hub retries up to writeRetries_ attempts)
+	int ret = hub_->SubmitI2cWrite(busClient_, addressDacI2C_, data, dataBytes, writeRetries_, 1u << shadowReg_);
+	if( ret == 0  )
+	{
+		CompleteVoltage( voltageCode, neg );
+	}
+
+	return ret;
+
+}
+
+//Queued writes count once the magnitude and sign shadows both show them
+void ILDADac8571::CompleteVoltage( unsigned int voltageCode, bool neg )
+{
+	if( hub_->IsAsynchronous() )
+	{
+		queuedVoltage_ = converter_.ToVolts( voltageCode, neg );
+		queuedCode_ = voltageCode;
+		queuedNeg_ = neg;
+		voltageQueued_ = true;
+		return;
+	}
+	voltage_ = converter_.ToVolts( voltageCode, neg );
+	voltageQueued_ = false;
+}
+
+//A queued write that failed or was overwritten by another client leaves voltage_ as it was
+long double ILDADac8571::GetVoltage( void)
+{
+	if( !hub_ )
+	{
+		return voltage_;
+	}
+	SyncToPreset();
+	if( !voltageQueued_ )
+	{
+		return voltage_;
+	}
+
+	unsigned int code, pin;
+	if( hub_->GetShadow( shadowReg_, code ) && code == queuedCode_ &&
+		hub_->GetShadow( gpioPin0 + g_ILDATiltNegAddresses[axis_], pin ) && (pin == 0) == queuedNeg_ )
+	{
+		voltage_ = queuedVoltage_;
+		voltageQueued_ = false;
+	}
+	else if( !hub_->IsClientBusy( busClient_ ) )
+	{
+		voltageQueued_ = false;
+	}
+	return voltage_;
+}
+
+//A preset applied since the last look moved the axis, voltage_ follows the magnitude and sign shadows again
+bool ILDADac8571::SyncToPreset( void)
+{
+	unsigned long generation = hub_->GetPresetGeneration();
+	if( generation == presetSeen_ )
+	{
+		return false;
+	}
+	presetSeen_ = generation;
+
+	unsigned int code, pin;
+	if( !hub_->GetShadow( shadowReg_, code ) || !hub_->GetShadow( gpioPin0 + g_ILDATiltNegAddresses[axis_], pin ) )
+	{
+		return false;
+	}
+	voltage_ = converter_.ToVolts( code, pin == 0 );
+	voltageQueued_ = false;
+	return true;
+}
+
+//Magnitude code for a bipolar request, the sign is carried by the negative-switch GPIO
+unsigned int ILDADac8571::VoltageToCode(long double setVoltage, bool& neg)
+{
+	return converter_.ToCode( (double) setVoltage, neg );
+}
+
+/*************************************************************
+ILDABeamTilt Implementation
+*************************************************************/
+
+ILDABeamTilt::ILDABeamTilt(TiltDirection axis, unsigned long resolution) : ILDADac8571(axis, resolution),
+	  initialized_(false),
+      busy_(false), 
+	  isNeg_(false),
+	  seqRateHz_(g_ILDATiltDefaultSequenceRateHz),
+	  sequencer_(nullptr),
+	  stopSequence_(false),
+	  seqRunning_(false),
+	  seqResult_(DEVICE_OK),
+	  seqPlayed_(0),
+	  seqMissed_(0),
+	  seqJitterSumNs_(0),
+	  seqJitterMaxNs_(0)
+{
+   InitializeDefaultErrorMessages();
+
+   //Fixed since Laser controller is static 0-5Volts currently
+   voltageInc_ = (voltageMax_ - voltageMin_) / resolution;
+
+   //Set Voltage Window to the Overall Window
+   vWindowMax_ = voltageMax_;
+   vWindowMin_ = -1 * voltageMax_;
+
+   name_ = g_ILDATiltNames[axis];
+
+   addressNeg_ = g_ILDATiltNegAddresses[axis];
+
+   // Description
+   int nRet = CreateProperty(MM::g_Keyword_Description, g_ILDATiltDescrips[axis], MM::String, true);
+   assert(DEVICE_OK == nRet);
+
+   // Name
+   nRet = CreateProperty(MM::g_Keyword_Name, name_.c_str(), MM::String, true);
+   assert(DEVICE_OK == nRet);
+
+   // parent ID display
+   CreateHubIDProperty();
+}
+
+ILDABeamTilt::~ILDABeamTilt()
+{
+   Shutdown();
+}
+
+void ILDABeamTilt::GetName(char* name) const
+{
+   CDeviceUtils::CopyLimitedString(name, name_.c_str());
+}
+
+//Covers both the sign GPIO and the DAC write
+bool ILDABeamTilt::Busy()
+{
+   ReapSequencer();
+   return (hub_) ? hub_->IsClientBusy( busClient_ ) : false;
+}
+
+
+int ILDABeamTilt::Initialize()
+{
+   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
+   if (!hub) {
+      //return ERR_NO_PORT_SET;
+   }
+   char hubLabel[MM::MaxStrLength];
+   hub->GetLabel(hubLabel);
+   SetParentID(hubLabel); // for backward comp.
+
+   hub_ = hub;
+   ConfigureConversion();
+
+   // set property list
+   // -----------------
+
+   //Voltage Window Values
+   //1 = true, 0 = false
+   CPropertyActionEx* pXAct = new CPropertyActionEx(this, &ILDABeamTilt::OnWindowVoltage, 1);
+   CreateProperty("WindowMaxVoltage", NumToToken(vWindowMax_), MM::Float, false, pXAct);
+   SetPropertyLimits("WindowMaxVoltage", vWindowMin_, voltageMax_);
+
+   pXAct = new CPropertyActionEx(this, &ILDABeamTilt::OnWindowVoltage, 0);
+   CreateProperty("WindowMinVoltage", NumToToken(vWindowMin_), MM::Float, false, pXAct);
+   SetPropertyLimits("WindowMinVoltage", -1 * voltageMax_, vWindowMax_);
+
+   // State
    // -----
-   pAct = new CPropertyAction (this, &CStateBase::OnLabel);
-   nRet = CreateProperty(MM::g_Keyword_Label, "", MM::String, false, pAct);
+   //Warm start: the hub read the axis back before any device initialised
+   voltage_ = hub_->GetTiltVolts( axis_ );
+   CPropertyAction* pAct = new CPropertyAction (this, &ILDABeamTilt::OnVoltage);
+   int nRet = CreateProperty("Voltage", NumToToken( voltage_ ), MM::Float, false, pAct);
    if (nRet != DEVICE_OK)
       return nRet;
+   SetPropertyLimits("Voltage", vWindowMin_, vWindowMax_);
 
-   //Raw Voltage Control
-   pAct = new CPropertyAction (this, &ILDALaser::OnVoltage);
-   nRet = CreateProperty("Voltage", "0", MM::Float, false, pAct);
+   //DA Sequence Playback
+   pAct = new CPropertyAction (this, &ILDABeamTilt::OnSequenceRate);
+   nRet = CreateProperty("Sequence Rate (Hz)", NumToToken(seqRateHz_), MM::Float, false, pAct);
    if (nRet != DEVICE_OK)
       return nRet;
-   SetPropertyLimits("Voltage", voltageMin_, voltageMax_);
+   SetPropertyLimits("Sequence Rate (Hz)", 1, g_ILDATiltMaxSequenceRateHz);
 
-   SetPreInitProperty( "Voltage" );
-
-   //I2C write retries
-   pAct = new CPropertyAction (this, &ILDALaser::OnRetries);
-   nRet = CreateProperty("Write Retries", NumToToken( writeRetries_ ), MM::Integer, false, pAct);
-   if (nRet != DEVICE_OK)
-      return nRet;
+   //Read-only timing achieved by the playback thread
+   const char* statNames[seqStatTotal] = { "Sequence Points Played", "Sequence Missed Deadlines",
+      "Sequence Jitter Mean (us)", "Sequence Jitter Max (us)" };
+   for( long i = 0; i < seqStatTotal; i++ )
+   {
+      pXAct = new CPropertyActionEx(this, &ILDABeamTilt::OnSequenceStat, i);
+      nRet = CreateProperty(statNames[i], "0", (i < seqJitterMean) ? MM::Integer : MM::Float, true, pXAct);
+      if (nRet != DEVICE_OK)
+         return nRet;
+   }
 
    nRet = UpdateStatus();
-
    if (nRet != DEVICE_OK)
       return nRet;
 
@@ -772,137 +4959,441 @@ int ILDALaser::Initialize()
    return DEVICE_OK;
 }
 
-int ILDALaser::Shutdown()
+int ILDABeamTilt::Shutdown()
 {
-	initialized_ = false;
-	
-	return DEVICE_OK;
+   StopDASequence();
+   initialized_ = false;
+   return DEVICE_OK;
 }
 
-/******************************************************
-  Property Actions
-******************************************************/
+//Sets Absolute Value of Signal
+//Negative Positive Controlled By SetInversion()
+int ILDABeamTilt::SetSignal(double currentVoltage)
+{
+	int ret = 0;
 
-int ILDALaser::OnState(MM::PropertyBase* pProp, MM::ActionType eAct)
+	//Coalesced: sign and magnitude leave together as one latest-value token
+	if( hub_ && hub_->GetTiltCoalescing() )
+	{
+		bool neg;
+		unsigned int voltageCode = VoltageToCode( currentVoltage, neg );
+		//A zero magnitude always returns the switch to positive
+		neg = neg && voltageCode != 0;
+
+		ret = hub_->SubmitTiltUpdate( busClient_, axis_, voltageCode, neg, writeCmds_[dispWrite], writeRetries_ );
+		if( ret == DEVICE_OK )
+		{
+			isNeg_ = neg;
+			CompleteVoltage( voltageCode, neg );
+		}
+		return ret;
+	}
+
+	if (!hub_)
+	{
+	  return DEVICE_COMM_HUB_MISSING;
+	}
+
+	//Sign from the same table as the magnitude (a zero code stays positive)
+	bool neg;
+	unsigned int code = converter_.ToCode( currentVoltage, neg );
+	neg = neg && code != 0;
+
+	//Zero, switch and magnitude go out as one command, compared against the hub's shadows
+	//(a hub-level X/Y write may have moved the pin since isNeg_ was last set)
+	ret = hub_->SubmitTiltSigned( busClient_, axis_, code, neg, writeCmds_[dispWrite], writeRetries_ );
+	if( ret == DEVICE_OK )
+	{
+		isNeg_ = neg;
+		CompleteVoltage( code, neg );
+	}
+
+	return ret;
+
+}
+
+int ILDABeamTilt::ToggleNegative(void)
+{
+/*   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
+   if (!hub) {
+      return DEVICE_COMM_HUB_MISSING;
+   }
+   char hubLabel[MM::MaxStrLength];
+   hub->GetLabel(hubLabel);
+   SetParentID(hubLabel); // for backward comp.*/
+   // Toggles Negative Value
+   //Same zero, switch, magnitude order as SetSignal, the old magnitude never
+   //drives the output with the new sign
+   bool neg;
+   unsigned int code = VoltageToCode( GetRequestedVoltage(), neg );
+   int ret = hub_->SubmitTiltSigned( busClient_, axis_, code, !isNeg_, writeCmds_[dispWrite], writeRetries_ );
+   if( ret == DEVICE_OK )
+   {
+      isNeg_ = !isNeg_;
+      CompleteVoltage( code, isNeg_ );
+   }
+   return ret;
+
+}
+
+int ILDABeamTilt::SetGateOpen(bool open)
+{
+   return DEVICE_OK;
+}
+
+/*******************************************************************
+DA Sequencing
+*******************************************************************/
+int ILDATiltSequencer::svc()
+{
+	ILDARaisePlaybackPriority();
+	return tilt_->RunSequence();
+}
+
+int ILDABeamTilt::GetDASequenceMaxLength(long& nrEvents) const
+{
+   nrEvents = g_ILDATiltMaxSequenceLength;
+   return DEVICE_OK;
+}
+
+int ILDABeamTilt::AddToDASequence(double voltage)
+{
+   if( (long) seqVoltages_.size() >= g_ILDATiltMaxSequenceLength )
+   {
+      return DEVICE_SEQUENCE_TOO_LARGE;
+   }
+
+   seqVoltages_.push_back( voltage );
+   return DEVICE_OK;
+}
+
+int ILDABeamTilt::ClearDASequence()
+{
+   seqVoltages_.clear();
+   return DEVICE_OK;
+}
+
+//Quantises the collected voltages (clamped to the voltage window) into the playback buffer
+int ILDABeamTilt::SendDASequence()
+{
+   ReapSequencer();
+   if( sequencer_ )
+   {
+      return DEVICE_ERR;
+   }
+
+   seqCodes_.clear();
+   seqCodes_.reserve( seqVoltages_.size() );
+   for( size_t i = 0; i < seqVoltages_.size(); i++ )
+   {
+      seqCodes_.push_back( PackSequenceCode( seqVoltages_[i] ) );
+   }
+
+   return DEVICE_OK;
+}
+
+unsigned int ILDABeamTilt::PackSequenceCode(double voltage)
+{
+   if( voltage > vWindowMax_ )
+   {
+      voltage = vWindowMax_;
+   }
+   else if( voltage < vWindowMin_ )
+   {
+      voltage = vWindowMin_;
+   }
+
+   bool neg;
+   unsigned int code = VoltageToCode( voltage, neg );
+   //A zero magnitude always returns the switch to positive
+   neg = neg && code != 0;
+
+   return (code & 0xFFFF) | ((neg) ? 0x10000 : 0);
+}
+
+int ILDABeamTilt::StartDASequence()
+{
+   if( !hub_ )
+   {
+      return DEVICE_COMM_HUB_MISSING;
+   }
+   ReapSequencer();
+   if( sequencer_ )
+   {
+      return DEVICE_OK;
+   }
+   //A sequence that ended on a failed write reports it once, the next start plays again
+   int failed = seqResult_.exchange( DEVICE_OK );
+   if( failed != DEVICE_OK )
+   {
+      return failed;
+   }
+   if( seqCodes_.empty() )
+   {
+      return DEVICE_ERR;
+   }
+
+   seqPlayed_.store( 0 );
+   seqMissed_.store( 0 );
+   seqJitterSumNs_.store( 0 );
+   seqJitterMaxNs_.store( 0 );
+
+   stopSequence_.store( false );
+   seqRunning_.store( true );
+   sequencer_ = new ILDATiltSequencer( this );
+   sequencer_->activate();
+
+   return DEVICE_OK;
+}
+
+int ILDABeamTilt::StopDASequence()
+{
+   if( sequencer_ )
+   {
+      stopSequence_.store( true );
+      sequencer_->wait();
+      delete sequencer_;
+      sequencer_ = nullptr;
+   }
+
+   return seqResult_.exchange( DEVICE_OK );
+}
+
+//Joins a playback thread that has ended on its own (a failed write), as ILDAPlayer::OnPlayback
+//does for a finished file. The failure stays in seqResult_ for Start or Stop to return.
+int ILDABeamTilt::ReapSequencer()
+{
+   if( sequencer_ && !seqRunning_.load() )
+   {
+      sequencer_->wait();
+      delete sequencer_;
+      sequencer_ = nullptr;
+      ILDA_TRACE_ERROR( seqResult_.load() );
+   }
+
+   return seqResult_.load();
+}
+
+//Loops over the code buffer until stopped. Each point has a fixed slot on an absolute
+//schedule; a point later than a whole period counts as missed and the schedule restarts
+//from now instead of bursting to catch up.
+int ILDABeamTilt::RunSequence()
 {
-	//In reality, Collect Data on Power Levels and Then Change
+   typedef std::chrono::steady_clock Clock;
+
+   const long long periodNs = (long long) (1e9 / seqRateHz_);
+   const size_t total = seqCodes_.size();
+   Clock::time_point next = Clock::now();
+   size_t index = 0;
+   unsigned int packed = 0;
+   int ret = DEVICE_OK;
+
+   while( !stopSequence_.load() )
+   {
+      ILDAWaitUntil( next );
+
+      //Lateness of the release itself, the bus time of the write is not part of it
+      long long lateNs = std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - next ).count();
+
+      packed = seqCodes_[index];
+      //Every point keeps its slot in the queue, a sequence is never coalesced
+      ret = hub_->SubmitTiltSigned( busClient_, axis_, packed & 0xFFFF, (packed & 0x10000) != 0,
+         writeCmds_[dispWrite], writeRetries_ );
+      if( ret != DEVICE_OK )
+      {
+         break;
+      }
+
+      seqPlayed_++;
+      seqJitterSumNs_ += lateNs;
+      if( lateNs > seqJitterMaxNs_.load() )
+      {
+         seqJitterMaxNs_.store( lateNs );
+      }
+
+      if( lateNs > periodNs )
+      {
+         seqMissed_++;
+         next = Clock::now();
+      }
+      next += std::chrono::nanoseconds( periodNs );
+
+      index = (index + 1 < total) ? index + 1 : 0;
+   }
+
+   //The axis is left on the last point played
+   if( seqPlayed_.load() > 0 )
+   {
+      isNeg_ = (packed & 0x10000) != 0;
+      CompleteVoltage( packed & 0xFFFF, isNeg_ );
+   }
+
+   seqResult_.store( ret );
+   seqRunning_.store( false );
+   return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Action handlers
+///////////////////////////////////////////////////////////////////////////////
 
+int ILDABeamTilt::OnVoltage(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
    if (eAct == MM::BeforeGet)
    {
-      // nothing to do, let the caller use cached property
+      //Catches up once queued writes have gone out
+      pProp->Set( (double) GetVoltage() );
    }
    else if (eAct == MM::AfterSet)
    {
-      long powerPos;
-      pProp->Get(powerPos);
-      SetPowerPos(powerPos);
-    }
-                                          
+      double voltage;
+      pProp->Get(voltage);
+	  int ret;
+      ret = SetSignal(voltage);
+	  
+	  if( ret != DEVICE_OK )
+		  return DEVICE_ERR;
+
+	  pProp->Set( (double) GetVoltage() );
+	  
+   }
+
+   return DEVICE_OK;
+}
 
+int ILDABeamTilt::OnSequenceRate(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(seqRateHz_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      //Rate is read once when playback starts
+      ReapSequencer();
+      if( sequencer_ )
+      {
+         return DEVICE_ERR;
+      }
+      pProp->Get(seqRateHz_);
+   }
    return DEVICE_OK;
 }
 
-int ILDALaser::OnVoltage(MM::PropertyBase* pProp, MM::ActionType eAct)
+int ILDABeamTilt::OnSequenceStat(MM::PropertyBase* pProp, MM::ActionType eAct, long stat)
 {
-
    if (eAct == MM::BeforeGet)
    {
-      // nothing to do, let the caller use cached property
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      double currentVoltage;
-      pProp->Get(currentVoltage);
-	  currentVoltage = SetVoltage(currentVoltage, singleWrite);
-	  LogMessageCode( (const int) currentVoltage, false);
-	  pProp->Set((double) voltage_);
-	  UpdateProperty( "Voltage" );
+      long played = seqPlayed_.load();
+      switch( stat )
+      {
+        case seqPlayed:
+         pProp->Set(played);
+         break;
+        case seqMissed:
+         pProp->Set(seqMissed_.load());
+         break;
+        case seqJitterMean:
+         pProp->Set( (played > 0) ? seqJitterSumNs_.load() / 1000.0 / played : 0.0 );
+         break;
+        case seqJitterMax:
+         pProp->Set( seqJitterMaxNs_.load() / 1000.0 );
+         break;
+      }
    }
-                                          
    return DEVICE_OK;
-
 }
 
-int ILDALaser::OnRetries(MM::PropertyBase* pProp, MM::ActionType eAct)
+//IsMax treated as Boolean (0 = Min, !0 = Max)
+int ILDABeamTilt::OnWindowVoltage(MM::PropertyBase* pProp, MM::ActionType eAct, long isMax)
 {
+   bool Max = (isMax != 0) ? true : false;
 
    if (eAct == MM::BeforeGet)
    {
-      // nothing to do, let the caller use cached property
+	  //Static Property
+	  (Max) ? pProp->Set(vWindowMax_) : pProp->Set(vWindowMin_);
    }
    else if (eAct == MM::AfterSet)
    {
-	  double proxy;
-      pProp->Get(proxy);
-	  writeRetries_ = (int) proxy;
+	  //Limited By Property Limits
+      (Max) ? pProp->Get(vWindowMax_) : pProp->Get(vWindowMin_);
+	  if(Max)
+	  {
+		 if(HasProperty("WindowMinVoltage"))
+		 {
+			SetPropertyLimits("WindowMinVoltage", -1 * voltageMax_, vWindowMax_);
+			UpdateProperty( "WindowMinVoltage" );
+		 }
+	  }
+	  else
+	  {
+		  if(HasProperty("WindowMaxVoltage"))
+		  {
+			SetPropertyLimits("WindowMaxVoltage", vWindowMin_, voltageMax_);
+			 UpdateProperty( "WindowMaxVoltage" );
+		  }
+	  }
+
+      if (HasProperty("Voltage"))
+	  {
+         SetPropertyLimits("Voltage", vWindowMin_, vWindowMax_);
+		 UpdateProperty( "Voltage" );
+	  }
+
    }
-                                          
    return DEVICE_OK;
-
 }
 
-/***************************************************************
-ILDASystemShutter Implementation
-***************************************************************/
 
+/*************************************************************
+ILDAGalvo Implementation
+*************************************************************/
 
-ILDASystemShutter::ILDASystemShutter( unsigned long resolution ) : ILDAMCP4271( resolution ),
-initialized_(false), 
-name_(g_SystemShutterName)
+ILDAGalvo::ILDAGalvo() :
+	  initialized_(false),
+	  name_(g_GalvoName),
+	  hub_(nullptr),
+	  posX_(0),
+	  posY_(0),
+	  spotIntervalUs_(0),
+	  polygonRepetitions_(1)
 {
-
-   //MCP4171 Object Specific Hardware Properties
-   //Shutter DAC Channel Address
-   addressDACChannel_= g_ILDASystemShutterChannelBit; 
-
    InitializeDefaultErrorMessages();
-   //EnableDelay();
-
-   // Name
-   int ret = CreateProperty(MM::g_Keyword_Name, g_SystemShutterName, MM::String, true);
-   assert(DEVICE_OK == ret);
 
    // Description
-   ret = CreateProperty(MM::g_Keyword_Description, "Whole System Shutter (Meant for On-Off Purposes)", MM::String, true);
-   assert(DEVICE_OK == ret);
+   int nRet = CreateProperty(MM::g_Keyword_Description, "Beam XY Galvo (both tilt axes, shutter as illumination)", MM::String, true);
+   assert(DEVICE_OK == nRet);
 
-   if( !endianCheck_ )
-   {
-	   LogMessage("Checking Endianness", false);
-	   bigEndian_ = ILDAIsBigEndian();
-	   endianCheck_ = true;
-   }
+   // Name
+   nRet = CreateProperty(MM::g_Keyword_Name, name_.c_str(), MM::String, true);
+   assert(DEVICE_OK == nRet);
 
    // parent ID display
    CreateHubIDProperty();
 }
 
-ILDASystemShutter::~ILDASystemShutter()
+ILDAGalvo::~ILDAGalvo()
 {
    Shutdown();
 }
 
-void ILDASystemShutter::GetName(char* name) const
+void ILDAGalvo::GetName(char* name) const
 {
    CDeviceUtils::CopyLimitedString(name, name_.c_str());
 }
 
-bool ILDASystemShutter::Busy()
+//Scans run inside the RunPolygons call, only single moves can be queued
+bool ILDAGalvo::Busy()
 {
-   //Electronic Shutter, unnecessary
-   /*MM::MMTime interval = GetCurrentMMTime() - changedTime_;
-
-   if (interval < (1000.0 * GetDelayMs() ))
-      return true;
-   else*/
-       return false;
+   return (hub_) ? hub_->IsClientBusy( galvoClient ) : false;
 }
 
-int ILDASystemShutter::Initialize()
+int ILDAGalvo::Initialize()
 {
    ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
    if (!hub) {
-      //return ;
+      return DEVICE_COMM_HUB_MISSING;
    }
    char hubLabel[MM::MaxStrLength];
    hub->GetLabel(hubLabel);
@@ -912,251 +5403,314 @@ int ILDASystemShutter::Initialize()
 
    // set property list
    // -----------------
-   
-   // OnOff
-   // ------
-   CPropertyAction* pAct = new CPropertyAction (this, &ILDASystemShutter::OnOnOff);
-   int ret = CreateProperty("OnOff", "0", MM::Integer, false, pAct);
-   if (ret != DEVICE_OK)
-      return ret;
-
-   // set shutter into the off state
-   //WriteToPort(0);
+   CPropertyAction* pAct = new CPropertyAction (this, &ILDAGalvo::OnSpotInterval);
+   int nRet = CreateProperty("Spot Interval (us)", "0", MM::Float, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   SetPropertyLimits("Spot Interval (us)", 0, 1000000);
 
-   std::vector<std::string> vals;
-   vals.push_back("0");
-   vals.push_back("1");
-   ret = SetAllowedValues("OnOff", vals);
-   if (ret != DEVICE_OK)
-      return ret;
+   pAct = new CPropertyAction (this, &ILDAGalvo::OnPolygonRepetitions);
+   nRet = CreateProperty("Polygon Repetitions", "1", MM::Integer, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   SetPropertyLimits("Polygon Repetitions", 1, 10000);
 
-   ret = UpdateStatus();
-   if (ret != DEVICE_OK)
-      return ret;
+   nRet = UpdateStatus();
+   if (nRet != DEVICE_OK)
+      return nRet;
 
-   changedTime_ = GetCurrentMMTime();
    initialized_ = true;
 
    return DEVICE_OK;
 }
 
-int ILDASystemShutter::Shutdown()
+int ILDAGalvo::Shutdown()
 {
-   if (initialized_)
-   {
-      initialized_ = false;
-   }
+   initialized_ = false;
    return DEVICE_OK;
 }
 
-//Note:  Currently Toggles DAC through I2C, however, switch implementation considered for later
-int ILDASystemShutter::SetOpen(bool open)
+//Move, open, dwell and close go out as one batch
+int ILDAGalvo::PointAndFire(double x, double y, double time_us)
 {
-	std::ostringstream os;
-	os << "Request " << open;
-	LogMessage(os.str().c_str(), true);
+	if( !hub_ )
+	{
+		return DEVICE_COMM_HUB_MISSING;
+	}
+
+	int ret = hub_->RunTiltBatch( &x, &y, 1, time_us, 1, true, galvoClient );
+	if( ret == DEVICE_OK )
+	{
+		posX_ = x;
+		posY_ = y;
+	}
+	return ret;
+}
 
-	int ret =0;
+int ILDAGalvo::SetSpotInterval(double pulseInterval_us)
+{
+	if( pulseInterval_us < 0 )
+	{
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
 
-   if (open)
-   {
-	  ret = SetVoltage(voltageMax_, singleWrite);
-	  LogMessageCode(ret, false);
-      return SetProperty("OnOff", "1");
-   }
-   else
-   {
-	  ret = SetVoltage(voltageMin_, singleWrite);
-	  LogMessageCode(ret, false);
-      return SetProperty("OnOff", "0");
-   }
+	spotIntervalUs_ = pulseInterval_us;
+	return DEVICE_OK;
 }
 
-int ILDASystemShutter::GetOpen(bool& open)
+int ILDAGalvo::SetPosition(double x, double y)
 {
-   char buf[MM::MaxStrLength];
-   int ret = GetProperty("OnOff", buf);
-   if (ret != DEVICE_OK)
-      return ret;
-   long pos = atol(buf);
-   pos > 0 ? open = true : open = false;
+	if( !hub_ )
+	{
+		return DEVICE_COMM_HUB_MISSING;
+	}
 
-   return DEVICE_OK;
+	int ret = hub_->SetXY( x, y, galvoClient );
+	if( ret == DEVICE_OK )
+	{
+		posX_ = x;
+		posY_ = y;
+	}
+	return ret;
 }
 
-int ILDASystemShutter::Fire(double /*deltaT*/)
+int ILDAGalvo::GetPosition(double& x, double& y)
 {
-   return DEVICE_UNSUPPORTED_COMMAND;
+	x = posX_;
+	y = posY_;
+	return DEVICE_OK;
 }
 
+int ILDAGalvo::SetIlluminationState(bool on)
+{
+	if( !hub_ )
+	{
+		return DEVICE_COMM_HUB_MISSING;
+	}
 
-///////////////////////////////////////////////////////////////////////////////
-// Action handlers
-///////////////////////////////////////////////////////////////////////////////
+	return hub_->SetShutterOutput( on, galvoClient );
+}
 
-int ILDASystemShutter::OnOnOff(MM::PropertyBase* pProp, MM::ActionType eAct)
+//Ranges are in tilt volts (sign carried by the inverting switch)
+double ILDAGalvo::GetXRange()
 {
-   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
-   if (eAct == MM::BeforeGet)
-   {
-      // get initialized state
-      pProp->Set((long)hub->GetShutterState());
-   }
-   else if (eAct == MM::AfterSet)
-   {
-      long pos;
-      pProp->Get(pos);
-      if (pos != 0 && pos != 1)
-	  {
-         return DEVICE_ERR; // turn everything off
-	  }
-      else
-	  {
-		//Communicate to Hub
-        hub->SetShutterState( (bool) pos );
-	  }
-   }
-
-   return DEVICE_OK;
+	return (hub_) ? 2 * hub_->GetTiltVoltageMax() : 0;
 }
 
+double ILDAGalvo::GetXMinimum()
+{
+	return (hub_) ? -1 * hub_->GetTiltVoltageMax() : 0;
+}
 
-/************************************************************
-MCP4721 Base Class Member Functions
-*************************************************************/
-ILDADac8571::ILDADac8571(TiltDirection axis, unsigned long resolution )
+double ILDAGalvo::GetYRange()
 {
-   //Initialize Base Class Members
-   addressDacI2C_ = g_ILDATiltDACI2CAddresses[axis];
-   resolution_ = resolution;
-   voltage_ = 0;
-   writeRetries_ = 1;
-   voltageMax_ = 10;
-   voltageMin_ = 0;
+	return GetXRange();
+}
 
-   //Fixed since Laser controller is static 0-5Volts currently
-   voltageInc_ = (voltageMax_ - voltageMin_) / resolution;
+double ILDAGalvo::GetYMinimum()
+{
+	return GetXMinimum();
 }
 
-int ILDADac8571::SetVoltage(long double setVoltage, WriteCmdTypes writeCmd)
+int ILDAGalvo::AddPolygonVertex(int polygonIndex, double x, double y)
 {
-	if (!hub_)
+	if( polygonIndex < 0 )
 	{
-	  return DEVICE_COMM_HUB_MISSING;
+		return DEVICE_INVALID_INPUT_PARAM;
+	}
+
+	if( polygons_.size() <= (size_t) polygonIndex )
+	{
+		polygons_.resize( polygonIndex + 1 );
 	}
+	polygons_[polygonIndex].push_back( std::make_pair( x, y ) );
+
+	return DEVICE_OK;
+}
 
-	bool neg = false;
+int ILDAGalvo::DeletePolygons()
+{
+	polygons_.clear();
+	scanX_.clear();
+	scanY_.clear();
+	polygonStarts_.clear();
+	return DEVICE_OK;
+}
+
+int ILDAGalvo::RunSequence()
+{
+	return DEVICE_UNSUPPORTED_COMMAND;
+}
+
+//Flattens every polygon into one closed path (each polygon returns to its first vertex)
+int ILDAGalvo::LoadPolygons()
+{
+	scanX_.clear();
+	scanY_.clear();
+	polygonStarts_.clear();
 
-	if( setVoltage < 0 )
+	for( size_t i = 0; i < polygons_.size(); i++ )
 	{
-		neg = true;
+		const std::vector< std::pair<double, double> >& polygon = polygons_[i];
+		if( !polygon.empty() )
+		{
+			polygonStarts_.push_back( (int) scanX_.size() );
+		}
+		for( size_t j = 0; j < polygon.size(); j++ )
+		{
+			scanX_.push_back( polygon[j].first );
+			scanY_.push_back( polygon[j].second );
+		}
+		if( polygon.size() > 2 )
+		{
+			scanX_.push_back( polygon[0].first );
+			scanY_.push_back( polygon[0].second );
+		}
 	}
-	//Change voltage to absolute Value
-	setVoltage = abs( setVoltage );
 
-	//Ensures no overflow value to 0 setting
-	if ( setVoltage >= voltageMax_ )
+	return DEVICE_OK;
+}
+
+int ILDAGalvo::SetPolygonRepetitions(int repetitions)
+{
+	if( repetitions < 1 )
 	{
-	  setVoltage = voltageMax_ - voltageInc_;
+		return DEVICE_INVALID_INPUT_PARAM;
 	}
 
-	
-	unsigned int voltageCode;
-	voltageCode = (unsigned int) ((setVoltage - voltageMin_) / voltageInc_);
+	polygonRepetitions_ = repetitions;
+	return DEVICE_OK;
+}
 
-	//Write only to one DAC Channel
-	const int dataBytes = 3;
-	unsigned char data[dataBytes + 1];
-	//Command Byte Selection and Packaging
-	switch(writeCmd)
+//Every vertex of every repetition goes to the transport in slices, until done or StopSequence
+int ILDAGalvo::RunPolygons()
+{
+	if( !hub_ )
 	{
-	  case dispWrite:
-		data[0] = writeCmds_[ writeCmd ];
-		data[1] = (voltageCode >> 8) & 0xFF;
-		data[2] = voltageCode & 0xFF;
-		break;
-	  default:
-		  return DEVICE_ERR;
+		return DEVICE_COMM_HUB_MISSING;
+	}
+
+	if( scanX_.empty() )
+	{
+		LoadPolygons();
+		if( scanX_.empty() )
+		{
+			return DEVICE_OK;
+		}
 	}
 
+	int ret = hub_->RunTiltBatch( &scanX_[0], &scanY_[0], (int) scanX_.size(), spotIntervalUs_,
+		(int) polygonRepetitions_, true, galvoClient, &polygonStarts_[0], (int) polygonStarts_.size() );
+	//A stopped scan leaves the beam part way through
+	posX_ = hub_->GetTiltVolts( x );
+	posY_ = hub_->GetTiltVolts( y );
+	return ret;
+}
 
-	//trasmitbyte switch
-	int i = 0, ret;
-	while( i < writeRetries_ )
+//A running RunPolygons ends at its next slice with the shutter closed
+int ILDAGalvo::StopSequence()
+{
+	if( !hub_ )
 	{
-	  // Upon Successful Write
-	  ret = hub_->I2Cwrite(dataBytes, addressDacI2C_, true, data);
+		return DEVICE_COMM_HUB_MISSING;
+	}
 
-	  if( ret == 0  )
-	  {
-		  voltage_ = (neg) ? voltageCode * voltageInc_ * -1 : voltageCode * voltageInc_;
-		  break;
-	  }
+	hub_->StopTiltBatch();
+	return DEVICE_OK;
+}
+
+int ILDAGalvo::GetChannel(char* channelName)
+{
+	CDeviceUtils::CopyLimitedString(channelName, "Default");
+	return DEVICE_OK;
+}
 
-	  i++;
-	}
+///////////////////////////////////////////////////////////////////////////////
+// Action handlers
+///////////////////////////////////////////////////////////////////////////////
 
-	return ret;
+int ILDAGalvo::OnSpotInterval(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(spotIntervalUs_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      double interval;
+      pProp->Get(interval);
+      return SetSpotInterval(interval);
+   }
+   return DEVICE_OK;
+}
 
+int ILDAGalvo::OnPolygonRepetitions(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(polygonRepetitions_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      long repetitions;
+      pProp->Get(repetitions);
+      return SetPolygonRepetitions( (int) repetitions );
+   }
+   return DEVICE_OK;
 }
 
+
 /*************************************************************
-ILDABeamTilt Implementation
+ILDAPlayer Implementation
 *************************************************************/
 
-ILDABeamTilt::ILDABeamTilt(TiltDirection axis, unsigned long resolution) : ILDADac8571(axis, resolution),
+ILDAPlayer::ILDAPlayer() :
 	  initialized_(false),
-      busy_(false), 
-	  isNeg_(false)
+	  name_(g_PlayerName),
+	  hub_(nullptr),
+	  pointRate_(g_ILDAPlayerDefaultPointRate),
+	  loop_(true),
+	  player_(nullptr),
+	  stopPlayback_(false),
+	  playing_(false),
+	  currentFrame_(0),
+	  missedPoints_(0)
 {
    InitializeDefaultErrorMessages();
 
-   //Fixed since Laser controller is static 0-5Volts currently
-   voltageInc_ = (voltageMax_ - voltageMin_) / resolution;
-
-   //Set Voltage Window to the Overall Window
-   vWindowMax_ = voltageMax_;
-   vWindowMin_ = -1 * voltageMax_;
-
-   name_ = g_ILDATiltNames[axis];
-
-   addressNeg_ = g_ILDATiltNegAddresses[axis];
-
    // Description
-   int nRet = CreateProperty(MM::g_Keyword_Description, g_ILDATiltDescrips[axis], MM::String, true);
+   int nRet = CreateProperty(MM::g_Keyword_Description, "Streams ILDA frame files to the tilt and laser DACs", MM::String, true);
    assert(DEVICE_OK == nRet);
 
    // Name
    nRet = CreateProperty(MM::g_Keyword_Name, name_.c_str(), MM::String, true);
    assert(DEVICE_OK == nRet);
 
-   if( !endianCheck_ )
-   {
-	   LogMessage("Checking Endianness", false);
-	   bigEndian_ = ILDAIsBigEndian();
-	   endianCheck_ = true;
-   }
-
    // parent ID display
    CreateHubIDProperty();
 }
 
-ILDABeamTilt::~ILDABeamTilt()
+ILDAPlayer::~ILDAPlayer()
 {
    Shutdown();
 }
 
-void ILDABeamTilt::GetName(char* name) const
+void ILDAPlayer::GetName(char* name) const
 {
    CDeviceUtils::CopyLimitedString(name, name_.c_str());
 }
 
+//Playback runs in the background, only the queued points of the current frame count
+bool ILDAPlayer::Busy()
+{
+   return (hub_) ? hub_->IsClientBusy( playerClient ) : false;
+}
 
-int ILDABeamTilt::Initialize()
+int ILDAPlayer::Initialize()
 {
    ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
    if (!hub) {
-      //return ERR_NO_PORT_SET;
+      return DEVICE_COMM_HUB_MISSING;
    }
    char hubLabel[MM::MaxStrLength];
    hub->GetLabel(hubLabel);
@@ -1166,24 +5720,45 @@ int ILDABeamTilt::Initialize()
 
    // set property list
    // -----------------
+   CPropertyAction* pAct = new CPropertyAction (this, &ILDAPlayer::OnFile);
+   int nRet = CreateProperty("File", "", MM::String, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
 
-   //Voltage Window Values
-   //1 = true, 0 = false
-   CPropertyActionEx* pXAct = new CPropertyActionEx(this, &ILDABeamTilt::OnWindowVoltage, 1);
-   CreateProperty("WindowMaxVoltage", NumToToken(vWindowMax_), MM::Float, false, pXAct);
-   SetPropertyLimits("WindowMaxVoltage", vWindowMin_, voltageMax_);
+   pAct = new CPropertyAction (this, &ILDAPlayer::OnPointRate);
+   nRet = CreateProperty("Point Rate (pps)", NumToToken(pointRate_), MM::Float, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   SetPropertyLimits("Point Rate (pps)", 1, g_ILDAPlayerMaxPointRate);
 
-   pXAct = new CPropertyActionEx(this, &ILDABeamTilt::OnWindowVoltage, 0);
-   CreateProperty("WindowMinVoltage", NumToToken(vWindowMin_), MM::Float, false, pXAct);
-   SetPropertyLimits("WindowMinVoltage", -1 * voltageMax_, vWindowMax_);
+   pAct = new CPropertyAction (this, &ILDAPlayer::OnLoop);
+   nRet = CreateProperty("Loop", "On", MM::String, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   AddAllowedValue("Loop", "Off");
+   AddAllowedValue("Loop", "On");
 
-   // State
-   // -----
-   CPropertyAction* pAct = new CPropertyAction (this, &ILDABeamTilt::OnVoltage);
-   int nRet = CreateProperty("Voltage", "0.0", MM::Float, false, pAct);
+   pAct = new CPropertyAction (this, &ILDAPlayer::OnPlayback);
+   nRet = CreateProperty("Playback", g_ILDAPlayerStopped, MM::String, false, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+   AddAllowedValue("Playback", g_ILDAPlayerStopped);
+   AddAllowedValue("Playback", g_ILDAPlayerPlaying);
+
+   pAct = new CPropertyAction (this, &ILDAPlayer::OnFrameCount);
+   nRet = CreateProperty("Frame Count", "0", MM::Integer, true, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   pAct = new CPropertyAction (this, &ILDAPlayer::OnCurrentFrame);
+   nRet = CreateProperty("Current Frame", "0", MM::Integer, true, pAct);
+   if (nRet != DEVICE_OK)
+      return nRet;
+
+   pAct = new CPropertyAction (this, &ILDAPlayer::OnMissedPoints);
+   nRet = CreateProperty("Missed Points", "0", MM::Integer, true, pAct);
    if (nRet != DEVICE_OK)
       return nRet;
-   SetPropertyLimits("Voltage", vWindowMin_, vWindowMax_);
 
    nRet = UpdateStatus();
    if (nRet != DEVICE_OK)
@@ -1194,133 +5769,334 @@ int ILDABeamTilt::Initialize()
    return DEVICE_OK;
 }
 
-int ILDABeamTilt::Shutdown()
+int ILDAPlayer::Shutdown()
 {
+   StopPlayback();
+   reader_.Close();
    initialized_ = false;
    return DEVICE_OK;
 }
 
-//Sets Absolute Value of Signal
-//Negative Positive Controlled By SetInversion()
-int ILDABeamTilt::SetSignal(double currentVoltage)
+int ILDAPlayerThread::svc()
 {
-	long bits;
-	int ret = 0;
-	bool signChange = false;
-
-	bits = (long) (currentVoltage / voltageInc_);
+	ILDARaisePlaybackPriority();
+	return player_->RunPlayback();
+}
 
-	//Activate Inverting Switch if there is a change in inversion and +/-
-    if( (currentVoltage < 0 && bits != 0 && isNeg_ != true) || ( ( bits == 0 || currentVoltage >= 0 ) && isNeg_ != false ))
+int ILDAPlayer::StartPlayback()
+{
+	if( !hub_ )
+	{
+		return DEVICE_COMM_HUB_MISSING;
+	}
+	if( !reader_.IsOpen() )
 	{
-		signChange = true;
-		LogMessage("Inside of ToggleNegative", true);
-		ret = ToggleNegative();
-		LogMessageCode(ret, false);
+		LogMessage("Error: No ILDA File Loaded", false);
+		return DEVICE_ERR;
+	}
+	if( player_ )
+	{
+		return DEVICE_OK;
 	}
 
-	LogMessage("Setting Voltage soon", true);
-	//To Be Changed Later
-	ret = SetVoltage( currentVoltage, dispWrite );
+	missedPoints_.store( 0 );
+	currentFrame_.store( 0 );
+	stopPlayback_.store( false );
+	playing_.store( true );
+	player_ = new ILDAPlayerThread( this );
+	player_->activate();
 
-	if( ret != 0 )
+	return DEVICE_OK;
+}
+
+int ILDAPlayer::StopPlayback()
+{
+	if( !player_ )
 	{
-		if( signChange )
-		{
-			ToggleNegative();
-		}
+		return DEVICE_OK;
 	}
 
-	LogMessage("Voltage Attempted to be set", true);
-	return ret;
+	stopPlayback_.store( true );
+	player_->wait();
+	delete player_;
+	player_ = nullptr;
 
+	return DEVICE_OK;
 }
 
-int ILDABeamTilt::ToggleNegative(void)
+//Decodes one frame from the mapped file and batch encodes it onto the end of packed_.
+//ILDA full scale maps onto the full tilt range, colour 0-255 onto the full laser range.
+int ILDAPlayer::PackFrame(unsigned int frame)
 {
-/*   ILDAHub* hub = static_cast<ILDAHub*>(GetParentHub());
-   if (!hub) {
-      return DEVICE_COMM_HUB_MISSING;
-   }
-   char hubLabel[MM::MaxStrLength];
-   hub->GetLabel(hubLabel);
-   SetParentID(hubLabel); // for backward comp.*/
-   // Toggles Negative Value
-   isNeg_ = (isNeg_) ? false : true;
+	int ret = reader_.DecodeFrame( frame, points_ );
+	if( ret != ildaFileOk )
+	{
+		return ret;
+	}
+
+	const float tiltScale = (float) (hub_->GetTiltVoltageMax() / 32768.0);
+	float colorScale[colorTotal];
+	for( int color = 0; color < colorTotal; color++ )
+	{
+		colorScale[color] = (float) (hub_->GetLaserVoltageMax( color ) / 255.0);
+	}
+	const size_t count = points_.size();
+
+	float * channels[encoderChannelTotal];
+	for( int c = 0; c < encoderChannelTotal; c++ )
+	{
+		volts_[c].resize( count );
+		channels[c] = (count > 0) ? &volts_[c][0] : nullptr;
+	}
+
+	for( size_t i = 0; i < count; i++ )
+	{
+		const ILDAPoint& point = points_[i];
+		channels[encoderX][i] = point.x * tiltScale;
+		channels[encoderY][i] = point.y * tiltScale;
+		channels[encoderRed][i] = (point.blanked) ? 0 : point.r * colorScale[red637];
+		channels[encoderGreen][i] = (point.blanked) ? 0 : point.g * colorScale[green532];
+		channels[encoderBlue][i] = (point.blanked) ? 0 : point.b * colorScale[blue445];
+	}
+
+	size_t first = packed_.size();
+	packed_.resize( first + count );
+	if( count > 0 )
+	{
+		hub_->EncodeSamples( channels, (unsigned int) count, &packed_[first] );
+	}
 
-   return hub_->GPIOwrite(addressNeg_, isNeg_);
+	return ildaFileOk;
+}
 
+//The packed payloads go to the bus as they are: tilt as one latched X/Y update,
+//colour as one MCP4728 fast write (sent under the hub's staging lock, as multi-write
+//blocks while a channel's range is not yet on the chip)
+int ILDAPlayer::SendPoint(const ILDAEncodedSample& point)
+{
+	return hub_->SubmitEncodedSample( playerClient, point );
 }
 
-int ILDABeamTilt::SetGateOpen(bool open)
+//R/G/B off once playback ends, whichever way it ends
+int ILDAPlayer::BlankColors()
 {
-   return DEVICE_OK;
+	unsigned int codes[MCP4728_CHANNELS];
+	unsigned int mask = 0;
+	for( int color = 0; color < colorTotal; color++ )
+	{
+		int channel = g_ILDALaserDACChannelBits[color] >> 1;
+		codes[channel] = 0;
+		mask |= 1u << channel;
+	}
+	return hub_->WriteMCP4728Codes( codes, mask, 1, playerClient );
+}
+
+//Same absolute schedule as the tilt DA sequencer, one slot per point.
+//Every frame is encoded before the schedule starts. Files too large for that are encoded a
+//frame at a time and the schedule restarts after each frame, so decoding never counts as lateness.
+int ILDAPlayer::RunPlayback()
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const long long periodNs = (long long) (1e9 / pointRate_);
+	const unsigned int frames = reader_.GetFrameCount();
+	int ret = DEVICE_OK;
+
+	size_t totalPoints = 0;
+	for( unsigned int frame = 0; frame < frames; frame++ )
+	{
+		totalPoints += reader_.GetPointCount( frame );
+	}
+	const bool prepacked = totalPoints <= g_ILDAPlayerMaxPackedPoints;
+
+	packed_.clear();
+	frameStarts_.clear();
+	if( prepacked )
+	{
+		packed_.reserve( totalPoints );
+		for( unsigned int frame = 0; frame < frames && ret == DEVICE_OK; frame++ )
+		{
+			frameStarts_.push_back( packed_.size() );
+			ret = (PackFrame( frame ) == ildaFileOk) ? DEVICE_OK : DEVICE_ERR;
+		}
+		frameStarts_.push_back( packed_.size() );
+	}
+
+	Clock::time_point next = Clock::now();
+	for( unsigned int frame = 0; frames > 0 && ret == DEVICE_OK && !stopPlayback_.load(); )
+	{
+		currentFrame_.store( frame );
+		size_t first = 0, last;
+		if( prepacked )
+		{
+			first = frameStarts_[frame];
+			last = frameStarts_[frame + 1];
+		}
+		else
+		{
+			packed_.clear();
+			if( PackFrame( frame ) != ildaFileOk )
+			{
+				ret = DEVICE_ERR;
+				break;
+			}
+			last = packed_.size();
+			next = Clock::now();
+		}
+
+		for( size_t i = first; i < last && !stopPlayback_.load(); i++ )
+		{
+			ILDAWaitUntil( next );
+
+			ret = SendPoint( packed_[i] );
+			if( ret != DEVICE_OK )
+			{
+				break;
+			}
+
+			if( Clock::now() - next > std::chrono::nanoseconds( periodNs ) )
+			{
+				missedPoints_++;
+				next = Clock::now();
+			}
+			next += std::chrono::nanoseconds( periodNs );
+		}
+
+		if( ret != DEVICE_OK )
+		{
+			break;
+		}
+
+		if( ++frame >= frames )
+		{
+			if( !loop_.load() )
+			{
+				break;
+			}
+			frame = 0;
+		}
+	}
+
+	int blankRet = BlankColors();
+	if( ret == DEVICE_OK )
+	{
+		ret = blankRet;
+	}
+
+	playing_.store( false );
+	return ret;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Action handlers
 ///////////////////////////////////////////////////////////////////////////////
 
-int ILDABeamTilt::OnVoltage(MM::PropertyBase* pProp, MM::ActionType eAct)
+int ILDAPlayer::OnFile(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
    if (eAct == MM::BeforeGet)
    {
-      // nothing to do, let the caller use cached property
+      pProp->Set(path_.c_str());
    }
    else if (eAct == MM::AfterSet)
    {
-      double voltage;
-      pProp->Get(voltage);
-	  int ret;
-      ret = SetSignal(voltage);
-	  
-	  if( ret != DEVICE_OK )
-		  return DEVICE_ERR;
+      StopPlayback();
 
-	  pProp->Set( (double) voltage_);
-	  
+      std::string path;
+      pProp->Get(path);
+      if( path.empty() )
+      {
+         reader_.Close();
+         path_ = path;
+         return DEVICE_OK;
+      }
+
+      int ret = reader_.Open( path.c_str() );
+      if( ret != ildaFileOk )
+      {
+         LogMessage(ILDAFrameReader::GetResultText( ret ), false);
+         return DEVICE_INVALID_PROPERTY_VALUE;
+      }
+      path_ = path;
    }
+   return DEVICE_OK;
+}
 
+int ILDAPlayer::OnPointRate(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set(pointRate_);
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      //Rate is read once when playback starts
+      if( player_ )
+      {
+         return DEVICE_ERR;
+      }
+      pProp->Get(pointRate_);
+   }
    return DEVICE_OK;
 }
 
-//IsMax treated as Boolean (0 = Min, !0 = Max)
-int ILDABeamTilt::OnWindowVoltage(MM::PropertyBase* pProp, MM::ActionType eAct, long isMax)
+int ILDAPlayer::OnPlayback(MM::PropertyBase* pProp, MM::ActionType eAct)
 {
-   bool Max = (isMax != 0) ? true : false;
+   if (eAct == MM::BeforeGet)
+   {
+      //A non-looping file may have finished on its own
+      if( player_ && !playing_.load() )
+      {
+         StopPlayback();
+      }
+      pProp->Set( (player_) ? g_ILDAPlayerPlaying : g_ILDAPlayerStopped );
+   }
+   else if (eAct == MM::AfterSet)
+   {
+      std::string state;
+      pProp->Get(state);
+      return (state == g_ILDAPlayerPlaying) ? StartPlayback() : StopPlayback();
+   }
+   return DEVICE_OK;
+}
 
+int ILDAPlayer::OnLoop(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
    if (eAct == MM::BeforeGet)
    {
-	  //Static Property
-	  (Max) ? pProp->Set(vWindowMax_) : pProp->Set(vWindowMin_);
+      pProp->Set( (loop_.load()) ? "On" : "Off" );
    }
    else if (eAct == MM::AfterSet)
    {
-	  //Limited By Property Limits
-      (Max) ? pProp->Get(vWindowMax_) : pProp->Get(vWindowMin_);
-	  if(Max)
-	  {
-		 if(HasProperty("WindowMinVoltage"))
-		 {
-			SetPropertyLimits("WindowMinVoltage", -1 * voltageMax_, vWindowMax_);
-			UpdateProperty( "WindowMinVoltage" );
-		 }
-	  }
-	  else
-	  {
-		  if(HasProperty("WindowMaxVoltage"))
-		  {
-			SetPropertyLimits("WindowMaxVoltage", vWindowMin_, voltageMax_);
-			 UpdateProperty( "WindowMaxVoltage" );
-		  }
-	  }
+      std::string loop;
+      pProp->Get(loop);
+      loop_.store( loop == "On" );
+   }
+   return DEVICE_OK;
+}
 
-      if (HasProperty("Voltage"))
-	  {
-         SetPropertyLimits("Voltage", vWindowMin_, vWindowMax_);
-		 UpdateProperty( "Voltage" );
-	  }
+int ILDAPlayer::OnFrameCount(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set( (long) reader_.GetFrameCount() );
+   }
+   return DEVICE_OK;
+}
+
+int ILDAPlayer::OnCurrentFrame(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set( currentFrame_.load() );
+   }
+   return DEVICE_OK;
+}
 
+int ILDAPlayer::OnMissedPoints(MM::PropertyBase* pProp, MM::ActionType eAct)
+{
+   if (eAct == MM::BeforeGet)
+   {
+      pProp->Set( missedPoints_.load() );
    }
    return DEVICE_OK;
 }
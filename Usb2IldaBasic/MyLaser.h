@@ -3,9 +3,26 @@
 
 #include "../../MMDevice/MMDevice.h"
 #include "../../MMDevice/DeviceBase.h"
+#include "../../MMDevice/DeviceThreads.h"
 #include <string>
 #include <map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "PreInitSettings.h"
+#include "ILDATransport.h"
+#include "ILDAMcp2221Transport.h"
+#include "ILDABusQueue.h"
+#include "ILDAFile.h"
+#include "ILDAFrameCache.h"
+#include "ILDACodeConverter.h"
+#include "ILDABatchEncoder.h"
+#include "ILDAPowerCurve.h"
+#include "ILDALatencyHistogram.h"
+#include "ILDABusTrace.h"
+#include "ILDATraceReplay.h"
+#include "ILDAChipModels.h"
 
 
 //Manufacturer Defaults
@@ -15,6 +32,30 @@
 //Custom Constants
 #define DEVICE_OCCUPIED -1
 
+//Write Path Tracing Levels (fixed at compile time, define ILDA_TRACE_LEVEL to override)
+//Levels above the build level compile to nothing, so a successful write formats no strings
+#define ILDA_TRACE_OFF 0
+#define ILDA_TRACE_ERRORS 1   //failed writes only
+#define ILDA_TRACE_WRITES 2   //every write, to the debug log
+#ifndef ILDA_TRACE_LEVEL
+   #define ILDA_TRACE_LEVEL ILDA_TRACE_ERRORS
+#endif
+
+#if ILDA_TRACE_LEVEL >= ILDA_TRACE_ERRORS
+   #define ILDA_TRACE_ERROR(ret) do { if( (ret) != DEVICE_OK ) { LogMessageCode( (ret), false ); } } while(0)
+#else
+   #define ILDA_TRACE_ERROR(ret) ((void) 0)
+#endif
+
+#if ILDA_TRACE_LEVEL >= ILDA_TRACE_WRITES
+   #define ILDA_TRACE_WRITE(msg) LogMessage( (msg), true )
+#else
+   #define ILDA_TRACE_WRITE(msg) ((void) 0)
+#endif
+
+//MCP4728 Channel Count (Red, Green, Blue, Shutter)
+#define MCP4728_CHANNELS 4
+
 
 enum BeamColor{
 	red637 = 0,
@@ -31,12 +72,61 @@ enum TiltDirection{
 	dirTotal
 };
 
+//Hub Shadow Registers (last value known to be on the hardware)
+//Adjust ILDABusCommand::shadowMask width if more than 16 are added
+enum ILDAShadowRegister{
+	mcp4728ChannelA = 0,
+	mcp4728ChannelB,
+	mcp4728ChannelC,
+	mcp4728ChannelD,
+	dac8571X,
+	dac8571Y,
+	gpioPin0,
+	gpioPin1,
+	gpioPin2,
+	gpioPin3,
+
+	shadowTotal
+};
+
+//Bus Latency Histogram Split (one histogram per target and outcome)
+enum ILDABusTarget{
+	busTargetMCP4728 = 0,
+	busTargetDac8571X,
+	busTargetDac8571Y,
+	busTargetTiltBroadcast,
+	busTargetGpio,
+
+	busTargetTotal
+};
+
+enum ILDABusOutcome{
+	busOutcomeOk = 0,   //first attempt
+	busOutcomeRetried,  //succeeded after failed attempts (time includes them)
+	busOutcomeFailed,   //every attempt failed
+
+	busOutcomeTotal
+};
+
+//MCP4728 Output Ranges (reference and gain, selectable per channel)
+enum ILDAMCP4728Range{
+	mcp4728RangeVdd = 0,       //VDD reference, 0-5 V
+	mcp4728RangeInternal1,     //internal 2.048 V reference, gain 1
+	mcp4728RangeInternal2,     //internal 2.048 V reference, gain 2
+
+	mcp4728RangeTotal
+};
+
 //Binary Reference Maps
 //It is the burden of the programmer to make sure the char and cmdStr match lengths
 //std::map<std::string, unsigned char> ILDACreateBinRefMap( std::string cmdStr[], unsigned char binaryBase[]);
 
-//Endianness Check
-bool ILDAIsBigEndian( void);
+//Endianness (known at compile time, every MSVC target is little endian)
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   #define ILDA_BIG_ENDIAN 1
+#else
+   #define ILDA_BIG_ENDIAN 0
+#endif
 
 //Class Instantiations
 
@@ -47,12 +137,66 @@ class ILDABinaryFunctor
 		~ILDABinaryFunctor(){};
 
 	protected:
-	  static bool endianCheck_;
-      static bool bigEndian_;
+      static const bool bigEndian_ = (ILDA_BIG_ENDIAN != 0);
+};
+
+class ILDAHub;
+class ILDADac8571;
+class ILDABeamTilt;
+class ILDAPlayer;
+
+//Hub I/O Worker
+//In asynchronous mode this is the only thread that touches the bus
+class ILDABusWorker : public MMDeviceThreadBase
+{
+	public:
+		ILDABusWorker( ILDAHub* hub ) : hub_(hub) {};
+		~ILDABusWorker() {};
+
+	int svc();
+
+	private:
+	  ILDAHub* hub_;
 };
 
-class ILDAHub : public HubBase<ILDAHub>
+//DA Sequence Playback Thread (one per sequencing ILDABeamTilt)
+class ILDATiltSequencer : public MMDeviceThreadBase
 {
+	public:
+		ILDATiltSequencer( ILDABeamTilt* tilt ) : tilt_(tilt) {};
+		~ILDATiltSequencer() {};
+
+	int svc();
+
+	private:
+	  ILDABeamTilt* tilt_;
+};
+
+//ILDA File Playback Thread
+class ILDAPlayerThread : public MMDeviceThreadBase
+{
+	public:
+		ILDAPlayerThread( ILDAPlayer* player ) : player_(player) {};
+		~ILDAPlayerThread() {};
+
+	int svc();
+
+	private:
+	  ILDAPlayer* player_;
+};
+
+//Illumination Preset (every output the hub can set in one batch)
+struct ILDAPreset
+{
+	double laserVolts[colorTotal];
+	bool shutterOpen;
+	double tiltVolts[dirTotal];
+};
+
+class ILDAHub : public HubBase<ILDAHub>, public ILDATransportMonitor
+{
+   friend class ILDABusWorker;
+
 public:
 	ILDAHub();
    ~ILDAHub() {Shutdown();};
@@ -67,6 +211,10 @@ public:
 
    // HUB api
    MM::DeviceDetectionStatus DetectDevice(int retries = 3);
+   MM::DeviceDetectionStatus EnumerateBridges(int retries = 3);
+   bool OpenKnownBridge(void);
+   bool IsILDABridge(void* handle);
+   void RememberBridge(void* handle, unsigned int index);
    int VerifyListedDevice(unsigned int index, void* &handle, int retries = 3);
    int VerifiedClose(void* &ptr, int retries = 3);
    int DetectInstalledDevices(void);
@@ -76,12 +224,170 @@ public:
    int I2Cwrite(int dataLen, unsigned char slaveAddress, bool use7bitAddress, unsigned char * i2cTxData);
    int GPIOwrite(int pinIndex, bool isLow);
 
+   //Bus Command Submission
+   //Executed inline when synchronous, queued for the worker when asynchronous
+   int SubmitI2cWrite(int client, unsigned char slaveAddress, const unsigned char * data, int dataLen, int retries = 1, unsigned int shadowMask = 0);
+   int SubmitGpioWrite(int client, int pinIndex, bool isLow);
+   bool IsClientBusy(int client) { return pending_[client].load() > 0; };
+   //Writes return before they reach the bus
+   bool IsAsynchronous(void) { return asynchronous_.load() && worker_ != nullptr; };
+
+   //MCP4728 Multi-Channel Staging (channel = DAC1:DAC0 bits)
+   //Staged codes and the frames built from them are guarded by stageLock_ (taken before busLock_)
+   int StageMCP4728Code(int channel, unsigned int code);
+   int FlushMCP4728(int retries = 1, int client = hubClient);
+   int WriteMCP4728Codes(const unsigned int codes[MCP4728_CHANNELS], unsigned int channelMask, int retries = 1, int client = hubClient);
+   int WriteMCP4728Channel(int channel, unsigned int code, int retries = 1, int client = hubClient);
+   bool GetMCP4728Deferred(void) { return mcp4728Deferred_; };
+   bool IsMCP4728Staged(int channel) { return mcp4728Pending_[channel]; };
+   unsigned char MCP4728UpperByte(int channel, unsigned int code) const;
+
+   //Per-Channel Reference/Gain (takes effect with the channel's next multi-write)
+   //Fast writes cannot carry the bits, so until a frame that does has succeeded the channel is
+   //only ever written with multi-write blocks
+   void SetMCP4728Range(int channel, int range);
+   int GetMCP4728Range(int channel) const { return mcp4728Range_[channel]; };
+   bool IsMCP4728RangeCommitted(int channel) const { return mcp4728RangeCommitted_[channel].load(); };
+   const ILDACodeConverter& GetMCP4728Converter(int channel) const { return mcp4728Converters_[channel]; };
+
+   //Power-On Defaults (current codes to input registers and EEPROM, verified by readback)
+   int CommitPowerOnDefaults(void);
+
+   //Latest-Value-Wins Tilt Updates
+   //While a tilt token is queued for an axis, newer values overwrite the slot instead of queuing
+   int SubmitTiltUpdate(int client, int axis, unsigned int code, bool neg, unsigned char control, int retries = 1);
+   int SubmitTiltSigned(int client, int axis, unsigned int code, bool neg, unsigned char control, int retries = 1);
+   bool GetTiltCoalescing(void) { return tiltCoalescing_; };
+
+   //Synchronous X/Y Tilt
+   //Both DAC8571 data registers are stored without updating, then latched by one broadcast
+   int SetXY(double xVolts, double yVolts, int client = hubClient);
+   int SubmitTiltXY(int client, const unsigned int codes[dirTotal], const bool neg[dirTotal], int retries = 1);
+   double GetTiltVoltageMax(void);
+   unsigned int TiltVoltageToCode(int axis, double volts, bool& neg);
+   double GetTiltVolts(int axis) { return tiltXY_[axis]; };
+   double GetLaserVoltageMax(int color) const;
+
+   //Batch Encoding (x, y, r, g, b volts to wire-ready frames)
+   void EncodeSamples(const float * const channels[encoderChannelTotal], unsigned int count, ILDAEncodedSample * out);
+   int SubmitEncodedSample(int client, const ILDAEncodedSample& sample, int retries = 1);
+
+   //Batched Scans (ILDAGalvo)
+   //Slices of the scan reach the transport as ExecuteBatch calls, each under the bus lock.
+   //With illuminate set the shutter opens on the first point, closes for every jump onto
+   //one of polygonStarts (indexes into the scan) and closes after the last point.
+   int RunTiltBatch(const double * xVolts, const double * yVolts, int count, double dwellUs, int repetitions, bool illuminate, int client = hubClient,
+      const int * polygonStarts = nullptr, int polygonCount = 0);
+   void StopTiltBatch(void);
+   int SetShutterOutput(bool open, int client = hubClient);
+
+   //Named Presets
+   //Applying one is a single ExecuteBatch: one MCP4728 fast write for R/G/B and the shutter
+   //(multi-writes while a channel's range is not on the chip), one latched X/Y update and
+   //at most one combined GPIO report for the sign pins
+   void DefinePreset(const std::string& name, const ILDAPreset& preset);
+   int SavePreset(const std::string& name);
+   bool DeletePreset(const std::string& name);
+   int ApplyPreset(const std::string& name);
+   //Counts applied presets, so devices know their outputs were moved for them
+   unsigned long GetPresetGeneration(void) const { return presetGeneration_.load(); };
+
+   //Shadow Registers
+   //Set before a write is submitted, invalidated again if that write fails
+   bool ShadowMatches(int reg, unsigned int value);
+   bool GetShadow(int reg, unsigned int& value);
+   bool IsRedundant(int reg, unsigned int value);
+   void SetShadow(int reg, unsigned int value) { shadow_[reg].store( value ); };
+   void InvalidateShadow(unsigned int mask);
+
    //Property Events
    int OnVID(MM::PropertyBase* pProp, MM::ActionType pAct);
    int OnPID(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBridgeSerial(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBridgeIndex(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnDetectionTime(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnDetectionPath(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnStartMode(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnWarmStartSeeded(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnTransport(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnSimLatency(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnSimI2cClock(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnSimOverheadReports(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnSimBusTime(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnSimOutputs(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnMCP4728WriteMode(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnMCP4728Commit(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPowerOnDefaults(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPowerOnDefaultsStatus(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusMode(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnQueueDepth(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusClassStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat);
+   int OnBatchPreempted(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusLatencyStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat);
+   int OnBusLatencyReset(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusTraceFile(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusTraceAction(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusTraceRecords(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnBusTraceStatus(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnReplay(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnReplayOption(MM::PropertyBase* pProp, MM::ActionType pAct, long option);
+   int OnReplayStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat);
+
+   //Batched transfer timing (ILDATransportMonitor, called with busLock_ held)
+   void OnTransfer(const ILDATransportOp& op, double us, int ret);
+   int OnAsyncFailures(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnForceRefresh(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnRedundantSkipped(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnTiltCoalescing(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnTiltCoalesced(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnTiltXY(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnFrameCacheSize(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnFrameCacheStat(MM::PropertyBase* pProp, MM::ActionType pAct, long stat);
+   int OnEncoderBenchmark(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnEncoderThroughput(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPreset(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPresetName(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPresetAction(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPresetDefinition(MM::PropertyBase* pProp, MM::ActionType pAct);
+   int OnPresetFile(MM::PropertyBase* pProp, MM::ActionType pAct);
 
 private:
    void GetPeripheralInventory();
+   int CreateSimulatedProperties();
+   int CreateBusProperties();
+   void ConfigureEncoder();
+   int ReadBackOutputs();
+   void RefreshPresetList();
+   int ReadPresetFile();
+   int WritePresetFile();
+
+   //Bus Command Execution
+   int Submit(const ILDABusCommand& cmd);
+   int Execute(const ILDABusCommand& cmd);
+   int ClassifyCommand(const ILDABusCommand& cmd) const;
+   void RecordWait(const ILDABusCommand& cmd);
+   void YieldToSafety(void);
+   int FlushStaged(int retries, int client);
+   int Transmit(int kind, unsigned char address, const unsigned char * data, int dataLen, int retries);
+   int ExecuteTiltUpdate(int axis);
+   int ExecuteTiltAxis(int axis, unsigned int code, bool neg, unsigned char control, int retries);
+   int ExecuteTiltXY(const ILDABusCommand& cmd);
+   int ExecuteOps(const ILDATransportOp * ops, int count, int retries);
+   void RecordTransfer(bool gpio, unsigned char address, int outcome, double us);
+   int ReadI2c(int dataLen, unsigned char address, unsigned char * data);
+   int ReadGpio(unsigned char * gpio);
+   const ILDACachedPoint * QuantiseScan(const double * xVolts, const double * yVolts, int count);
+   void MarkScanJumps(const ILDACachedPoint * scan, int count, const int * polygonStarts, int polygonCount);
+   bool CompileScan(const ILDACachedPoint * scan, int count, double dwellUs, bool illuminate, unsigned char shutterRangeBits);
+   int BuildTiltXYOps(const unsigned int codes[dirTotal], const bool neg[dirTotal], unsigned int state[shadowTotal], ILDATransportOp * ops);
+   int BuildTiltAxisOps(int axis, unsigned int code, bool neg, unsigned char control, unsigned int state[shadowTotal], ILDATransportOp * ops);
+   void SnapshotShadows(unsigned int state[shadowTotal]);
+   int CommitShadows(const unsigned int before[shadowTotal], const unsigned int after[shadowTotal], bool ok);
+   int RunWorker();
+   void StartWorker();
+   void StopWorker();
+   bool WaitForIdle(double timeoutMs = 0);
+   bool QueuesEmpty();
 
    std::vector<std::string> peripherals_;
    //static MMThreadLock lock_;
@@ -91,6 +397,132 @@ private:
    long vid_;
    long pid_;
    void *handle_;
+
+   //Last Good Bridge (tried before any enumeration, saved with the configuration)
+   std::string bridgeSerial_;
+   long bridgeIndex_;
+   double detectionMs_;
+   std::string detectionPath_;
+
+   //Warm Start (shadows seeded from the hardware instead of assumed)
+   bool warmStart_;
+   long warmStartSeeded_;
+
+   //Bus Backend (owned)
+   ILDATransport* transport_;
+   std::string transportName_;
+   double simReportLatencyUs_;
+   double simI2cClockHz_;
+   long simOverheadReports_;
+
+   //Chip models behind the simulated transport (owned, null on hardware)
+   ILDAMCP4728Model* simMcp4728_;
+   ILDADac8571Model* simTilt_[dirTotal];
+
+   //Last code sent to (or staged for) each MCP4728 channel
+   std::mutex stageLock_;
+   unsigned int mcp4728Codes_[MCP4728_CHANNELS];
+   bool mcp4728Pending_[MCP4728_CHANNELS];
+   bool mcp4728Deferred_;
+   std::string powerOnDefaultsStatus_;
+
+   //Serialised Bus Access
+   static const unsigned int queueCapacity_ = 1024;
+   ILDABusQueue<queueCapacity_> queues_[busPriorityTotal];
+   ILDABusWorker* worker_;
+   MMThreadLock busLock_;
+   std::mutex wakeLock_;
+   std::condition_variable wake_;
+   std::atomic<bool> workerSleeping_;
+   std::atomic<bool> stopWorker_;
+   std::atomic<long> pending_[busClientTotal];
+   std::atomic<long> asyncFailures_;
+   std::atomic<bool> asynchronous_;
+
+   //Per-Class Scheduling State (pending counts cover both bus modes)
+   std::atomic<unsigned int> submitSequence_;
+   unsigned int executedSequence_;
+   std::atomic<long> classPending_[busPriorityTotal];
+   std::atomic<long> classExecuted_[busPriorityTotal];
+   std::atomic<long long> classWaitTotalUs_[busPriorityTotal];
+   std::atomic<long long> classWaitMaxUs_[busPriorityTotal];
+   std::atomic<long> batchPreempted_;
+
+   //Transfer Latency
+   ILDALatencyHistogram busLatency_[busTargetTotal][busOutcomeTotal];
+   bool transferRetrying_;
+   double transferFailedUs_;
+
+   //Bus Trace (client and attempt of the transfers in flight, set with busLock_ held)
+   ILDABusTrace busTrace_;
+   unsigned char traceClient_;
+   unsigned char traceAttempt_;
+   std::string busTraceFile_;
+   std::string busTraceStatus_;
+
+   //Last Replay Of The Trace File (simulated bridge with this hub's latency model)
+   ILDAReplayOptions replayOptions_;
+   ILDAReplayResult replayResult_;
+
+   //Shadow Registers
+   static const unsigned int shadowInvalid_ = 0xFFFFFFFF;
+   std::atomic<unsigned int> shadow_[shadowTotal];
+   std::atomic<long> redundantSkipped_;
+   bool forceRefresh_;
+
+   //Tilt Coalescing Slots (control << 24 | neg << 16 | code)
+   std::atomic<unsigned int> tiltLatest_[dirTotal];
+   std::atomic<int> tiltRetries_[dirTotal];
+   std::atomic<bool> tiltQueued_[dirTotal];
+   std::atomic<long> tiltCoalesced_;
+   bool tiltCoalescing_;
+
+   //Hub-Level DAC8571 Drivers (volts to code for X/Y writes)
+   ILDADac8571* tiltDacs_[dirTotal];
+   double tiltXY_[dirTotal];
+
+   //One scan at a time (the state below is only touched under batchLock_)
+   std::mutex batchLock_;
+   std::atomic<bool> stopBatch_;
+
+   //One slice of ops, reused so that a repeated scan does not reallocate
+   std::vector<ILDATransportOp> batchOps_;
+   //Per scan point, set where the beam jumps onto a new polygon
+   std::vector<unsigned char> batchJump_;
+
+   //Built ops of the last scan (point p's ops are scanOps_[scanOpStart_[p], scanOpStart_[p + 1]))
+   //and what they were built from
+   std::vector<ILDATransportOp> scanOps_;
+   std::vector<unsigned int> scanOpStart_;
+   std::vector<ILDACachedPoint> compiledPoints_;
+   std::vector<unsigned char> compiledJump_;
+   double compiledDwellUs_;
+   bool compiledIlluminate_;
+   unsigned char compiledRangeBits_;
+
+   //Pre-quantised scans
+   ILDAFrameCache frameCache_;
+   std::vector<ILDACachedPoint> uncachedScan_;
+
+   //MCP4728 Channel Ranges (conversion follows the reference/gain of each channel)
+   //Ranges change under stageLock_ and busLock_. A channel is committed once a frame carrying its
+   //current VREF/gain bits has succeeded, and uncommitted again by a range change or failed write.
+   void ApplyMCP4728Range(int channel, int range);
+   void NoteMCP4728Ranges(const unsigned char * data, int dataLen);
+   std::atomic<int> mcp4728Range_[MCP4728_CHANNELS];
+   std::atomic<bool> mcp4728RangeCommitted_[MCP4728_CHANNELS];
+   ILDACodeConverter mcp4728Converters_[MCP4728_CHANNELS];
+
+   //Batch Encoder (tilt tables from tiltDacs_, colour from the laser channel ranges)
+   ILDABatchEncoder encoder_;
+   double encoderThroughput_;
+
+   //Presets (name selected for Save/Delete/Definition, last one applied)
+   std::map<std::string, ILDAPreset> presets_;
+   std::string presetName_;
+   std::string presetApplied_;
+   std::string presetFile_;
+   std::atomic<unsigned long> presetGeneration_;
 };
 
 /*
@@ -123,22 +555,45 @@ class ILDAMCP4271
 		~ILDAMCP4271() {};
 
 	int SetVoltage(long double setVoltage, WriteCmdTypes writeCmd);
+	int SetCode(unsigned int voltageCode, WriteCmdTypes writeCmd);
+
+	//Reference/gain change, rewrites the current voltage (clamped to the new range)
+	int SetRange(int range);
 
 	protected:
+	  //Range limits and conversion table for range (no bus traffic)
+	  void ApplyRange( int range );
+
+	  //Rebuilds the fixed-point table from the current range (Initialize, range changes)
+	  void ConfigureConversion( void) { converter_.Configure( voltageMin_, voltageMax_, resolution_, false ); };
+
+	  //voltage_ follows the chip: set now when synchronous, once the queued write is out otherwise
+	  void CompleteVoltage( unsigned int voltageCode );
+	  long double GetVoltage( void);
+	  bool SyncToPreset( void);
+	  //Latest voltage asked for, whether or not it has reached the chip yet
+	  long double GetRequestedVoltage( void) const { return (voltageQueued_) ? queuedVoltage_ : voltage_; };
 	
 	  //static bool mapSet_;
 	  //Adjust Enum accordingly for new commands, index matches command base
 	  static const char writeCmds_[cmdTypeTotals];
 
+	  ILDACodeConverter converter_;
 	  char addressDacI2C_;
       int writeRetries_;
 	  char addressDACChannel_;
+	  int busClient_;
 	  unsigned long resolution_;
 	  ILDAHub * hub_;
 	  long double voltage_;
 	  long double voltageInc_;
 	  double voltageMax_;
       double voltageMin_;
+	  int range_;
+	  long double queuedVoltage_;
+	  unsigned int queuedCode_;
+	  bool voltageQueued_;
+	  unsigned long presetSeen_;   //hub preset generation voltage_ reflects
 
 };
 
@@ -148,6 +603,8 @@ class ILDADac8571
 	public:
 		enum WriteCmdTypes {
 			dispWrite= 0, //0x10
+			storeWrite,   //0x00 (temporary register only)
+			loadWrite,    //0x20 (update from temporary register)
 
 			cmdTypeTotals
 		};
@@ -155,23 +612,45 @@ class ILDADac8571
 		ILDADac8571(TiltDirection axis, unsigned long resolution );
 		~ILDADac8571() {};
 
+	void SetHub( ILDAHub * hub ) { hub_ = hub; };
+
 	int SetVoltage(long double setVoltage, WriteCmdTypes writeCmd);
 	int NegativeVoltage( bool setNeg );
+	unsigned int VoltageToCode(long double setVoltage, bool& neg);
+	double GetVoltageMax(void) const { return voltageMax_; };
+	const ILDACodeConverter& GetConverter(void) const { return converter_; };
 
 	protected:
+	  //Bipolar: magnitude code plus sign for the inverting switch
+	  void ConfigureConversion( void) { converter_.Configure( voltageMin_, voltageMax_, resolution_, true ); };
+
+	  //voltage_ follows the chip: set now when synchronous, once the queued write is out otherwise
+	  void CompleteVoltage( unsigned int voltageCode, bool neg );
+	  long double GetVoltage( void);
+	  bool SyncToPreset( void);
+	  long double GetRequestedVoltage( void) const { return (voltageQueued_) ? queuedVoltage_ : voltage_; };
 	
 	  //static bool mapSet_;
 	  //Adjust Enum accordingly for new commands, index matches command base
 	  static const char writeCmds_[cmdTypeTotals];
 
+	  ILDACodeConverter converter_;
 	  char addressDacI2C_;
+	  TiltDirection axis_;
       int writeRetries_;
+	  int busClient_;
+	  int shadowReg_;
 	  unsigned long resolution_;
 	  ILDAHub * hub_;
 	  long double voltage_;
 	  long double voltageInc_;
 	  double voltageMax_;
       double voltageMin_;
+	  long double queuedVoltage_;
+	  unsigned int queuedCode_;
+	  bool queuedNeg_;
+	  bool voltageQueued_;
+	  unsigned long presetSeen_;   //hub preset generation voltage_ reflects
 
 };
 
@@ -199,6 +678,9 @@ public:
    int OnState(MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnVoltage(MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnRetries(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnCalibration(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnRange(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnStatePower(MM::PropertyBase* pProp, MM::ActionType eAct);
   // int OnDelay(MM::PropertyBase* pProp, MM::ActionType eAct);
    //int OnRepeatTimedPattern(MM::PropertyBase* pProp, MM::ActionType eAct);
    /*
@@ -226,6 +708,15 @@ private:
    int numPos_;
    bool initialized_;
    bool busy_;
+
+   //Power Calibration (state position -> DAC code, rebuilt whenever the curve changes)
+   void BuildStateCodes( void);
+   void SyncPowerPos( void);
+   double GetStateFraction( long pos ) const { return (numPos_ > 1) ? (double) pos / (numPos_ - 1) : 1.0; };
+
+   ILDAPowerCurve powerCurve_;
+   std::vector<unsigned int> stateCodes_;
+   unsigned long presetState_;   //hub preset generation powerPos_ reflects
 };
 
 class ILDASystemShutter : public CShutterBase<ILDASystemShutter>, ILDABinaryFunctor, ILDAMCP4271
@@ -261,6 +752,8 @@ private:
 
 class ILDABeamTilt : public CSignalIOBase<ILDABeamTilt>, ILDABinaryFunctor, ILDADac8571
 {
+   friend class ILDATiltSequencer;
+
 public:
    ILDABeamTilt(TiltDirection axis, unsigned long resolution);
    ~ILDABeamTilt();
@@ -271,7 +764,7 @@ public:
    int Shutdown();
   
    void GetName(char* pszName) const;
-   bool Busy() {return busy_;}
+   bool Busy();
 
    // DA API
    int SetGateOpen(bool open);
@@ -280,12 +773,20 @@ public:
    int GetSignal(double& volts) {return DEVICE_UNSUPPORTED_COMMAND;}     
    int GetLimits(double& minVolts, double& maxVolts) {minVolts = voltageMin_; maxVolts = voltageMax_; return DEVICE_OK;}
    
-   int IsDASequenceable(bool& isSequenceable) const {isSequenceable = false; return DEVICE_OK;}
+   int IsDASequenceable(bool& isSequenceable) const {isSequenceable = true; return DEVICE_OK;}
+   int GetDASequenceMaxLength(long& nrEvents) const;
+   int StartDASequence();
+   int StopDASequence();
+   int ClearDASequence();
+   int AddToDASequence(double voltage);
+   int SendDASequence();
 
    // action interface
    // ----------------
    int OnVoltage(MM::PropertyBase* pProp, MM::ActionType eAct);
    int OnWindowVoltage(MM::PropertyBase* pProp, MM::ActionType eAct, long isMax);
+   int OnSequenceRate(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnSequenceStat(MM::PropertyBase* pProp, MM::ActionType eAct, long stat);
 
    //Additional Methods
    int ToggleNegative();
@@ -310,6 +811,156 @@ private:
    int addressNeg_;
    bool isNeg_;
    std::string name_;
+
+   //DA Sequencing
+   //Voltages are collected by AddToDASequence and quantised once by SendDASequence,
+   //the playback thread only walks the packed code buffer (bit 16 = negative)
+   int RunSequence();
+   int ReapSequencer();
+   unsigned int PackSequenceCode(double voltage);
+
+   enum SequenceStat {
+      seqPlayed = 0,
+      seqMissed,
+      seqJitterMean,
+      seqJitterMax,
+
+      seqStatTotal
+   };
+
+   std::vector<double> seqVoltages_;
+   std::vector<unsigned int> seqCodes_;
+   double seqRateHz_;
+   ILDATiltSequencer* sequencer_;
+   std::atomic<bool> stopSequence_;
+   //Cleared when RunSequence returns, its result (a failed write) is kept until reported
+   std::atomic<bool> seqRunning_;
+   std::atomic<int> seqResult_;
+
+   //Lateness of each point against its scheduled time
+   std::atomic<long> seqPlayed_;
+   std::atomic<long> seqMissed_;
+   std::atomic<long long> seqJitterSumNs_;
+   std::atomic<long long> seqJitterMaxNs_;
+};
+
+//Point-and-shoot / ROI Galvo Built On The Two Tilt Axes
+//Uses the hub's DAC8571 drivers, so both axes always move together
+class ILDAGalvo : public CGalvoBase<ILDAGalvo>
+{
+public:
+   ILDAGalvo();
+   ~ILDAGalvo();
+
+   // MMDevice API
+   // ------------
+   int Initialize();
+   int Shutdown();
+
+   void GetName(char* pszName) const;
+   bool Busy();
+
+   // Galvo API
+   int PointAndFire(double x, double y, double time_us);
+   int SetSpotInterval(double pulseInterval_us);
+   int SetPosition(double x, double y);
+   int GetPosition(double& x, double& y);
+   int SetIlluminationState(bool on);
+   double GetXRange();
+   double GetXMinimum();
+   double GetYRange();
+   double GetYMinimum();
+   int AddPolygonVertex(int polygonIndex, double x, double y);
+   int DeletePolygons();
+   int RunSequence();
+   int LoadPolygons();
+   int SetPolygonRepetitions(int repetitions);
+   int RunPolygons();
+   int StopSequence();
+   int GetChannel(char* channelName);
+
+   // action interface
+   // ----------------
+   int OnSpotInterval(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPolygonRepetitions(MM::PropertyBase* pProp, MM::ActionType eAct);
+
+private:
+   bool initialized_;
+   std::string name_;
+   ILDAHub* hub_;
+
+   double posX_;
+   double posY_;
+   double spotIntervalUs_;
+   long polygonRepetitions_;
+
+   //Vertices per polygon, flattened into one closed scan by LoadPolygons
+   std::vector< std::vector< std::pair<double, double> > > polygons_;
+   std::vector<double> scanX_;
+   std::vector<double> scanY_;
+   //Scan index of each polygon's first vertex (light is off for the jump onto it)
+   std::vector<int> polygonStarts_;
+};
+
+//ILDA (.ild) File Player
+//Frames are decoded from the mapped file when they come up, batch encoded into DAC frames,
+//then pushed point by point to the tilt DACs and the R/G/B channels of the MCP4728
+class ILDAPlayer : public CGenericBase<ILDAPlayer>
+{
+   friend class ILDAPlayerThread;
+
+public:
+   ILDAPlayer();
+   ~ILDAPlayer();
+
+   // MMDevice API
+   // ------------
+   int Initialize();
+   int Shutdown();
+
+   void GetName(char* pszName) const;
+   bool Busy();
+
+   // action interface
+   // ----------------
+   int OnFile(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPointRate(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnPlayback(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnLoop(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnFrameCount(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnCurrentFrame(MM::PropertyBase* pProp, MM::ActionType eAct);
+   int OnMissedPoints(MM::PropertyBase* pProp, MM::ActionType eAct);
+
+private:
+   int StartPlayback();
+   int StopPlayback();
+   int RunPlayback();
+   int PackFrame(unsigned int frame);
+   int SendPoint(const ILDAEncodedSample& point);
+   int BlankColors();
+
+   bool initialized_;
+   std::string name_;
+   ILDAHub* hub_;
+
+   ILDAFrameReader reader_;
+   std::string path_;
+   double pointRate_;
+   //Can be changed while the file plays
+   std::atomic<bool> loop_;
+
+   //Scratch buffers reused for every frame (volts are structure-of-arrays for the encoder)
+   std::vector<ILDAPoint> points_;
+   std::vector<float> volts_[encoderChannelTotal];
+   std::vector<ILDAEncodedSample> packed_;
+   //Index of each frame's first point in packed_ (when the whole file is encoded up front)
+   std::vector<size_t> frameStarts_;
+
+   ILDAPlayerThread* player_;
+   std::atomic<bool> stopPlayback_;
+   std::atomic<bool> playing_;
+   std::atomic<long> currentFrame_;
+   std::atomic<long> missedPoints_;
 };
 
-#endif //_ILDA_H_
\ No newline at end of file
+#endif //_ILDA_H_
\ No newline at end of file
@@ -0,0 +1,161 @@
+//Chip Model Test
+//Sends the frames the adapter builds (MCP4728 single, fast, sequential and select writes,
+//DAC8571 direct, store and broadcast load) over ILDASimulatedTransport with the models
+//attached, and checks the outputs, the time each one moved, the EEPROM busy window,
+//unmodelled addresses and the output history ring.
+//Builds without the MCP2221 DLL:  make -C Tests models
+#include "../ILDAChipModels.h"
+#include <cstdio>
+#include <cmath>
+
+//Same constants as MyLaser.cpp
+const unsigned char g_McpAddress = 0x61;
+const unsigned char g_McpSingleWrite = 0x41;       //a multi write with UDAC set, input register only
+const unsigned char g_McpSequentialWrite = 0x50;
+const unsigned char g_McpEepromWrite = 0x58;       //the chip's own single write, input register and EEPROM
+const unsigned char g_LaserSwitchAddress = 0x23;
+const unsigned char g_TiltAddresses[2] = { 0x4E, 0x4C };
+const unsigned char g_TiltBroadcast = 0x48;
+const unsigned char g_TiltDispWrite = 0x10;
+const unsigned char g_TiltStore = 0x00;
+const unsigned char g_TiltLoad = 0x20;
+const unsigned char g_TiltBroadcastData = 0x04;   //BRCSEL
+const double g_TiltFullScale = 10;
+
+static int g_Failures = 0;
+
+static void Check( bool ok, const char * what )
+{
+	if( !ok )
+	{
+		printf( "FAIL %s\n", what );
+		g_Failures++;
+	}
+}
+
+static bool Near( double a, double b )
+{
+	return fabs( a - b ) < 1e-9;
+}
+
+static int Send( ILDASimulatedTransport& bus, unsigned char address, unsigned char b0, unsigned char b1, unsigned char b2 )
+{
+	unsigned char data[3] = { b0, b1, b2 };
+	return bus.I2cWrite( 3, address, true, data );
+}
+
+static void CheckMcp4728( void)
+{
+	ILDASimulatedTransport bus( 125, 400000, 1 );
+	bus.SetRealTime( false );
+	ILDAMCP4728Model mcp( g_McpAddress, 5.0, 50000 );
+	bus.AttachDevice( &mcp );
+
+	//Single write to channel B (VDD reference): the output moves on the ACK of the last byte
+	mcp.ClearHistory();
+	Check( Send( bus, g_McpAddress, g_McpSingleWrite | (1 << 1), 0x08, 0x00 ) == 0, "single write acknowledged" );
+	Check( mcp.GetCode( 1 ) == 0x800 && Near( mcp.GetOutput( 1 ), 2.5 ), "single write output" );
+	Check( mcp.GetHistory().GetCount() == 1 && Near( mcp.GetHistory().GetEvent( 0 ).timeUs, bus.GetSimulatedTime() ),
+		"single write logged at the last ACK" );
+	Check( mcp.GetEepromCode( 1 ) == 0, "single write leaves the EEPROM" );
+
+	//An EEPROM write programs it too, new writes are NACKed until it is done
+	Check( Send( bus, g_McpAddress, g_McpEepromWrite | (1 << 1), 0x08, 0x00 ) == 0, "EEPROM write acknowledged" );
+	Check( mcp.GetEepromCode( 1 ) == 0x800, "EEPROM write" );
+	Check( Send( bus, g_McpAddress, g_McpSingleWrite, 0x01, 0x00 ) != 0, "write NACKed while the EEPROM is busy" );
+	bus.Delay( 50000 );
+	Check( Send( bus, g_McpAddress, g_McpSingleWrite, 0x01, 0x00 ) == 0, "write acknowledged once the EEPROM is done" );
+
+	//Fast write of all four channels, each moving two bytes after the last
+	unsigned char fast[8] = { 0x04, 0x00, 0x02, 0x00, 0x03, 0x00, 0x0F, 0xFF };
+	mcp.ClearHistory();
+	Check( bus.I2cWrite( 8, g_McpAddress, true, fast ) == 0, "fast write acknowledged" );
+	Check( mcp.GetCode( 0 ) == 0x400 && mcp.GetCode( 1 ) == 0x200 && mcp.GetCode( 2 ) == 0x300 && mcp.GetCode( 3 ) == 0xFFF,
+		"fast write codes" );
+	const ILDAOutputHistory& history = mcp.GetHistory();
+	Check( history.GetCount() == 4, "fast write events" );
+	for( unsigned long i = 1; i < history.GetCount(); i++ )
+	{
+		Check( Near( history.GetEvent( i ).timeUs - history.GetEvent( i - 1 ).timeUs, 2 * 9 * 1e6 / 400000 ), "fast write spacing" );
+	}
+
+	//Internal reference and gain on channel A: 0x400 of 4.096 V
+	unsigned char select[2] = { 0x80 | 0x08, 0xC0 | 0x08 };
+	Check( bus.I2cWrite( 2, g_McpAddress, true, select ) == 0, "select acknowledged" );
+	Check( Near( mcp.GetOutput( 0 ), 4.096 * 0x400 / 4096 ), "VREF and gain select" );
+
+	//Sequential write from A sets the EEPROM too, a reset reloads it
+	unsigned char sequential[9] = { g_McpSequentialWrite, 0x00, 0x10, 0x00, 0x20, 0x00, 0x30, 0x00, 0x40 };
+	Check( bus.I2cWrite( 9, g_McpAddress, true, sequential ) == 0, "sequential write acknowledged" );
+	bus.Delay( 50000 );
+	Check( Send( bus, g_McpAddress, g_McpEepromWrite, 0x0F, 0xFF ) == 0, "EEPROM write after the sequential write" );
+	bus.Delay( 50000 );
+	unsigned char reset = 0x06;
+	Check( bus.I2cWrite( 1, 0x00, true, &reset ) == 0, "general call reset" );
+	Check( mcp.GetCode( 0 ) == 0xFFF && mcp.GetCode( 3 ) == 0x40, "reset reloads the EEPROM" );
+
+	//Readback: status, input register, status, EEPROM per channel
+	unsigned char image[24];
+	Check( bus.I2cRead( 24, g_McpAddress, true, image ) == 0, "readback" );
+	Check( (image[0] & 0x80) && image[1] == 0x0F && image[2] == 0xFF && image[22] == 0x00 && image[23] == 0x40, "readback image" );
+
+	//The laser switch has no model and is still written and read
+	unsigned char laser = 0x01;
+	Check( bus.I2cWrite( 1, g_LaserSwitchAddress, true, &laser ) == 0, "unmodelled address written" );
+	Check( bus.I2cRead( 1, g_LaserSwitchAddress, true, &laser ) == 0, "unmodelled address read" );
+}
+
+static void CheckDac8571( void)
+{
+	ILDASimulatedTransport bus( 125, 400000, 1 );
+	bus.SetRealTime( false );
+	ILDADac8571Model x( g_TiltAddresses[0], g_TiltBroadcast, g_TiltFullScale );
+	ILDADac8571Model y( g_TiltAddresses[1], g_TiltBroadcast, g_TiltFullScale );
+	bus.AttachDevice( &x );
+	bus.AttachDevice( &y );
+
+	//Direct load
+	Check( Send( bus, g_TiltAddresses[0], g_TiltDispWrite, 0x80, 0x00 ) == 0, "DAC8571 write acknowledged" );
+	Check( x.GetCode() == 0x8000 && Near( x.GetOutput(), 5.0 ) && y.GetCode() == 0, "DAC8571 direct load" );
+
+	//Store to both, then one broadcast load moves them together
+	Check( Send( bus, g_TiltAddresses[0], g_TiltStore, 0x40, 0x00 ) == 0, "X store" );
+	Check( Send( bus, g_TiltAddresses[1], g_TiltStore, 0x20, 0x00 ) == 0, "Y store" );
+	Check( x.GetCode() == 0x8000 && y.GetCode() == 0 && x.GetTemporary() == 0x4000, "store leaves the outputs" );
+	x.ClearHistory();
+	y.ClearHistory();
+	Check( Send( bus, g_TiltBroadcast, g_TiltLoad, 0x00, 0x00 ) == 0, "broadcast load" );
+	Check( x.GetCode() == 0x4000 && y.GetCode() == 0x2000, "broadcast load from the temporary registers" );
+	Check( x.GetHistory().GetCount() == 1 && y.GetHistory().GetCount() == 1 &&
+		Near( x.GetHistory().GetEvent( 0 ).timeUs, y.GetHistory().GetEvent( 0 ).timeUs ), "broadcast outputs move together" );
+
+	//BRCSEL 0 loads the temporary registers whatever the load bits say, BRCSEL 1 takes the data
+	Check( Send( bus, g_TiltAddresses[0], g_TiltStore, 0x11, 0x11 ) == 0, "X store" );
+	Check( Send( bus, g_TiltBroadcast, g_TiltDispWrite, 0x77, 0x77 ) == 0, "broadcast without BRCSEL" );
+	Check( x.GetCode() == 0x1111 && y.GetCode() == 0x2000, "broadcast without BRCSEL ignores the data" );
+	Check( Send( bus, g_TiltBroadcast, g_TiltBroadcastData, 0x12, 0x34 ) == 0, "broadcast with BRCSEL" );
+	Check( x.GetCode() == 0x1234 && y.GetCode() == 0x1234, "broadcast with BRCSEL loads the data" );
+}
+
+static void CheckHistoryRing( void)
+{
+	ILDAOutputHistory history;
+	const unsigned long extra = 10;
+	for( unsigned long i = 0; i < ILDA_MODEL_HISTORY_MAX + extra; i++ )
+	{
+		history.Add( (double) i, 0, 0 );
+	}
+	Check( history.GetCount() == ILDA_MODEL_HISTORY_MAX && history.GetTotal() == ILDA_MODEL_HISTORY_MAX + extra, "history count" );
+	Check( history.GetEvent( 0 ).timeUs == extra && history.GetEvent( ILDA_MODEL_HISTORY_MAX - 1 ).timeUs == ILDA_MODEL_HISTORY_MAX + extra - 1,
+		"history keeps the newest, oldest first" );
+}
+
+int main()
+{
+	CheckMcp4728();
+	CheckDac8571();
+	CheckHistoryRing();
+
+	printf( "%s\n", (g_Failures) ? "FAIL" : "ok" );
+	return (g_Failures) ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+//Round Trip Test For ILDACodeConverter
+//Every code of every channel configuration the adapter uses goes to volts (ToVolts) and back
+//(ToCode and ToCodes) and has to come back unchanged; a quarter increment below it has to
+//truncate to the code below. Builds without the MCP2221 DLL:  make -C Tests converter
+#include "../ILDACodeConverter.h"
+#include <cstdio>
+#include <vector>
+
+struct ConverterCase
+{
+	const char * name;
+	double voltageMin;
+	double voltageMax;
+	unsigned long resolution;
+	bool bipolar;
+};
+
+//MCP4728 ranges (VDD, internal 2.048 V, internal 4.096 V) and DAC8571 tilt ranges
+const ConverterCase g_Cases[] = {
+	{ "MCP4728 5 V", 0, 5, 4096, false },
+	{ "MCP4728 2.048 V", 0, 2.048, 4096, false },
+	{ "MCP4728 4.096 V", 0, 4.096, 4096, false },
+	{ "DAC8571 5 V", 0, 5, 65536, true },
+	{ "DAC8571 10 V", 0, 10, 65536, true },
+	{ "Offset 1-3 V", 1, 3, 4096, false },
+};
+
+static int CheckCase( const ConverterCase& test )
+{
+	ILDACodeConverter converter;
+	converter.Configure( test.voltageMin, test.voltageMax, test.resolution, test.bipolar );
+
+	int failures = 0;
+	const unsigned int maxCode = converter.GetMaxCode();
+	std::vector<double> volts( maxCode + 1 );
+	std::vector<unsigned short> codes( maxCode + 1 );
+	for( unsigned int k = 0; k <= maxCode; k++ )
+	{
+		for( int sign = 0; sign < ((test.bipolar) ? 2 : 1); sign++ )
+		{
+			bool neg = sign != 0;
+			double v = converter.ToVolts( k, neg );
+			bool backNeg;
+			unsigned int back = converter.ToCode( v, backNeg );
+			if( back != k || (k > 0 && backNeg != neg) )
+			{
+				if( failures++ < 5 )
+				{
+					printf( "%s: %.9f V -> %u, expected %u\n", test.name, v, back, k );
+				}
+			}
+
+			if( k > 0 )
+			{
+				double below = (neg) ? v + converter.GetIncrement() / 4 : v - converter.GetIncrement() / 4;
+				unsigned int truncated = converter.ToCode( below );
+				if( truncated != k - 1 )
+				{
+					if( failures++ < 5 )
+					{
+						printf( "%s: %.9f V -> %u, expected %u\n", test.name, below, truncated, k - 1 );
+					}
+				}
+			}
+		}
+		volts[k] = converter.ToVolts( k );
+	}
+
+	converter.ToCodes( &volts[0], maxCode + 1, &codes[0] );
+	for( unsigned int k = 0; k <= maxCode; k++ )
+	{
+		if( codes[k] != k && failures++ < 5 )
+		{
+			printf( "%s: ToCodes %.9f V -> %u, expected %u\n", test.name, volts[k], codes[k], k );
+		}
+	}
+
+	//Saturation at both ends (a bipolar channel saturates on the magnitude)
+	if( converter.ToCode( test.voltageMax * 2 ) != maxCode || (test.bipolar && converter.ToCode( -test.voltageMax * 2 ) != maxCode) ||
+		(!test.bipolar && converter.ToCode( test.voltageMin - 1 ) != 0) )
+	{
+		printf( "%s: saturation\n", test.name );
+		failures++;
+	}
+
+	printf( "%-18s %6u codes  %s\n", test.name, maxCode + 1, (failures) ? "FAIL" : "ok" );
+	return failures;
+}
+
+int main()
+{
+	int failures = 0;
+	for( size_t i = 0; i < sizeof(g_Cases) / sizeof(g_Cases[0]); i++ )
+	{
+		failures += CheckCase( g_Cases[i] );
+	}
+
+	printf( "%s\n", (failures) ? "FAIL" : "ok" );
+	return (failures) ? 1 : 0;
+}
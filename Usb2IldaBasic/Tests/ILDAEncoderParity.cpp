@@ -0,0 +1,129 @@
+//Parity Test For ILDABatchEncoder
+//Batch encodes random and code-exact waveforms over the channel ranges the hub configures and
+//checks every sample against ILDACodeConverter::ToCode, bit for bit (codes, payload bytes and
+//sign bits). Build it with -mavx2 as well to cover the 8 wide path:  make -C Tests encoder
+#include "../ILDABatchEncoder.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+const unsigned char g_TiltDispWrite = 0x10;
+const unsigned int g_Samples = 262147;   //not a multiple of the vector width, the tail runs too
+
+struct EncoderCase
+{
+	const char * name;
+	double tiltVolts;
+	double colorVolts[ILDA_ENCODER_COLOR_CHANNELS];
+};
+
+//DAC8571 tilt (bipolar, 16 bit) and MCP4728 colour ranges (VDD, 2.048 V, 4.096 V)
+const EncoderCase g_Cases[] = {
+	{ "10 V tilt, 5 V colour", 10, { 5, 5, 5 } },
+	{ "5 V tilt, mixed colour", 5, { 5, 2.048, 4.096 } },
+	{ "10 V tilt, 2.048 V colour", 10, { 2.048, 2.048, 2.048 } },
+};
+
+static double Random( double span )
+{
+	return span * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+static int CheckCase( const EncoderCase& test )
+{
+	ILDACodeConverter converters[encoderChannelTotal];
+	const ILDACodeConverter * table[encoderChannelTotal];
+	for( int c = 0; c < encoderChannelTotal; c++ )
+	{
+		bool tilt = c < ILDA_ENCODER_TILT_CHANNELS;
+		converters[c].Configure( 0, (tilt) ? test.tiltVolts : test.colorVolts[c - encoderRed], (tilt) ? 65536 : 4096, tilt );
+		table[c] = &converters[c];
+	}
+
+	ILDABatchEncoder encoder;
+	encoder.Configure( table, g_TiltDispWrite );
+
+	//Random volts past both ends, then every code's own voltage (and one float step either side)
+	std::vector<float> waveform( g_Samples * encoderChannelTotal );
+	const float * channels[encoderChannelTotal];
+	for( int c = 0; c < encoderChannelTotal; c++ )
+	{
+		channels[c] = &waveform[c * g_Samples];
+		double span = converters[c].GetVoltageMin() + (converters[c].GetMaxCode() + 1) * converters[c].GetIncrement();
+		for( unsigned int i = 0; i < g_Samples; i++ )
+		{
+			float v;
+			if( i % 2 == 0 )
+			{
+				v = (float) Random( span * 1.2 );
+			}
+			else
+			{
+				unsigned int code = (i / 2) % (converters[c].GetMaxCode() + 1);
+				v = (float) converters[c].ToVolts( code, converters[c].IsBipolar() && (i & 4) );
+				v = (i % 3 == 0) ? v : v * (1.0f + ((i % 3 == 1) ? 6e-8f : -6e-8f));
+			}
+			waveform[c * g_Samples + i] = v;
+		}
+	}
+
+	std::vector<ILDAEncodedSample> encoded( g_Samples );
+	encoder.Encode( channels, g_Samples, &encoded[0] );
+
+	int failures = 0;
+	for( unsigned int i = 0; i < g_Samples; i++ )
+	{
+		unsigned char signs = 0;
+		for( int c = 0; c < encoderChannelTotal; c++ )
+		{
+			bool neg;
+			unsigned int expected = converters[c].ToCode( (double) channels[c][i], neg );
+			unsigned int got;
+			if( c < ILDA_ENCODER_TILT_CHANNELS )
+			{
+				got = ((unsigned int) encoded[i].tilt[c][1] << 8) | encoded[i].tilt[c][2];
+				if( encoded[i].tilt[c][0] != g_TiltDispWrite )
+				{
+					got = ~0u;
+				}
+				if( neg && expected != 0 )
+				{
+					signs |= (unsigned char) (1 << c);
+				}
+			}
+			else
+			{
+				int color = c - encoderRed;
+				got = ((unsigned int) encoded[i].color[color * 2] << 8) | encoded[i].color[color * 2 + 1];
+			}
+
+			if( got != expected && failures++ < 5 )
+			{
+				printf( "%s: sample %u channel %d %.9f V -> %u, expected %u\n", test.name, i, c, channels[c][i], got, expected );
+			}
+		}
+
+		if( encoded[i].signs != signs && failures++ < 5 )
+		{
+			printf( "%s: sample %u signs %u, expected %u\n", test.name, i, encoded[i].signs, signs );
+		}
+	}
+
+	printf( "%-28s %u samples  %s\n", test.name, g_Samples, (failures) ? "FAIL" : "ok" );
+	return failures;
+}
+
+int main()
+{
+	srand( 1 );
+	printf( "Instruction set: %s\n", ILDABatchEncoder::GetInstructionSet() );
+
+	int failures = 0;
+	for( size_t i = 0; i < sizeof(g_Cases) / sizeof(g_Cases[0]); i++ )
+	{
+		failures += CheckCase( g_Cases[i] );
+	}
+
+	printf( "%s\n", (failures) ? "FAIL" : "ok" );
+	return (failures) ? 1 : 0;
+}
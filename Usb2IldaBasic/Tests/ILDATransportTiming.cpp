@@ -0,0 +1,138 @@
+//Timing Harness For The DAC Write Paths
+//Replays the frames ILDAMCP4271::SetCode and ILDADac8571/ILDABeamTilt::SetSignal hand to
+//the transport over ILDASimulatedTransport, in simulated time (checked against the model)
+//and in real time (wall clock, shows the cost of the host side on top of the model).
+//Builds without the MCP2221 DLL:  make -C Tests timing
+#include "../ILDATransport.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+//Same constants as MyLaser.cpp
+const unsigned char g_McpAddress = 0x61;
+const unsigned char g_McpSingleWrite = 0x41;
+const unsigned char g_TiltXAddress = 0x4E;
+const unsigned char g_TiltDispWrite = 0x10;
+const int g_TiltXNegPin = 3;
+
+enum WritePath {
+	laserSingleWrite = 0,
+	tiltMagnitude,
+	tiltSignedFlip,
+
+	writePathTotal
+};
+
+const char * g_PathNames[writePathTotal] = { "MCP4728 single write", "DAC8571 magnitude", "DAC8571 sign flip" };
+
+//Sends one call's worth of frames, code varies so nothing is repeated
+static int SendPath( ILDATransport& bus, int path, unsigned int code )
+{
+	unsigned char data[3];
+	unsigned char gpio[MCP2221_GPIO_TOTAL];
+	int ret;
+	switch( path )
+	{
+	  case laserSingleWrite:
+		data[0] = g_McpSingleWrite;
+		data[1] = (code >> 8) & 0x0F;
+		data[2] = code & 0xFF;
+		return bus.I2cWrite( 3, g_McpAddress, true, data );
+	  case tiltMagnitude:
+		data[0] = g_TiltDispWrite;
+		data[1] = (code >> 8) & 0xFF;
+		data[2] = code & 0xFF;
+		return bus.I2cWrite( 3, g_TiltXAddress, true, data );
+	  case tiltSignedFlip:
+		//Zero, switch, magnitude
+		data[0] = g_TiltDispWrite;
+		data[1] = 0;
+		data[2] = 0;
+		ret = bus.I2cWrite( 3, g_TiltXAddress, true, data );
+		if( ret != 0 )
+		{
+			return ret;
+		}
+		memset( gpio, 0xFF, sizeof(gpio) );
+		gpio[g_TiltXNegPin] = code & 1;
+		ret = bus.SetGpioValues( gpio );
+		if( ret != 0 )
+		{
+			return ret;
+		}
+		data[1] = (code >> 8) & 0xFF;
+		data[2] = code & 0xFF;
+		return bus.I2cWrite( 3, g_TiltXAddress, true, data );
+	}
+	return -1;
+}
+
+//Modelled cost of one call: reports * latency + (address + data bytes) * 9 bits / clock
+static double ExpectedUs( int path, double latencyUs, double clockHz, unsigned int overhead )
+{
+	double frameUs = (overhead + 1) * latencyUs + 4 * 9 * 1e6 / clockHz;
+	return (path == tiltSignedFlip) ? 2 * frameUs + latencyUs : frameUs;
+}
+
+int main( int argc, char ** argv )
+{
+	const int calls = (argc > 1) ? atoi( argv[1] ) : 200;
+	const double latencies[] = { 125, 1000 };
+	const double clocks[] = { 100000, 400000 };
+	const unsigned int overheads[] = { 0, 1, 2 };
+	int failures = 0;
+
+	printf( "%-22s %9s %9s %4s %12s %12s %12s\n", "path", "lat(us)", "clk(Hz)", "ovh", "model(us)", "sim(us)", "wall(us)" );
+	for( int path = 0; path < writePathTotal; path++ )
+	{
+		for( size_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]); l++ )
+		{
+			for( size_t c = 0; c < sizeof(clocks) / sizeof(clocks[0]); c++ )
+			{
+				for( size_t o = 0; o < sizeof(overheads) / sizeof(overheads[0]); o++ )
+				{
+					//Simulated time
+					ILDASimulatedTransport sim( latencies[l], clocks[c], overheads[o] );
+					sim.SetRealTime( false );
+					for( int i = 0; i < calls; i++ )
+					{
+						failures += (SendPath( sim, path, (unsigned int) i * 7 ) != 0);
+					}
+					double simUs = sim.GetSimulatedTime() / calls;
+					double modelUs = ExpectedUs( path, latencies[l], clocks[c], overheads[o] );
+					if( simUs < modelUs - 1e-6 || simUs > modelUs + 1e-6 )
+					{
+						printf( "FAIL %s: simulated %.3f us, model %.3f us\n", g_PathNames[path], simUs, modelUs );
+						failures++;
+					}
+
+					//Real time (only the cheapest model, the rest would take minutes)
+					double wallUs = 0;
+					if( l == 0 && c == sizeof(clocks) / sizeof(clocks[0]) - 1 )
+					{
+						ILDASimulatedTransport real( latencies[l], clocks[c], overheads[o] );
+						const int realCalls = (calls < 50) ? calls : 50;
+						std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+						for( int i = 0; i < realCalls; i++ )
+						{
+							failures += (SendPath( real, path, (unsigned int) i * 7 ) != 0);
+						}
+						wallUs = std::chrono::duration<double, std::micro>( std::chrono::steady_clock::now() - start ).count() / realCalls;
+						if( wallUs < real.GetSimulatedTime() / realCalls )
+						{
+							printf( "FAIL %s: real time run finished early\n", g_PathNames[path] );
+							failures++;
+						}
+					}
+
+					printf( "%-22s %9.0f %9.0f %4u %12.2f %12.2f %12.2f\n", g_PathNames[path], latencies[l], clocks[c],
+						overheads[o], modelUs, simUs, wallUs );
+				}
+			}
+		}
+	}
+
+	printf( (failures) ? "%d failures\n" : "ok\n", failures );
+	return (failures) ? 1 : 0;
+}
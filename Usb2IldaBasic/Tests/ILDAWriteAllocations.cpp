@@ -0,0 +1,185 @@
+//Allocation Test For The Write Paths
+//Global operator new is replaced by a counting one. The frames ILDAMCP4271::SetVoltage and
+//ILDABeamTilt::SetSignal produce go from volts to codes (ILDACodeConverter) and through
+//ExecuteBatch over ILDASimulatedTransport, with a monitor that records them the way
+//ILDAHub::OnTransfer does (bus trace ring and latency histogram). Once everything is
+//constructed, no call may allocate.
+//Only the transport, conversion, trace and histogram layers are the real code. The hub
+//(Submit, Execute, the shadow registers and the bus queue) builds with MSVC only, so the
+//frames are put together here by stand-ins for SetVoltage and SetSignal and the hub's own
+//paths are not covered.  Builds without the MCP2221 DLL:  make -C Tests alloc
+#include "../ILDATransport.h"
+#include "../ILDACodeConverter.h"
+#include "../ILDABusTrace.h"
+#include "../ILDALatencyHistogram.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+static unsigned long g_Allocations = 0;
+
+void * operator new( std::size_t size )
+{
+	g_Allocations++;
+	void * p = malloc( (size) ? size : 1 );
+	if( !p )
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void * operator new[]( std::size_t size )
+{
+	return operator new( size );
+}
+
+void operator delete( void * p ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void * p ) noexcept
+{
+	free( p );
+}
+
+void operator delete( void * p, std::size_t ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void * p, std::size_t ) noexcept
+{
+	free( p );
+}
+
+//Same constants as MyLaser.cpp
+const unsigned char g_McpAddress = 0x61;
+const unsigned char g_McpSingleWrite = 0x41;      //a multi write with UDAC set
+const unsigned char g_McpInternal2x = 0x90;       //VREF and gain bits of the 4.096 V range
+const int g_LaserChannel = 0;
+const unsigned char g_TiltXAddress = 0x4E;
+const unsigned char g_TiltDispWrite = 0x10;
+const int g_TiltXNegPin = 3;
+const int g_Calls = 10000;
+
+//Frames handed to the transport, for checking the trace
+static unsigned long g_Transfers = 0;
+
+//Stands in for ILDAHub::OnTransfer
+class WriteMonitor : public ILDATransportMonitor
+{
+	public:
+		WriteMonitor( ILDATransport& bus ) : bus_(bus) {};
+
+	void OnTransfer( const ILDATransportOp& op, double us, int ret )
+	{
+		bool gpio = op.kind == ILDATransportOp::gpioWrite;
+		trace_.Record( bus_.GetClockUs() - us, us, ret, (unsigned char) ((gpio) ? traceGpioWrite : traceI2cWrite), 0,
+			op.address, op.data, (gpio) ? MCP2221_GPIO_TOTAL : op.dataLen, 0 );
+		latency_[(gpio) ? 1 : 0].Record( us );
+	};
+
+	ILDABusTrace trace_;
+	ILDALatencyHistogram latency_[2];
+
+	protected:
+	  ILDATransport& bus_;
+};
+
+static void I2cOp( ILDATransportOp& op, unsigned char address, unsigned char command, unsigned int code )
+{
+	op.kind = ILDATransportOp::i2cWrite;
+	op.address = address;
+	op.dataLen = 3;
+	op.data[0] = command;
+	op.data[1] = (unsigned char) (code >> 8);
+	op.data[2] = (unsigned char) (code & 0xFF);
+	op.delayUs = 0;
+}
+
+//ILDAMCP4271::SetVoltage: one multi-write block for the channel, carrying its range
+//(ILDAHub::WriteMCP4728Channel and MCP4728UpperByte)
+static int SetVoltage( ILDATransport& bus, const ILDACodeConverter& converter, double volts )
+{
+	ILDATransportOp op;
+	I2cOp( op, g_McpAddress, (unsigned char) (g_McpSingleWrite | (g_LaserChannel << 1)),
+		((unsigned int) g_McpInternal2x << 8) | (converter.ToCode( volts ) & 0x0FFF) );
+	g_Transfers++;
+	return bus.ExecuteBatch( &op, 1 );
+}
+
+//ILDABeamTilt::SetSignal: magnitude, or zero, sign switch and magnitude when the sign flips
+static int SetSignal( ILDATransport& bus, const ILDACodeConverter& converter, double volts, bool& wasNeg )
+{
+	ILDATransportOp ops[3];
+	bool neg;
+	unsigned int code = converter.ToCode( volts, neg );
+	int count = 0;
+	if( neg != wasNeg )
+	{
+		I2cOp( ops[count++], g_TiltXAddress, g_TiltDispWrite, 0 );
+		ILDATransportOp& gpio = ops[count++];
+		gpio.kind = ILDATransportOp::gpioWrite;
+		gpio.address = 0;
+		gpio.dataLen = MCP2221_GPIO_TOTAL;
+		memset( gpio.data, 0xFF, sizeof(gpio.data) );
+		gpio.data[g_TiltXNegPin] = (neg) ? 1 : 0;
+		gpio.delayUs = 0;
+		wasNeg = neg;
+	}
+	I2cOp( ops[count++], g_TiltXAddress, g_TiltDispWrite, code );
+	g_Transfers += count;
+	return bus.ExecuteBatch( ops, count );
+}
+
+int main()
+{
+	ILDASimulatedTransport sim( 125, 400000, 1 );
+	sim.SetRealTime( false );
+	WriteMonitor monitor( sim );
+	sim.SetMonitor( &monitor );
+
+	ILDACodeConverter laser, tilt;
+	laser.Configure( 0, 4.096, 4096, false );
+	tilt.Configure( 0, 10, 65536, true );
+
+	//The trace ring was allocated above, so a zero count here means the counter is not in use
+	int failures = 0;
+	if( g_Allocations == 0 )
+	{
+		printf( "FAIL operator new is not being counted\n" );
+		failures++;
+	}
+	bool wasNeg = false;
+
+	//Laser voltage
+	unsigned long before = g_Allocations;
+	for( int i = 0; i < g_Calls; i++ )
+	{
+		failures += (SetVoltage( sim, laser, 4.096 * i / g_Calls ) != 0);
+	}
+	unsigned long laserAllocations = g_Allocations - before;
+	printf( "%-24s %6d calls %6lu allocations\n", "MCP4728 SetVoltage", g_Calls, laserAllocations );
+
+	//Tilt signal, the sign flipping on every call after the first
+	before = g_Allocations;
+	for( int i = 0; i < g_Calls; i++ )
+	{
+		failures += (SetSignal( sim, tilt, ((i & 1) ? -10.0 : 10.0) * i / g_Calls, wasNeg ) != 0);
+	}
+	unsigned long tiltAllocations = g_Allocations - before;
+	printf( "%-24s %6d calls %6lu allocations\n", "DAC8571 SetSignal", g_Calls, tiltAllocations );
+
+	if( monitor.trace_.GetTotal() != g_Transfers )
+	{
+		printf( "FAIL trace recorded %lu transfers, expected %lu\n", monitor.trace_.GetTotal(), g_Transfers );
+		failures++;
+	}
+
+	failures += (laserAllocations != 0) + (tiltAllocations != 0);
+	printf( "%s\n", (failures) ? "FAIL" : "ok" );
+	return (failures) ? 1 : 0;
+}